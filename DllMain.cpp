@@ -10,20 +10,34 @@
 
 #include "wcx_pdf.h"
 #include "resource.h"
+#include "./libs/zlib/cpu_features.h"           // cpu_check_features()
 
 #ifdef _MSC_VER
 #include <crtdbg.h>
 #endif
 
-int WINAPI DllMain(HINSTANCE hInstDll, DWORD fdwReason, LPVOID /* lpvReserved */)
+int WINAPI DllMain(HINSTANCE hInstDll, DWORD fdwReason, LPVOID lpvReserved)
 {
     switch(fdwReason)
     {
         case DLL_PROCESS_ATTACH:
             InitInstance(hInstDll);
+#ifdef X86_SIMD_SSSE3
+            // Detect the SIMD instruction sets before any thread decodes or scans
+            cpu_check_features();
+#endif
+            break;
+
+        case DLL_THREAD_DETACH:
+            TPdfScratch::ReleaseThisThread();
             break;
 
         case DLL_PROCESS_DETACH:
+
+            // When the plugin is unloaded, close the kept databases. When the process exits,
+            // the other threads are already gone and the system frees everything
+            if(lpvReserved == NULL)
+                TPdfDatabase::Shutdown();
 #ifdef _DEBUG
             _CrtDumpMemoryLeaks();
 #endif  // _MSC_VER
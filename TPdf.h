@@ -15,8 +15,47 @@
 // Defines
 
 #define PDF_MAGIC_SIGNATURE     0x434947414D464450 // "PDFMAGIC"
+#define PDF_ARCHIVE_SIGNATURE   0x4C444E4148464450 // "PDFHANDL"
 #define PDF_PVOID_TRUE          ((TPdfDatabase *)(INT_PTR)(1))
 #define PDF_MAX_FILTERS         8
+#define PDF_MAX_XREF_SECTIONS   0x400       // Max number of xref sections chained by /Prev
+#define PDF_MAX_RESOLVE_DEPTH   4           // Max nesting of indirect references being resolved
+#define PDF_MIN_SCAN_CHUNK      0x100000    // Min size of the file chunk scanned by one thread
+#define PDF_DECODE_BATCH_SIZE   0x10000     // Small streams are decoded in batches of about this weight
+#define PDF_MAX_NESTING         0x20        // Max nesting of arrays and dictionaries in object parameters
+#define PDF_ZLIB_CHUNK_SIZE     0x40000000  // zlib counts the buffer sizes in 32-bit integers, so big streams go in chunks
+#define PDF_PARALLEL_INFLATE    0x1000000   // Min raw size of a Flate stream decoded by more threads
+#define PDF_FILTER_WINDOW       0x10000     // Size of the buffer between two stages of the filter chain
+#define PDF_ARENA_BLOCK_SIZE    0x10000     // Size of one block of the arena allocator of the database
+#define PDF_ARENA_MAX_STREAM    0x400       // Decoded streams up to this size are moved to the arena
+#define PDF_DICT_INLINE_ENTRIES 8           // Number of dictionary entries stored without allocation
+#define PDF_SCRATCH_MAX_BUFFER  0x100000    // Output buffers up to this size stay in the scratch pool of the thread
+#define PDF_SCRATCH_MAX_SPARES  0x10        // Max number of scratch pools kept after their threads have ended
+#define PDF_VIRTUAL_THRESHOLD   0x1000000   // Buffers from this size grow in reserved virtual memory, so they are never copied
+#ifdef _WIN64
+#define PDF_VIRTUAL_RESERVE     0x40000000  // Min size of the virtual memory reserved for a big buffer
+#else
+#define PDF_VIRTUAL_RESERVE     0           // 32-bit processes have little address space to spare, so they reserve just twice the size
+#endif
+#define PDF_RATIO_ONE           0x10        // Learned ratios of the decoded size to the raw size are in 1/16
+#define PDF_MAX_PREDICT_RATIO   0x400       // Sizes predicted from the object parameters must not exceed the raw size by more
+#define PDF_CACHE_SIGNATURE     0x54414350  // "PCAT", signature of the catalog cache file
+#define PDF_CACHE_VERSION       2           // Version of the catalog cache file
+#define PDF_CACHE_FINGERPRINT   0x400       // Size of the begin and the end of the PDF file that are hashed into the cache key
+#define PDF_MAX_KEPT_DATABASES  4           // Max number of databases kept open after their archive handles were closed
+
+// Options that change the file list, so they are part of the catalog cache key
+#define PDF_CACHE_SHOW_REVISIONS 0x0001
+#define PDF_CACHE_LAZY_DECODE    0x0002
+#define PDF_CACHE_EXACT_SIZES    0x0004
+
+// Keywords for TPdfBlob::FindKeyword
+#define PDF_KEYWORD_EOL         0x0001      // 0x0A or 0x0D
+#define PDF_KEYWORD_DICT        0x0002      // "<<"
+#define PDF_KEYWORD_OBJ         0x0004      // "obj"
+#define PDF_KEYWORD_STREAM      0x0008      // "stream"
+#define PDF_KEYWORD_ENDSTREAM   0x0010      // "endstream"
+#define PDF_KEYWORD_ENDOBJ      0x0020      // "endobj"
 
 //-----------------------------------------------------------------------------
 // Enums
@@ -33,8 +72,24 @@ typedef enum _PDFFL
     PDFF_RunLength,
     PDFF_DCT,
     PDFF_CCITTFaxDecode,
+    PDFF_MaxFilter                          // Number of the filter types
 } PDFFL, *PPDFFL;
 
+// Types of values in PDF dictionaries
+typedef enum _PDFVT
+{
+    PDFV_None = 0,                          // Unknown keyword or a missing value
+    PDFV_Null,                              // "null"
+    PDFV_Bool,                              // "true" or "false"
+    PDFV_Number,                            // Integer or real number
+    PDFV_Ref,                               // Indirect reference, "N G R"
+    PDFV_Name,                              // "/Name", possibly with "#xx" escapes
+    PDFV_String,                            // Literal string, "(...)"
+    PDFV_HexString,                         // Hexadecimal string, "<...>"
+    PDFV_Array,                             // "[...]"
+    PDFV_Dict,                              // "<<...>>"
+} PDFVT, *PPDFVT;
+
 struct DOS_FTIME
 {
     unsigned ft_tsec : 5;                   // Two second interval
@@ -45,6 +100,140 @@ struct DOS_FTIME
     unsigned ft_year : 7;                   // Year
 };
 
+// One entry of the cross-reference catalog
+struct TPdfObjectRef
+{
+    ULONGLONG ObjectOffset;                 // Offset of the "N G obj" header, relative to the begin of the file
+    DWORD dwObjectId;                       // Object number
+    DWORD dwGeneration;                     // Generation number
+    DWORD dwSection;                        // Index of the xref section (0 = the newest one)
+    DWORD dwObjStmId;                       // For compressed objects: Object number of the /ObjStm
+    DWORD dwObjStmIndex;                    // For compressed objects: Index of the object within the /ObjStm
+    bool bInUse;                            // false = the entry was marked as free ('f')
+};
+
+// Object stream (/Type /ObjStm) that has been decoded
+struct TPdfObjectStream
+{
+    struct TPdfFile * pPdfFile;             // Decoded data of the object stream
+    std::vector<DWORD> ObjectIds;           // Object numbers, in the order of the stream header
+    std::vector<size_t> Offsets;            // Offsets of the objects, relative to the begin of the decoded data
+};
+
+// Candidate of an object header, found by the parallel scan of the file
+struct TPdfObjectHeader
+{
+    size_t KeywordOffset;                   // Offset of the "obj" keyword, relative to the begin of the file
+    size_t LineOffset;                      // Offset of the begin of the line with the keyword
+    bool bIsHeader;                         // true = the line is a valid "N G obj" header
+};
+
+// Value in the object parameters. Points to the PDF data, nothing is copied
+struct TPdfValue
+{
+    LPBYTE pbBegin;                         // Begin of the value, including the leading '/', '(', '<' or '['
+    LPBYTE pbEnd;                           // End of the value, including the closing bracket
+    PDFVT Type;
+};
+
+// One "/Key value" pair of a dictionary
+struct TPdfDictEntry
+{
+    TPdfValue Key;
+    TPdfValue Value;
+};
+
+// Dictionary ("<< ... >>"), parsed into a table of keys and values
+struct TPdfDict
+{
+    TPdfDict();
+
+    LPBYTE Parse(LPBYTE pbDictBegin, LPBYTE pbDictEnd);
+    void   Clear();
+
+    const TPdfValue * Find(LPCSTR szKey) const;
+    bool GetInt(LPCSTR szKey, int & RefValue, int nDefaultValue = 0, bool bBoolAllowed = false) const;
+    bool GetInt(LPCSTR szKey, LONGLONG & RefValue, LONGLONG nDefaultValue = 0) const;
+    bool GetName(LPCSTR szKey, LPSTR szBuffer, size_t ccBuffer, LPCSTR szDefaultValue = "") const;
+    bool GetArray(LPCSTR szKey, std::vector<ULONGLONG> & Array) const;
+    bool GetRef(LPCSTR szKey, DWORD & RefObjectId) const;
+    bool GetDict(LPCSTR szKey, TPdfDict & Dict) const;
+    bool GetDecodeParms(DWORD dwFilterIndex, TPdfDict & DecodeParms) const;
+
+    static LPBYTE ParseValue(LPBYTE pbPtr, LPBYTE pbEnd, TPdfValue & Value, DWORD dwNesting = 0);
+    static LPBYTE SkipWhiteSpaces(LPBYTE pbPtr, LPBYTE pbEnd);
+    static bool   GetArrayItem(const TPdfValue & Array, size_t nIndex, TPdfValue & Item);
+    static bool   IsName(const TPdfValue & Value, LPCSTR szName);
+
+    TPdfDictEntry m_InlineEntries[PDF_DICT_INLINE_ENTRIES]; // The first top-level entries, in the order of the PDF data
+    std::vector<TPdfDictEntry> m_MoreEntries;               // Entries that don't fit the inline array
+    size_t m_nEntries;                      // Total number of entries
+    LPBYTE m_pbBegin;                       // Begin of the dictionary ("<<")
+    LPBYTE m_pbEnd;                         // End of the dictionary (past the ">>")
+};
+
+// Header of the catalog cache file. It is followed by the array of entries and by the name of the PDF file.
+// The file is mapped to memory and used as-is
+struct TPdfCacheHeader
+{
+    DWORD dwSignature;                      // PDF_CACHE_SIGNATURE
+    DWORD dwVersion;                        // PDF_CACHE_VERSION
+    DWORD dwOptions;                        // PDF_CACHE_XXX flags of the options the file list was made with
+    DWORD dwEntries;                        // Number of TPdfCacheEntry structures
+    ULONGLONG FileSize;                     // Size of the PDF file
+    ULONGLONG FileTime;                     // Last write time of the PDF file
+    ULONGLONG Fingerprint;                  // Hash of the begin and the end of the PDF file
+    DWORD cchFileName;                      // Length of the full name of the PDF file, without the terminating zero
+    DWORD dwSections;                       // Number of xref sections. 0 = the files were found by the sequential scan
+    ULONGLONG XrefOffset;                   // Offset of the newest xref section
+};
+
+// One file of the catalog cache. The offsets are relative to the begin of the PDF file
+struct TPdfCacheEntry
+{
+    ULONGLONG ObjectOffset;                 // Offset of the object header ("N G obj")
+    ULONGLONG RawOffset;                    // Offset of the raw (encoded) stream data
+    ULONGLONG RawSize;                      // Size of the raw (encoded) stream data
+    ULONGLONG FileSize;                     // Size of the decoded data, as it was listed
+    ULONGLONG ParamsOffset;                 // Offset of the object parameters ("<<")
+    DWORD cbParams;                         // Size of the object parameters, including the closing ">>"
+    DWORD dwObjectId;                       // Object number
+    DWORD dwRevision;                       // Revision of the document (0 = the live one)
+    DWORD dwObjectRevision;                 // Revision of the newest xref section that lists the object
+    DWORD dwExtension;                      // Index of the file extension
+    DWORD dwReserved;
+};
+
+// Statistics of the decoded data kept in memory, for sizing the budget
+struct TPdfDecodedStats
+{
+    ULONGLONG Hits;                         // Extracted files whose decoded data were in memory
+    ULONGLONG Misses;                       // Extracted files that had to be decoded again
+    ULONGLONG Evictions;                    // Decoded data freed to stay within the budget
+    ULONGLONG DecodeTime;                   // Time spent by decoding the misses to memory, in microseconds
+    ULONGLONG PeakBytes;                    // The most decoded data held at once
+};
+
+// Stream waiting to be decoded by the decode pool
+struct TPdfDecodeTask
+{
+    struct TPdfFile * pPdfFile;             // The file to be decoded
+    TPdfDict ObjParams;                     // Object parameters of the stream
+    DWORD dwErrCode;                        // Result of the decoding
+    bool bPrepare;                          // true = only prepare the file for lazy decoding
+    bool bExactSize;                        // Lazy decoding: Run the counting pass
+};
+
+// Identity of the PDF file on the disk. Archive handles of the same unchanged file share one database
+struct TPdfFileId
+{
+    ULONGLONG FileIndex;                    // Unique ID of the file on the volume
+    ULONGLONG FileSize;                     // Size of the file
+    ULONGLONG FileTime;                     // Last write time of the file
+    DWORD dwVolumeSerial;                   // Serial number of the volume
+    DWORD dwOptions;                        // PDF_CACHE_XXX flags of the options the file list is made with
+};
+
 //-----------------------------------------------------------------------------
 // PDF objects
 
@@ -69,13 +258,20 @@ struct TPdfBlob
     DWORD ReadByte(BYTE & RefValue);
     DWORD GetHexValue(BYTE & RefValue);
 
+    LPBYTE FindKeyword(DWORD dwKeywords, DWORD * PtrKeyword = NULL);
+    DWORD  CheckKeyword(LPBYTE pbKeyword, DWORD dwKeywords);
+    bool   IsKeyword(LPBYTE pbKeyword, LPCSTR szKeyword, size_t nLength);
+
     LPBYTE LoadOneLine(LPSTR szBuffer, size_t ccBuffer);
     LPBYTE FindEndOfPdf();
     LPBYTE FindEndOfLine();
     LPBYTE SkipEndOfLine();
     LPBYTE SkipPdfSpaces();
+    LPBYTE SkipWhiteSpaces();
+    LPBYTE LoadInteger(ULONGLONG & RefValue);
 
     LPBYTE ReallocateBuffer(LPBYTE pbPtr, SIZE_T cbNewSize);
+    LPBYTE ReallocateVirtual(SIZE_T cbNewSize);
     DWORD  Resize(size_t cbNewSize);
     size_t Size() const { return (pbEnd - pbData); }
     bool CheckData(LPCVOID pv, size_t cb);
@@ -86,52 +282,198 @@ struct TPdfBlob
     LPBYTE pbPtr;
     LPBYTE pbEnd;
     bool bAllocated;
+    bool bVirtual;                          // true = the data are in reserved virtual memory, committed as they grow
+};
+
+// Bump allocator owned by the database. Small data that live as long as the database
+// are carved from big blocks, which are all freed at once when the database goes away
+struct TPdfArena
+{
+    TPdfArena();
+    ~TPdfArena();
+
+    LPVOID Alloc(size_t cbSize);
+    void   FreeAll();
+
+    protected:
+
+    CRITICAL_SECTION m_Lock;                // The decode pool threads allocate in parallel
+    LPBYTE m_pbBlock;                       // The current block. Each block begins with the pointer to the previous one
+    LPBYTE m_pbPtr;                         // Free space in the current block
+    LPBYTE m_pbEnd;                         // End of the current block
+};
+
+// Statistics of the scratch pools
+struct TPdfScratchStats
+{
+    ULONGLONG BufferReuses;                 // Output buffers taken from the pool
+    ULONGLONG BufferAllocs;                 // Output buffers allocated or enlarged
+    ULONGLONG StageReuses;                  // Filter stages taken from the pool
+    ULONGLONG StageAllocs;                  // Filter stages allocated
+    ULONGLONG ContextReuses;                // Decoder contexts (zlib states, LZW tables, windows) reused
+    ULONGLONG ContextAllocs;                // Decoder contexts created
+    ULONGLONG PredictExact;                 // Decoded sizes predicted exactly
+    ULONGLONG PredictTooSmall;              // Predicted sizes that were too small, so the buffer had to grow
+    ULONGLONG PredictTooLarge;              // Predicted sizes that were too large
+    ULONGLONG FlateWhole;                   // Flate streams decoded in one go
+    ULONGLONG FlateFallbacks;               // Flate streams left to the streaming zlib
+    ULONGLONG FlateParallel;                // Flate streams decoded by more threads
+    ULONGLONG FlateParallelFallbacks;       // Flate streams where the parallel decoding didn't work
+};
+
+// Reusable output buffer and decoder contexts of one thread. Every thread that decodes
+// gets its own pool, so the filter chains take and return the objects without any lock.
+// When the thread ends, the pool is kept as a spare for the next decoding thread
+struct TPdfScratch
+{
+    TPdfScratch();
+    ~TPdfScratch();
+
+    static TPdfScratch * ForThisThread();
+    static void ReleaseThisThread();
+    static void FreeSpares();
+
+    TPdfBlob m_Buffer;                      // Output buffer for the decoded data. Empty while in use
+    struct TPdfFilterStage * m_pFreeStages; // Filter stages that are not used by any chain
+    DWORD m_Ratios[PDFF_MaxFilter];         // Learned ratio of the decoded size to the raw size for each last filter. 0 = not learned yet
+    TPdfScratchStats m_Stats;               // Statistics since the pool was given to the thread
+    LIST_ENTRY m_Entry;                     // Link in the list of all pools. The spare ones go first
+    bool m_bSpare;                          // true = the pool doesn't belong to any thread
+    bool m_bPoolThread;                     // true = the thread is one of the threads of a decode pool
+};
+
+// Chain of stream filters. The decoded data are pulled through the chain in chunks,
+// so the intermediate data between two filters never exist as a whole
+struct TPdfFilterChain
+{
+    TPdfFilterChain();
+    ~TPdfFilterChain();
+
+    DWORD Open(LPBYTE pbRawData, LPBYTE pbRawEnd, const PDFFL * Filters, const DWORD * FilterIndexes, DWORD dwFilters, const TPdfDict & ObjParams);
+    DWORD Read(LPBYTE pbBuffer, size_t cbBuffer, size_t & cbRead);
+    DWORD ReadAll(TPdfBlob & Output, size_t cbExpected = 0, TPdfArena * pArena = NULL);
+    void  Close();
+
+    bool IsEmpty()              { return (m_dwStages == 0); }
+
+    protected:
+
+    DWORD ReadStage(DWORD dwStage, LPBYTE pbBuffer, size_t cbBuffer, size_t & cbRead);
+
+    struct TPdfFilterStage * m_Stages[PDF_MAX_FILTERS];  // Stages of the chain, one per filter
+    DWORD m_dwStages;
+    LPBYTE m_pbRawPtr;                      // Raw (encoded) data not given to the first stage yet
+    LPBYTE m_pbRawEnd;
+    size_t m_cbRawData;                     // Size of all raw data
 };
 
 struct TPdfFile : public TPdfBlob
 {
-    TPdfFile(LPBYTE pbData, LPBYTE pbEnd, DWORD dwObjectId);
+    TPdfFile(LPBYTE pbData, LPBYTE pbEnd, DWORD dwObjectId, TPdfArena * pArena = NULL);
     ~TPdfFile();
 
+    // Files are allocated in the arena of the database, their memory is freed with the arena
+    static void * operator new(size_t cbSize, TPdfArena & Arena) throw()   { return Arena.Alloc(cbSize); }
+    static void operator delete(void * /* pvFile */, TPdfArena & /* Arena */) {}
+    static void operator delete(void * /* pvFile */)                {}
+
     DWORD AddRef();
     DWORD Release();
 
     void SetOwner(struct TPdfDatabase * pPdfDb);
 
-    DWORD Load(LPCSTR szObjParams);
-    DWORD DecodeObject_AsciiHex(TPdfBlob & Source);
-    DWORD DecodeObject_Flate(TPdfBlob & Source);
-    DWORD DecodeObject_LZW(TPdfBlob & Source, LPCSTR szObjParams);
-    DWORD DecodeObject_CCITT(TPdfBlob & Source, LPCSTR szObjParams);
-    DWORD DecodeObject_RunLength(TPdfBlob & Source);
+    DWORD Load(const TPdfDict & ObjParams);
+    DWORD Prepare(const TPdfDict & ObjParams, bool bExactSize);
+    DWORD Decode();
+    DWORD OpenStream(TPdfFilterChain & Chain);
+    void  Unload();
+    DWORD LoadObjParams(TPdfDict & ObjParams);
+    DWORD DecodeObject_CCITT(TPdfBlob & Source, const TPdfDict & ObjParams, const TPdfDict & DecodeParms);
 
     const TPdfBlob & GetData()  { return *this; };
-    DWORD PackSize()            { return m_dwRawSize; }
-    DWORD FileSize()            { return (DWORD)Size(); }
+    ULONGLONG PackSize()        { return m_RawSize; }
+    ULONGLONG FileSize()        { return m_FileSize; }
+    bool  IsDecoded()           { return m_bDecoded; }
+    bool  CanDecodeAgain()      { return (m_pbParamsBegin != NULL); }
 
-    LPCSTR GetStreamFilter(LPCSTR szPtr, size_t & RefLength);
-    DWORD  GetStreamFilters(LPCSTR szObjParams, PDFFL * Filters, DWORD & RefFilterCount);
+    PDFFL  GetStreamFilter(const TPdfValue & Name);
+    DWORD  GetStreamFilters(const TPdfDict & ObjParams, PDFFL * Filters, DWORD * FilterIndexes, DWORD & RefFilterCount);
+    size_t GetExpectedSize(const TPdfDict & ObjParams, DWORD dwChainFilters);
 
-    LPCTSTR FileExtension();
+    LPCTSTR FileExtension(TPdfBlob & Data);
     void GetName(LPTSTR szBuffer, size_t cchBuffer);
 
     struct TPdfDatabase * m_pPdfDb;         // Mother PDF database
     LIST_ENTRY m_Entry;                     // Link to other files
+    LIST_ENTRY m_DecodedEntry;              // Link in the LRU list of decoded files. NULL = not in the list
     LPCTSTR m_szExtension;
     LPCTSTR m_szFileType;
     DWORD m_dwObjectId;                     // Object ID
+    DWORD m_dwRevision;                     // Revision of the document (0 = the live one)
     PDFFL m_Filters[PDF_MAX_FILTERS];       // Array of filters
+    DWORD m_FilterIndexes[PDF_MAX_FILTERS]; // Positions of the filters in /Filter, for their /DecodeParms
     DWORD m_dwFilters;
-    DWORD m_dwRawSize;
+    ULONGLONG m_RawSize;                    // Size of the raw (encoded) stream data
+    ULONGLONG m_FileSize;                   // Size of the decoded data. Estimated, if not decoded yet
+    TPdfArena * m_pArena;                   // Arena for small decoded data. NULL = the data stay on the heap
+    LPBYTE m_pbObject;                      // Begin of the object header in the PDF data
+    LPBYTE m_pbParamsBegin;                 // Begin of the object parameters in the PDF data. Parsed again for lazy decoding
+    LPBYTE m_pbParamsEnd;                   // End of the object parameters in the PDF data
+    LPBYTE m_pbRawData;                     // Begin of the raw (encoded) stream data
+    LPBYTE m_pbRawEnd;                      // End of the raw (encoded) stream data
+    bool m_bDecoded;                        // true = the blob contains the decoded data
+    bool m_bExactSize;                      // true = m_FileSize is the exact size of the decoded data
     DWORD m_dwRefs;
 };
 
+// Work-stealing pool of threads that decode streams in parallel
+struct TPdfDecodePool
+{
+    TPdfDecodePool(std::vector<TPdfDecodeTask> & Tasks);
+    ~TPdfDecodePool();
+
+    static DWORD GetThreadCount(DWORD dwThreads);
+    DWORD Run(DWORD dwThreads);
+
+    protected:
+
+    // Range of task indexes (into m_Order), processed by one thread at once
+    typedef std::pair<size_t, size_t> TPdfDecodeBatch;
+
+    struct TPdfDecodeQueue
+    {
+        CRITICAL_SECTION Lock;
+        std::deque<TPdfDecodeBatch> Batches; // Big batches are at the front
+    };
+
+    struct TPdfDecodeWorker
+    {
+        TPdfDecodePool * pPool;
+        DWORD dwQueue;                      // Index of the own queue
+    };
+
+    static DWORD WINAPI WorkerThread(LPVOID lpParameter);
+    void  ProcessBatches(DWORD dwQueue);
+    bool  PopBatch(DWORD dwQueue, TPdfDecodeBatch & Batch);
+    void  DecodeTask(TPdfDecodeTask & Task);
+
+    std::vector<TPdfDecodeTask> & m_Tasks;  // All tasks, in the catalog order
+    std::vector<size_t> m_Order;            // Task indexes, the most expensive first
+    std::vector<TPdfDecodeBatch> m_Batches; // Batches of tasks, the most expensive first
+    TPdfDecodeQueue * m_Queues;             // One queue per thread
+    DWORD m_dwQueues;
+};
+
 // Our structure describing open archive
 struct TPdfDatabase : public TPdfBlob
 {
     static TPdfDatabase * Open(LPCWSTR szFileName, bool bFastCheck);
-    static TPdfDatabase * Load(LPBYTE pbFileData, size_t cbFileData, FILETIME & ft, bool bFastCheck);
+    static TPdfDatabase * Load(LPBYTE pbFileData, size_t cbFileData, FILETIME & ft, bool bFastCheck, bool bMappedView = false, LPCWSTR szFileName = NULL);
     static TPdfDatabase * FromHandle(HANDLE hHandle);
+    static HANDLE OpenArchive(LPCWSTR szFileName);
+    static bool   CloseArchive(HANDLE hHandle);
+    static void   CloseKeptDatabases(bool bCloseAll, bool bTimerCallback);
+    static void   Shutdown();
 
     DWORD AddRef();
     DWORD Release();
@@ -139,38 +481,116 @@ struct TPdfDatabase : public TPdfBlob
     void  InsertFile(TPdfFile * pPdfFile);
     void  RemoveAllFiles();
 
-    TPdfFile * OpenNextFile();
-    TPdfFile * ReferenceFile(LPCTSTR szPlainName);
+    TPdfFile * OpenNextFile(size_t & nNextFile);
+    TPdfFile * ReferenceFile(LPCTSTR szFileName);
+    TPdfFile * FindFile(DWORD dwObjectId, DWORD dwRevision);
     void       UnlockAndRelease();
 
+    DWORD DecodeFile(TPdfFile * pPdfFile);
+    DWORD OpenFileStream(TPdfFile * pPdfFile, TPdfFilterChain & Chain);
+    void  InsertDecodedFile(TPdfFile * pPdfFile);
+
+    const TPdfObjectRef * FindObject(DWORD dwObjectId);
+    DWORD LoadIndirectObject(DWORD dwObjectId, TPdfBlob & Object);
+    bool  GetIndirectVariableInt(const TPdfDict & ObjParams, LPCSTR szVariableName, LONGLONG & RefValue);
+
     const DOS_FTIME & FileTime()         { return m_FileTime; }
 
     protected:
 
-    TPdfDatabase(LPBYTE pbPdfBegin, LPBYTE pbPdfEnd, FILETIME & ft);
+    TPdfDatabase(LPBYTE pbFileBegin, LPBYTE pbPdfBegin, LPBYTE pbPdfEnd, FILETIME & ft, bool bMappedView);
     ~TPdfDatabase();
 
+    TPdfFile * LoadNextFile();
+
+    DWORD  LoadCrossReference(const TPdfCacheHeader * pPrevCache = NULL, std::vector<DWORD> * pUpdatedIds = NULL);
+    DWORD  LoadXrefTable(DWORD dwSection, TPdfDict & Trailer);
+    DWORD  LoadXrefStream(DWORD dwSection, TPdfDict & Trailer);
+    bool   VerifyObjectRef(const TPdfObjectRef & ObjRef);
+    bool   VerifyCatalog();
+    LPBYTE FindStartXref();
+
+    DWORD  LoadCatalogCache(LPCWSTR szFileName, LPBYTE pbFileData, size_t cbFileData, FILETIME & ft);
+    DWORD  LoadAppendedObjects(const TPdfCacheHeader * pPrevCache);
+    ULONGLONG GetHeaderOffset(ULONGLONG ObjectOffset);
+    DWORD  SaveCatalogCache();
+    TPdfFile * OpenNextFile_CACHE();
+
+    TPdfObjectStream * LoadObjectStream(DWORD dwObjStmId);
+    void   InsertObjectStream(TPdfFile * pPdfFile, const TPdfDict & ObjParams);
+    void   FreeObjectStreams();
+
+    TPdfFile * OpenNextFile_XREF();
+    void   IndexFile(TPdfFile * pPdfFile);
+    void   EvictDecodedFiles(TPdfFile * pKeepFile);
+    void   RemoveDecodedFiles();
+    DWORD  LoadAllObjects(DWORD dwThreads);
+    DWORD  QueueDecodeTask(TPdfFile * pPdfFile, const TPdfDict & ObjParams);
+    DWORD  FindObjectHeaders();
+    LPBYTE FindNextObjectKeyword(bool & bIsHeader);
     TPdfFile * OpenNextFile_SEQ();
-    TPdfFile * LoadPdfObject();
+    TPdfFile * LoadPdfObject(DWORD dwRevision = 0);
     LPBYTE CheckBeginOfObject();
     LPBYTE ParseBeginOfObject(int & nObjectId);
-    LPSTR  LoadObjectParameters();
+    LPBYTE LoadObjectParameters(TPdfDict & ObjParams);
     LPBYTE IsBeginOfStream();
-    LPBYTE FindEndOfStream(LPCSTR szObjParams);
+    LPBYTE FindEndOfStream(const TPdfDict & ObjParams);
     LPBYTE SkipEndOfStream();
     LPBYTE SkipEndOfObject();
 
+    TPdfArena m_Arena;                      // Memory of the files and of their small decoded data
     CRITICAL_SECTION m_Lock;
+    CRITICAL_SECTION m_DecodedLock;         // Guards the LRU list of decoded files, which is also used by the decode pool
+    std::vector<TPdfObjectRef> m_Catalog;   // Objects from the cross-reference table, sorted by offset
+    std::vector<TPdfObjectRef> m_History;   // Superseded versions of objects from older revisions, sorted by offset
+    std::vector<std::pair<DWORD, size_t> > m_ObjectIndex;   // Catalog indexes, sorted by object number
+    std::map<DWORD, TPdfObjectStream> m_ObjStreams;         // Decoded object streams, by object number
+    std::vector<TPdfObjectHeader> m_ObjHeaders;             // Object header candidates found by the parallel scan, sorted by offset
+    std::vector<TPdfDecodeTask> * m_pDecodeTasks;           // If not NULL, streams are queued here instead of being decoded
+    std::vector<TPdfFile *> m_Listed;       // Files returned by LoadNextFile, in the order of listing. Shared by all archive handles
+    bool m_bListComplete;                   // true = LoadNextFile has returned all files
+    std::vector<TPdfFile *> m_Loaded;       // Files loaded by LoadAllObjects, in the catalog order
+    size_t m_nNextLoaded;                   // Index of the next file in m_Loaded
+    bool m_bAllLoaded;                      // true = all files were loaded by LoadAllObjects
+    size_t m_nNextObject;                   // Index of the next catalog (or catalog cache) entry to be loaded
+    size_t m_nNextHeader;                   // Index of the next object header candidate
+    DWORD m_dwResolveDepth;                 // Nesting level of GetIndirectVariableInt
+    DWORD m_dwSections;                     // Number of xref sections (revisions) in the file
+    ULONGLONG m_XrefOffset;                 // Offset of the newest xref section
     LIST_ENTRY m_Files;                     // List of files
+    std::vector<TPdfFile *> m_FileIndex;    // Hash table of the returned files, by object number and revision
+    size_t m_nIndexedFiles;                 // Number of files in m_FileIndex
+    bool m_bIndexComplete;                  // false = the hash table is incomplete due to lack of memory
+    TPdfFile * m_pLastFile;                 // The file that has been returned by OpenNextFile most recently
+    LIST_ENTRY m_DecodedFiles;              // Files with decoded data that can be decoded again, the least recently used first
+    ULONGLONG m_DecodedBytes;               // Size of the decoded data of the files in m_DecodedFiles
+    TPdfDecodedStats m_DecodedStats;        // Statistics of the decoded data
+    LPBYTE m_pbMappedView;                  // If not NULL, the data are a view of the mapped PDF file, owned by the database
+    TPdfCacheHeader * m_pCache;             // View of the catalog cache, if the files are listed from it
+    std::vector<TPdfCacheEntry> m_CacheEntries;     // Cached files merged with the objects appended by incremental updates
+    const TPdfCacheEntry * m_pCacheEntries; // Entries of the catalog cache that the files are listed from
+    size_t m_nCacheEntries;                 // Number of entries in m_pCacheEntries
+    bool m_bListFromCache;                  // true = the files are listed from the catalog cache
+    TPdfCacheHeader m_CacheKey;             // Identity of the PDF file, checked against the catalog cache
+    WCHAR m_szCacheFile[MAX_PATH];          // Name of the catalog cache file. Empty = the catalog won't be saved
+    WCHAR m_szFileName[MAX_PATH];           // Full name of the PDF file
     ULONGLONG m_MagicSignature;             // PDF_MAGIC_SIGNATURE
     DOS_FTIME m_FileTime;                   // File time of the PDF file
     DWORD m_dwFiles;                        // Number of files
     DWORD m_dwRefs;
+    LIST_ENTRY m_SharedEntry;               // Entry in the list of shared databases. Empty = the database is not shared
+    TPdfFileId m_FileId;                    // Identity of the PDF file, for sharing the database
+    DWORD m_dwHandles;                      // Number of archive handles using the database
+    DWORD m_dwClosedTime;                   // Tick count when the last archive handle was closed
 };
 
-// Non-class functions
-bool GetObjectVariableInt(LPCSTR szObjParams, LPCSTR szVariableName, int & RefValue, int nDefaultValue = 0, bool bBoolAllowed = false);
-bool GetObjectVariableString(LPCSTR szObjParams, LPCSTR szVariableName, LPSTR szBuffer, size_t ccBuffer, LPCSTR szDefaultValue = "");
+// Archive handle given to Total Commander. Each handle has its own position in the list of files
+struct TPdfArchive
+{
+    ULONGLONG m_MagicSignature;             // PDF_ARCHIVE_SIGNATURE
+    TPdfDatabase * m_pPdfDb;                // The database, possibly shared with other handles of the same file
+    size_t m_nNextFile;                     // Index of the next file in the list of the database
+};
 
 
 #endif // __TPDF_H__
@@ -0,0 +1,104 @@
+/*****************************************************************************/
+/* TPdfArena.cpp                          Copyright (c) Ladislav Zezula 2024 */
+/*---------------------------------------------------------------------------*/
+/* Bump allocator for the data that live as long as the PDF database         */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#include "wcx_pdf.h"
+
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define PDF_ARENA_ALIGNMENT     0x10        // All allocations are aligned to 16 bytes
+#define PDF_ARENA_HEADER_SIZE   0x10        // Each block begins with the pointer to the previous block
+
+static size_t AlignArenaSize(size_t cbSize)
+{
+    return (cbSize + PDF_ARENA_ALIGNMENT - 1) & ~(size_t)(PDF_ARENA_ALIGNMENT - 1);
+}
+
+//-----------------------------------------------------------------------------
+// Constructor and destructor
+
+TPdfArena::TPdfArena()
+{
+    InitializeCriticalSection(&m_Lock);
+    m_pbBlock = NULL;
+    m_pbPtr = NULL;
+    m_pbEnd = NULL;
+}
+
+TPdfArena::~TPdfArena()
+{
+    FreeAll();
+    DeleteCriticalSection(&m_Lock);
+}
+
+//-----------------------------------------------------------------------------
+// Member functions
+
+LPVOID TPdfArena::Alloc(size_t cbSize)
+{
+    LPBYTE pbResult = NULL;
+    LPBYTE pbBlock;
+    size_t cbBlock;
+
+    // Only small data belong to the arena
+    if(cbSize > PDF_ARENA_BLOCK_SIZE)
+        return NULL;
+    cbSize = AlignArenaSize(cbSize);
+
+    EnterCriticalSection(&m_Lock);
+
+    // Carve the data from the current block, if they fit
+    if(m_pbBlock != NULL && cbSize <= (size_t)(m_pbEnd - m_pbPtr))
+    {
+        pbResult = m_pbPtr;
+        m_pbPtr += cbSize;
+    }
+    else
+    {
+        // Big data get a block of their own, so that the current block isn't wasted
+        cbBlock = (cbSize > PDF_ARENA_BLOCK_SIZE / 4) ? (PDF_ARENA_HEADER_SIZE + cbSize) : PDF_ARENA_BLOCK_SIZE;
+        if((pbBlock = (LPBYTE)HeapAlloc(g_hHeap, 0, cbBlock)) != NULL)
+        {
+            pbResult = pbBlock + PDF_ARENA_HEADER_SIZE;
+
+            if(cbBlock != PDF_ARENA_BLOCK_SIZE && m_pbBlock != NULL)
+            {
+                // Link the block behind the current one
+                *(LPBYTE *)(pbBlock) = *(LPBYTE *)(m_pbBlock);
+                *(LPBYTE *)(m_pbBlock) = pbBlock;
+            }
+            else
+            {
+                // The new block becomes the current one
+                *(LPBYTE *)(pbBlock) = m_pbBlock;
+                m_pbBlock = pbBlock;
+                m_pbPtr = pbResult + cbSize;
+                m_pbEnd = pbBlock + cbBlock;
+            }
+        }
+    }
+
+    LeaveCriticalSection(&m_Lock);
+    return pbResult;
+}
+
+void TPdfArena::FreeAll()
+{
+    LPBYTE pbBlock;
+
+    // Free all blocks at once
+    while((pbBlock = m_pbBlock) != NULL)
+    {
+        m_pbBlock = *(LPBYTE *)(pbBlock);
+        HeapFree(g_hHeap, 0, pbBlock);
+    }
+
+    m_pbPtr = m_pbEnd = NULL;
+}
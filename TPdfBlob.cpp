@@ -12,6 +12,166 @@
 
 //#define __DIAGNOSE_HEAP_ERRORS
 
+//-----------------------------------------------------------------------------
+// Vectorized keyword scanner. SSE2 is available on every x64 CPU,
+// AVX2 is detected at run time. AVX2 intrinsics need Visual Studio 2012+.
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PDF_SCAN_SSE2
+#include <intrin.h>
+#include <emmintrin.h>
+#include "./libs/zlib/cpu_features.h"           // x86_cpu_enable_sse2, x86_cpu_enable_avx2
+#if (defined(_MSC_VER) && (_MSC_VER >= 1700)) || defined(__AVX2__)
+#define PDF_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#define PDF_MAX_NEEDLES     6           // Max number of distinct first bytes of the keywords
+
+#define PDF_VIRTUAL_HEADER  0x10        // Reserved virtual memory begins with its size, the data follow
+#define PDF_VIRTUAL_PAGE    0x1000      // Virtual memory is committed by pages
+#define PDF_VIRTUAL_GRAIN   0x10000     // Virtual memory is reserved by the allocation granularity
+
+enum PDF_SIMD_LEVEL
+{
+    PDF_SIMD_NONE = 0,
+    PDF_SIMD_SSE2,
+    PDF_SIMD_AVX2
+};
+
+#ifdef PDF_SCAN_SSE2
+static int GetSimdLevel()
+{
+    // The CPU features are detected by zlib, once when the plugin is loaded
+    if(x86_cpu_enable_avx2)
+        return PDF_SIMD_AVX2;
+    if(x86_cpu_enable_sse2)
+        return PDF_SIMD_SSE2;
+    return PDF_SIMD_NONE;
+}
+
+static bool FindKeyword_SSE2(TPdfBlob & Blob, LPBYTE & pbScan, const BYTE * Needles, size_t nNeedles, DWORD dwKeywords, DWORD & RefKeyword)
+{
+    __m128i NeedleVectors[PDF_MAX_NEEDLES];
+
+    // Prepare the vectors with the first bytes of the keywords
+    for(size_t i = 0; i < nNeedles; i++)
+        NeedleVectors[i] = _mm_set1_epi8((char)Needles[i]);
+
+    // Check 32 bytes at once
+    while((pbScan + 32) <= Blob.pbEnd)
+    {
+        __m128i Block0 = _mm_loadu_si128((const __m128i *)(pbScan));
+        __m128i Block1 = _mm_loadu_si128((const __m128i *)(pbScan + 16));
+        __m128i Match0 = _mm_cmpeq_epi8(Block0, NeedleVectors[0]);
+        __m128i Match1 = _mm_cmpeq_epi8(Block1, NeedleVectors[0]);
+        unsigned long nIndex;
+        unsigned int Mask;
+
+        for(size_t i = 1; i < nNeedles; i++)
+        {
+            Match0 = _mm_or_si128(Match0, _mm_cmpeq_epi8(Block0, NeedleVectors[i]));
+            Match1 = _mm_or_si128(Match1, _mm_cmpeq_epi8(Block1, NeedleVectors[i]));
+        }
+
+        // Verify all candidates, from the lowest address
+        Mask = (unsigned int)_mm_movemask_epi8(Match0) | ((unsigned int)_mm_movemask_epi8(Match1) << 16);
+        while(_BitScanForward(&nIndex, Mask))
+        {
+            if((RefKeyword = Blob.CheckKeyword(pbScan + nIndex, dwKeywords)) != 0)
+            {
+                pbScan = pbScan + nIndex;
+                return true;
+            }
+            Mask &= (Mask - 1);
+        }
+        pbScan += 32;
+    }
+    return false;
+}
+#endif  // PDF_SCAN_SSE2
+
+#ifdef PDF_SCAN_AVX2
+static bool FindKeyword_AVX2(TPdfBlob & Blob, LPBYTE & pbScan, const BYTE * Needles, size_t nNeedles, DWORD dwKeywords, DWORD & RefKeyword)
+{
+    __m256i NeedleVectors[PDF_MAX_NEEDLES];
+
+    // Prepare the vectors with the first bytes of the keywords
+    for(size_t i = 0; i < nNeedles; i++)
+        NeedleVectors[i] = _mm256_set1_epi8((char)Needles[i]);
+
+    // Check 64 bytes at once
+    while((pbScan + 64) <= Blob.pbEnd)
+    {
+        __m256i Block0 = _mm256_loadu_si256((const __m256i *)(pbScan));
+        __m256i Block1 = _mm256_loadu_si256((const __m256i *)(pbScan + 32));
+        __m256i Match0 = _mm256_cmpeq_epi8(Block0, NeedleVectors[0]);
+        __m256i Match1 = _mm256_cmpeq_epi8(Block1, NeedleVectors[0]);
+        unsigned int Masks[2];
+        unsigned long nIndex;
+
+        for(size_t i = 1; i < nNeedles; i++)
+        {
+            Match0 = _mm256_or_si256(Match0, _mm256_cmpeq_epi8(Block0, NeedleVectors[i]));
+            Match1 = _mm256_or_si256(Match1, _mm256_cmpeq_epi8(Block1, NeedleVectors[i]));
+        }
+
+        // Verify all candidates, from the lowest address
+        Masks[0] = (unsigned int)_mm256_movemask_epi8(Match0);
+        Masks[1] = (unsigned int)_mm256_movemask_epi8(Match1);
+        for(size_t i = 0; i < 2; i++)
+        {
+            while(_BitScanForward(&nIndex, Masks[i]))
+            {
+                if((RefKeyword = Blob.CheckKeyword(pbScan + i * 32 + nIndex, dwKeywords)) != 0)
+                {
+                    pbScan = pbScan + i * 32 + nIndex;
+                    _mm256_zeroupper();
+                    return true;
+                }
+                Masks[i] &= (Masks[i] - 1);
+            }
+        }
+        pbScan += 64;
+    }
+
+    _mm256_zeroupper();
+    return false;
+}
+#endif  // PDF_SCAN_AVX2
+
+static LPBYTE AllocateVirtual(SIZE_T cbReserve, SIZE_T cbNeeded)
+{
+    LPBYTE pbBase;
+
+    // Reserve the range. If that much address space is not available, take just what is needed
+    cbReserve = (cbReserve < cbNeeded) ? cbNeeded : cbReserve;
+    cbReserve = (cbReserve + PDF_VIRTUAL_GRAIN - 1) & ~(SIZE_T)(PDF_VIRTUAL_GRAIN - 1);
+    if(cbReserve < cbNeeded)
+        return NULL;
+    if((pbBase = (LPBYTE)VirtualAlloc(NULL, cbReserve, MEM_RESERVE, PAGE_NOACCESS)) == NULL)
+    {
+        cbReserve = (cbNeeded + PDF_VIRTUAL_GRAIN - 1) & ~(SIZE_T)(PDF_VIRTUAL_GRAIN - 1);
+        if(cbReserve < cbNeeded || (pbBase = (LPBYTE)VirtualAlloc(NULL, cbReserve, MEM_RESERVE, PAGE_NOACCESS)) == NULL)
+            return NULL;
+    }
+
+    // Commit the pages for the header and the data
+    if(VirtualAlloc(pbBase, cbNeeded, MEM_COMMIT, PAGE_READWRITE) == NULL)
+    {
+        VirtualFree(pbBase, 0, MEM_RELEASE);
+        return NULL;
+    }
+    *(SIZE_T *)(pbBase) = cbReserve;
+    return pbBase;
+}
+
+static bool IsRegularLetter(BYTE OneByte)
+{
+    return ('a' <= OneByte && OneByte <= 'z') || ('A' <= OneByte && OneByte <= 'Z');
+}
+
 //-----------------------------------------------------------------------------
 // Constructor and destructor
 
@@ -22,24 +182,28 @@ TPdfBlob::TPdfBlob(LPBYTE pb0, LPBYTE pb1, bool bAllocate)
 
     // Setup the blob
     pbData = pbPtr = pbEnd = NULL;
+    bVirtual = false;
     SetData(pb0, pb1, bAllocate);
 }
 
 TPdfBlob::TPdfBlob(LPBYTE pb, size_t cb, bool bAllocate)
 {
     pbData = pbPtr = pbEnd = NULL;
+    bVirtual = false;
     SetData(pb, pb+cb, bAllocate);
 }
 
 TPdfBlob::TPdfBlob(const TPdfBlob & Source)
 {
     pbData = pbPtr = pbEnd = NULL;
+    bVirtual = false;
     SetData(Source);
 }
 
 TPdfBlob::TPdfBlob()
 {
     pbData = pbPtr = pbEnd = NULL;
+    bVirtual = false;
     SetData(NULL, NULL, false);
 }
 
@@ -66,7 +230,7 @@ DWORD TPdfBlob::SetData(LPCTSTR szFileName)
         // Retrieve the file size
         if(GetFileSizeEx(hFile, &FileSize))
         {
-            if(0x300 <= FileSize.QuadPart)
+            if(0x300 <= FileSize.QuadPart && (ULONGLONG)FileSize.QuadPart <= (SIZE_T)(-1))
             {
                 hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
                 if(hMap != NULL)
@@ -74,7 +238,7 @@ DWORD TPdfBlob::SetData(LPCTSTR szFileName)
                     pbFile = (LPBYTE)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
                     if(pbFile != NULL)
                     {
-                        dwErrCode = SetData(pbFile, pbFile + FileSize.LowPart, true);
+                        dwErrCode = SetData(pbFile, pbFile + (size_t)FileSize.QuadPart, true);
                         UnmapViewOfFile(pbFile);
                     }
                     else
@@ -121,7 +285,7 @@ DWORD TPdfBlob::SetData(LPBYTE pb0, LPBYTE pb1, bool bAllocate)
         pbData = pbPtr = pb0;
         pbEnd = pb1;
     }
-    return true;
+    return dwErrCode;
 }
 
 DWORD TPdfBlob::SetData(const TPdfBlob & Source)
@@ -135,11 +299,13 @@ void TPdfBlob::MoveFrom(TPdfBlob & Source)
     pbData = Source.pbData;
     pbEnd = Source.pbEnd;
     bAllocated = Source.bAllocated;
+    bVirtual = Source.bVirtual;
     ResetPosition();
 
     // Reset all variables in the source
     Source.pbData = Source.pbPtr = Source.pbEnd = NULL;
     Source.bAllocated = false;
+    Source.bVirtual = false;
 }
 
 bool TPdfBlob::SetPosition(LPBYTE pb)
@@ -160,7 +326,11 @@ void TPdfBlob::ResetPosition()
 
 void TPdfBlob::FreeData()
 {
-    if(pbData && bAllocated)
+    if(pbData && bAllocated && bVirtual)
+    {
+        VirtualFree(pbData - PDF_VIRTUAL_HEADER, 0, MEM_RELEASE);
+    }
+    else if(pbData && bAllocated)
     {
 #ifndef __DIAGNOSE_HEAP_ERRORS
         HeapFree(g_hHeap, 0, pbData);
@@ -171,25 +341,128 @@ void TPdfBlob::FreeData()
 
     pbData = pbPtr = pbEnd = NULL;
     bAllocated = false;
+    bVirtual = false;
+}
+
+DWORD TPdfBlob::CheckKeyword(LPBYTE pbKeyword, DWORD dwKeywords)
+{
+    size_t cbRemaining = (pbEnd - pbKeyword);
+
+    // Keywords must not be part of a longer word, e.g. "obj" in "endobj"
+    switch(pbKeyword[0])
+    {
+        case 0x0A:
+        case 0x0D:
+            return (dwKeywords & PDF_KEYWORD_EOL);
+
+        case '<':
+            return (cbRemaining >= 2 && pbKeyword[1] == '<') ? (dwKeywords & PDF_KEYWORD_DICT) : 0;
+
+        case 'o':
+            if((dwKeywords & PDF_KEYWORD_OBJ) && IsKeyword(pbKeyword, "obj", 3))
+                return PDF_KEYWORD_OBJ;
+            break;
+
+        case 's':
+            if((dwKeywords & PDF_KEYWORD_STREAM) && IsKeyword(pbKeyword, "stream", 6))
+                return PDF_KEYWORD_STREAM;
+            break;
+
+        case 'e':
+            if((dwKeywords & PDF_KEYWORD_ENDSTREAM) && IsKeyword(pbKeyword, "endstream", 9))
+                return PDF_KEYWORD_ENDSTREAM;
+            if((dwKeywords & PDF_KEYWORD_ENDOBJ) && IsKeyword(pbKeyword, "endobj", 6))
+                return PDF_KEYWORD_ENDOBJ;
+            break;
+    }
+    return 0;
+}
+
+bool TPdfBlob::IsKeyword(LPBYTE pbKeyword, LPCSTR szKeyword, size_t nLength)
+{
+    // Check the keyword itself
+    if((pbKeyword + nLength) > pbEnd || memcmp(pbKeyword, szKeyword, nLength))
+        return false;
+
+    // Check the character before. The character after is not checked,
+    // because broken PDFs may contain e.g. "endstreamendobj"
+    if(pbKeyword > pbData && IsRegularLetter(pbKeyword[-1]))
+        return false;
+    return true;
+}
+
+LPBYTE TPdfBlob::FindKeyword(DWORD dwKeywords, DWORD * PtrKeyword)
+{
+    LPBYTE pbScan = pbPtr;
+    size_t nNeedles = 0;
+    DWORD dwKeyword = 0;
+    BYTE Needles[PDF_MAX_NEEDLES];
+
+    // Sanity check
+    if(pbScan == NULL)
+        return NULL;
+
+    // Prepare the list of the first bytes of the keywords
+    if(dwKeywords & PDF_KEYWORD_EOL)
+    {
+        Needles[nNeedles++] = 0x0A;
+        Needles[nNeedles++] = 0x0D;
+    }
+    if(dwKeywords & PDF_KEYWORD_DICT)
+        Needles[nNeedles++] = '<';
+    if(dwKeywords & PDF_KEYWORD_OBJ)
+        Needles[nNeedles++] = 'o';
+    if(dwKeywords & PDF_KEYWORD_STREAM)
+        Needles[nNeedles++] = 's';
+    if(dwKeywords & (PDF_KEYWORD_ENDSTREAM | PDF_KEYWORD_ENDOBJ))
+        Needles[nNeedles++] = 'e';
+
+#ifdef PDF_SCAN_SSE2
+    // Scan the bulk of the data with the vector instructions
+    switch(GetSimdLevel())
+    {
+        case PDF_SIMD_AVX2:
+#ifdef PDF_SCAN_AVX2
+            if(FindKeyword_AVX2(*this, pbScan, Needles, nNeedles, dwKeywords, dwKeyword))
+                break;
+#endif
+            // No break here, the SSE2 code checks the rest
+
+        case PDF_SIMD_SSE2:
+            FindKeyword_SSE2(*this, pbScan, Needles, nNeedles, dwKeywords, dwKeyword);
+            break;
+    }
+#endif
+
+    // Check the remaining bytes one by one
+    while(dwKeyword == 0 && pbScan < pbEnd)
+    {
+        if((dwKeyword = CheckKeyword(pbScan, dwKeywords)) == 0)
+            pbScan++;
+    }
+
+    // Give the found keyword
+    if(PtrKeyword != NULL)
+        PtrKeyword[0] = dwKeyword;
+    return (dwKeyword != 0) ? pbScan : NULL;
 }
 
 LPBYTE TPdfBlob::FindEndOfLine()
 {
+    LPBYTE pbEndOfLine;
+
     // Find one of the EOL characters
-    while(pbPtr < pbEnd)
+    if((pbEndOfLine = FindKeyword(PDF_KEYWORD_EOL)) == NULL)
     {
-        if(pbPtr[0] == 0x0D || pbPtr[0] == 0x0A)
-        {
-            // Skip all EOLs
-            while((pbPtr < pbEnd) && (pbPtr[0] == 0x0D || pbPtr[0] == 0x0A))
-                pbPtr++;
-            return pbPtr;
-        }
+        pbPtr = pbEnd;
+        return NULL;
+    }
 
-        // Move to the next char
+    // Skip all EOLs
+    pbPtr = pbEndOfLine;
+    while((pbPtr < pbEnd) && (pbPtr[0] == 0x0D || pbPtr[0] == 0x0A))
         pbPtr++;
-    }
-    return NULL;
+    return pbPtr;
 }
 
 LPBYTE TPdfBlob::SkipEndOfLine()
@@ -206,6 +479,34 @@ LPBYTE TPdfBlob::SkipPdfSpaces()
     return pbPtr;
 }
 
+LPBYTE TPdfBlob::SkipWhiteSpaces()
+{
+    // PDF white-space characters: NUL, TAB, LF, FF, CR and SPACE
+    while((pbPtr < pbEnd) && (pbPtr[0] == 0x00 || pbPtr[0] == 0x09 || pbPtr[0] == 0x0A || pbPtr[0] == 0x0C || pbPtr[0] == 0x0D || pbPtr[0] == 0x20))
+        pbPtr++;
+    return pbPtr;
+}
+
+LPBYTE TPdfBlob::LoadInteger(ULONGLONG & RefValue)
+{
+    ULONGLONG Value = 0;
+    LPBYTE pbSavePtr;
+
+    // Skip the white spaces before the number
+    pbSavePtr = SkipWhiteSpaces();
+
+    // Parse the decimal number
+    while((pbPtr < pbEnd) && ('0' <= pbPtr[0] && pbPtr[0] <= '9'))
+        Value = Value * 10 + (*pbPtr++ - '0');
+
+    // There must be at least one digit
+    if(pbPtr == pbSavePtr)
+        return NULL;
+
+    RefValue = Value;
+    return pbPtr;
+}
+
 DWORD TPdfBlob::AppendBytes(LPCVOID pvData, size_t cbData)
 {
     // Shall we reallocate the buffer?
@@ -270,29 +571,19 @@ LPBYTE TPdfBlob::LoadOneLine(LPSTR szBuffer, size_t ccBuffer)
 {
     LPBYTE pbSavePtr = pbPtr;
     LPBYTE pbNextPtr = NULL;
+    DWORD dwKeyword = 0;
 
-    // Copy the line from the PDF
-    while(pbPtr < pbEnd)
+    // Find the end of the line. The line also ends at the begin of a dictionary.
+    if((pbPtr = FindKeyword(PDF_KEYWORD_EOL | PDF_KEYWORD_DICT, &dwKeyword)) != NULL)
     {
-        if(pbPtr + 2 <= pbEnd)
-        {
-            if(pbPtr[0] == '<' && pbPtr[1] == '<')
-            {
-                pbNextPtr = pbPtr + 2;
-                break;
-            }
-            if(pbPtr[0] == 0x0D && pbPtr[1] == 0x0A)
-            {
-                pbNextPtr = pbPtr + 2;
-                break;
-            }
-        }
-        if(pbPtr < pbEnd && (pbPtr[0] == 0x0A || pbPtr[0] == 0x0D))
-        {
+        if(dwKeyword == PDF_KEYWORD_DICT || (pbPtr[0] == 0x0D && (pbPtr + 2) <= pbEnd && pbPtr[1] == 0x0A))
+            pbNextPtr = pbPtr + 2;
+        else
             pbNextPtr = pbPtr + 1;
-            break;
-        }
-        pbPtr++;
+    }
+    else
+    {
+        pbPtr = pbEnd;
     }
 
     // Did we found a properly terminated EOL?
@@ -342,14 +633,15 @@ LPBYTE TPdfBlob::ReallocateBuffer(LPBYTE ptr, SIZE_T cbNewSize)
 {
     LPBYTE pbNewData = NULL;
 
+    // The new data are not zeroed. All callers write the whole buffer anyway
 #ifndef __DIAGNOSE_HEAP_ERRORS
     if(pbData == NULL)
     {
-        pbNewData = (LPBYTE)HeapAlloc(g_hHeap, HEAP_ZERO_MEMORY, cbNewSize);
+        pbNewData = (LPBYTE)HeapAlloc(g_hHeap, 0, cbNewSize);
     }
     else
     {
-        pbNewData = (LPBYTE)HeapReAlloc(g_hHeap, HEAP_ZERO_MEMORY, ptr, cbNewSize);
+        pbNewData = (LPBYTE)HeapReAlloc(g_hHeap, 0, ptr, cbNewSize);
         if(pbNewData == NULL)
         {
             HeapFree(g_hHeap, 0, pbData);
@@ -369,6 +661,55 @@ LPBYTE TPdfBlob::ReallocateBuffer(LPBYTE ptr, SIZE_T cbNewSize)
     return pbNewData;
 }
 
+LPBYTE TPdfBlob::ReallocateVirtual(SIZE_T cbNewSize)
+{
+    LPBYTE pbBase = (bVirtual && pbData != NULL) ? (pbData - PDF_VIRTUAL_HEADER) : NULL;
+    LPBYTE pbNewBase = NULL;
+    SIZE_T cbReserved = (pbBase != NULL) ? *(SIZE_T *)(pbBase) : 0;
+    SIZE_T cbNeeded = PDF_VIRTUAL_HEADER + cbNewSize;
+    SIZE_T cbOldSize = (pbData != NULL) ? Size() : 0;
+    SIZE_T cbCommitted;
+
+    // Within the reserved range, only the pages are committed or decommitted
+    if(pbBase != NULL && cbNeeded <= cbReserved)
+    {
+        if(cbNewSize >= cbOldSize)
+            return (LPBYTE)VirtualAlloc(pbBase, cbNeeded, MEM_COMMIT, PAGE_READWRITE) ? pbData : NULL;
+
+        // A range much bigger than the data would waste address space as long as the blob lives,
+        // which is long for decoded data kept in the cache. Such data are moved to a range of their size
+        if(cbReserved > PDF_VIRTUAL_RESERVE && cbNeeded < cbReserved / 4)
+            pbNewBase = AllocateVirtual(cbNeeded, cbNeeded);
+
+        // Give the pages that are not needed anymore back to the system
+        if(pbNewBase == NULL)
+        {
+            cbCommitted = (PDF_VIRTUAL_HEADER + cbOldSize + PDF_VIRTUAL_PAGE - 1) & ~(SIZE_T)(PDF_VIRTUAL_PAGE - 1);
+            cbNeeded = (cbNeeded + PDF_VIRTUAL_PAGE - 1) & ~(SIZE_T)(PDF_VIRTUAL_PAGE - 1);
+            if(cbCommitted > cbNeeded)
+                VirtualFree(pbBase + cbNeeded, cbCommitted - cbNeeded, MEM_DECOMMIT);
+            return pbData;
+        }
+    }
+    else
+    {
+        // Reserve a range big enough to let the buffer grow for a long time
+        if(cbNeeded < cbNewSize)
+            return NULL;
+        if((pbNewBase = AllocateVirtual(max(cbNeeded * 2, PDF_VIRTUAL_RESERVE), cbNeeded)) == NULL)
+            return NULL;
+    }
+
+    // Move the data from the heap or from the old range. While growing, this is the only copy
+    if(pbData != NULL)
+    {
+        memcpy(pbNewBase + PDF_VIRTUAL_HEADER, pbData, min(cbOldSize, cbNewSize));
+        FreeData();
+    }
+    bVirtual = true;
+    return pbNewBase + PDF_VIRTUAL_HEADER;
+}
+
 DWORD TPdfBlob::Resize(size_t cbNewSize)
 {
     LPBYTE pbNewData;
@@ -381,8 +722,12 @@ DWORD TPdfBlob::Resize(size_t cbNewSize)
         // Make sure there's at least one byte allocated
         cbNewSize = max(cbNewSize, 1);
 
-        // Reallocate the buffer
-        if((pbNewData = ReallocateBuffer(pbData, cbNewSize)) == NULL)
+        // Reallocate the buffer. Big buffers grow in the virtual memory
+        if(bVirtual || cbNewSize >= PDF_VIRTUAL_THRESHOLD)
+            pbNewData = ReallocateVirtual(cbNewSize);
+        else
+            pbNewData = ReallocateBuffer(pbData, cbNewSize);
+        if(pbNewData == NULL)
             return ERROR_NOT_ENOUGH_MEMORY;
 
         // Reconfigure the data
@@ -20,21 +20,6 @@ static LPCSTR SkipSpaces(LPCSTR szString)
     return szString;
 }
 
-static LPCSTR LoadOneBool(LPCSTR szString, int & nResult)
-{
-    if(!_strnicmp(szString, "true", 4))
-    {
-        nResult = 1;
-        return szString + 4;
-    }
-    if(!_strnicmp(szString, "false", 5))
-    {
-        nResult = 0;
-        return szString + 5;
-    }
-    return NULL;
-}
-
 static LPCSTR LoadOneInt(LPCSTR szString, int & nResult)
 {
     int nSignValue = 1;
@@ -81,114 +66,116 @@ static void FileTimeToDosFTime(DOS_FTIME & DosTime, const FILETIME & ft)
     DosTime.ft_tsec = (st.wSecond / 2);
 }
 
-static bool LoadOneString(LPSTR szBuffer, size_t ccBuffer, LPCSTR szPointer)
+static LPBYTE ParseObjectHeader(TPdfBlob & Blob, int & nObjectId)
 {
-    LPSTR szBufferEnd = szBuffer + ccBuffer - 1;
+    LPCSTR szCharPtr;
+    char szOneLine[256];
+    int nDummy = 0;
 
-    // Find the next slash character
-    while(szPointer[0] != 0 && szPointer[0] != '/' && szPointer[0] != '[')
-        szPointer++;
+    // Load the whole line
+    if((Blob.pbPtr = Blob.LoadOneLine(szOneLine, _countof(szOneLine))) == NULL)
+        return NULL;
+    szCharPtr = szOneLine;
 
-    // For compound encoding, load all encodings
-    if(szPointer[0] == '[')
-    {
-        // Skip the opening bracket
-        szPointer++;
+    // If the line was terminated by the begin of the dictionary ("1 0 obj<<"),
+    // move back so that the object parameters can be loaded
+    if(Blob.pbPtr[-1] == '<' && Blob.pbPtr[-2] == '<')
+        Blob.pbPtr -= 2;
 
-        // Copy the string
-        while(szBuffer < szBufferEnd && szPointer[0] != 0 && szPointer[0] != ']')
-            *szBuffer++ = *szPointer++;
-        szBuffer[0] = 0;
-        return true;
-    }
+    // Load the object ID
+    if((szCharPtr = LoadOneInt(szCharPtr, nObjectId)) == NULL)
+        return NULL;
 
-    // If there is a slash character, copy the subtype
-    if(szPointer[0] == '/')
-    {
-        if(szBuffer < szBufferEnd)
-            *szBuffer++ = *szPointer++;
+    // Load the second integer
+    if((szCharPtr = LoadOneInt(szCharPtr, nDummy)) == NULL)
+        return NULL;
 
-        while(szBuffer < szBufferEnd && szPointer[0] != '/' && isalnum(szPointer[0]))
-            *szBuffer++ = *szPointer++;
-        szBuffer[0] = 0;
-        return true;
-    }
-    return false;
+    // Check for the "obj". Trailing spaces are allowed
+    if(strncmp(szCharPtr = SkipSpaces(szCharPtr), "obj", 3))
+        return NULL;
+    return (SkipSpaces(szCharPtr + 3)[0] == 0) ? Blob.pbPtr : NULL;
 }
 
-LPCSTR GetObjectVariablePosition(LPCSTR szObjParams, LPCSTR szVariableName, bool bStringBeginAllowed = false)
-{
-    LPCSTR szVariablePos = szObjParams;
-
-    // Find the position of the variable
-    while((szVariablePos = strstr(szVariablePos, szVariableName)) != NULL)
-    {
-        // Move to the position of the integer value
-        szVariablePos = szVariablePos + strlen(szVariableName);
-
-        // Spaces are always allower
-        if(0x09 <= szVariablePos[0] && szVariablePos[0] <= 0x20)
-        {
-            return SkipSpaces(szVariablePos);
-        }
-
-        // For strings, we allow also the slash or '['
-        if(bStringBeginAllowed && (szVariablePos[0] == '/' || szVariablePos[0] == '['))
-        {
-            return szVariablePos;
-        }
-    }
+//-----------------------------------------------------------------------------
+// Parallel scan for object headers. Each thread searches one chunk of the file
+// for "obj" keywords and checks whether the line of the keyword is an object header.
 
-    // We did not find that variable in the object parameters
-    return NULL;
+struct TPdfScanChunk
+{
+    TPdfBlob * pPdfBlob;                    // The whole PDF file
+    LPBYTE pbChunkBegin;                    // Begin of the chunk scanned by the thread
+    LPBYTE pbChunkEnd;                      // End of the chunk scanned by the thread
+    std::vector<TPdfObjectHeader> Headers;  // Candidates found in the chunk, sorted by offset
+    DWORD dwErrCode;
+};
+
+static DWORD GetScanThreadCount(size_t cbToScan)
+{
+    size_t nMaxThreads = (cbToScan / PDF_MIN_SCAN_CHUNK);
+    DWORD dwThreads = TPdfDecodePool::GetThreadCount(g_Options.dwScanThreads);
+
+    // Small files are not worth the threads
+    if(dwThreads > nMaxThreads)
+        dwThreads = (DWORD)nMaxThreads;
+    if(dwThreads > MAXIMUM_WAIT_OBJECTS)
+        dwThreads = MAXIMUM_WAIT_OBJECTS;
+    return dwThreads;
 }
 
-bool GetObjectVariableInt(LPCSTR szObjParams, LPCSTR szVariableName, int & RefValue, int nDefaultValue, bool bBoolAllowed)
+static DWORD WINAPI FindObjectHeadersWorker(LPVOID lpParameter)
 {
-    LPCSTR szVariablePos;
-    int nResult = 0;
+    TPdfScanChunk * pChunk = (TPdfScanChunk *)lpParameter;
+    TPdfBlob * pPdfBlob = pChunk->pPdfBlob;
+    TPdfObjectHeader Header;
+    LPBYTE pbLineLimit = pPdfBlob->pbData;
+    LPBYTE pbLineBegin;
+    LPBYTE pbKeyword;
+    int nObjectId = 0;
 
-    // Find the position of the variable
-    if((szVariablePos = GetObjectVariablePosition(szObjParams, szVariableName)) != NULL)
+    // Both blobs span the whole file, so that the keyword checks can look at the preceding byte.
+    // The keyword that begins at the end of the chunk may reach into the next chunk.
+    TPdfBlob ScanBlob(pPdfBlob->pbData, pPdfBlob->pbEnd);
+    TPdfBlob LineBlob(pPdfBlob->pbData, pPdfBlob->pbEnd);
+    ScanBlob.pbPtr = pChunk->pbChunkBegin;
+    ScanBlob.pbEnd = min(pChunk->pbChunkEnd + 2, pPdfBlob->pbEnd);
+
+    try
     {
-        // Convert to integer
-        if(LoadOneInt(szVariablePos, nResult) != NULL)
+        while((pbKeyword = ScanBlob.FindKeyword(PDF_KEYWORD_OBJ)) != NULL && pbKeyword < pChunk->pbChunkEnd)
         {
-            RefValue = nResult;
-            return true;
-        }
+            // Find the begin of the line. The first line of the chunk may begin in the previous chunk
+            for(pbLineBegin = pbKeyword; pbLineBegin > pbLineLimit; pbLineBegin--)
+            {
+                if(pbLineBegin[-1] == 0x0A || pbLineBegin[-1] == 0x0D)
+                    break;
+            }
 
-        // Try to convert from Boolean, if allowed
-        if(bBoolAllowed && LoadOneBool(szVariablePos, nResult))
-        {
-            RefValue = nResult;
-            return true;
+            // If we stopped at the end of the previous keyword, both keywords are on the same line
+            Header.KeywordOffset = (pbKeyword - pPdfBlob->pbData);
+            if(pChunk->Headers.size() != 0 && pbLineBegin == pbLineLimit)
+            {
+                Header.LineOffset = pChunk->Headers.back().LineOffset;
+                Header.bIsHeader = pChunk->Headers.back().bIsHeader;
+            }
+            else
+            {
+                Header.LineOffset = (pbLineBegin - pPdfBlob->pbData);
+                LineBlob.SetPosition(pbLineBegin);
+                LineBlob.SkipEndOfLine();
+                Header.bIsHeader = (ParseObjectHeader(LineBlob, nObjectId) != NULL);
+            }
+            pChunk->Headers.push_back(Header);
+
+            // Continue after the keyword
+            ScanBlob.pbPtr = pbLineLimit = pbKeyword + 3;
         }
+        pChunk->dwErrCode = ERROR_SUCCESS;
     }
-
-    // Supply default value
-    RefValue = nDefaultValue;
-    return false;
-}
-
-bool GetObjectVariableString(LPCSTR szObjParams, LPCSTR szVariableName, LPSTR szBuffer, size_t ccBuffer, LPCSTR szDefaultValue)
-{
-    LPCSTR szVariablePos;
-
-    // Find the position of the variable
-    if((szVariablePos = GetObjectVariablePosition(szObjParams, szVariableName, true)) != NULL)
+    catch(std::bad_alloc)
     {
-        // Convert to integer
-        if(LoadOneString(szBuffer, ccBuffer, szVariablePos) != NULL)
-        {
-            return true;
-        }
+        pChunk->dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
     }
-
-    // Supply default value
-    if(szDefaultValue != NULL)
-        StringCchCopyA(szBuffer, ccBuffer, szDefaultValue);
-    return false;
+    return pChunk->dwErrCode;
 }
 
 //-----------------------------------------------------------------------------
@@ -213,7 +200,8 @@ TPdfDatabase * TPdfDatabase::Open(LPCWSTR szFileName, bool bFastCheck)
         // Retrieve the file size
         if(GetFileSizeEx(hFile, &FileSize))
         {
-            if(0x300 <= FileSize.QuadPart)
+            // On 32-bit systems, files bigger than the address space can't be mapped
+            if(0x300 <= FileSize.QuadPart && (ULONGLONG)FileSize.QuadPart <= (SIZE_T)(-1))
             {
                 hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
                 if(hMap != NULL)
@@ -221,9 +209,11 @@ TPdfDatabase * TPdfDatabase::Open(LPCWSTR szFileName, bool bFastCheck)
                     pbFile = (LPBYTE)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
                     if(pbFile != NULL)
                     {
-                        // Load the PDF database
-                        pPdfDb = Load(pbFile, (size_t)(FileSize.QuadPart), ft, bFastCheck);
-                        UnmapViewOfFile(pbFile);
+                        // Load the PDF database. If created, the database owns the view.
+                        // The mapping handle can be closed, the view keeps the mapping alive.
+                        pPdfDb = Load(pbFile, (size_t)(FileSize.QuadPart), ft, bFastCheck, true, szFileName);
+                        if(pPdfDb == NULL || pPdfDb == PDF_PVOID_TRUE)
+                            UnmapViewOfFile(pbFile);
                     }
                     CloseHandle(hMap);
                 }
@@ -234,7 +224,7 @@ TPdfDatabase * TPdfDatabase::Open(LPCWSTR szFileName, bool bFastCheck)
     return pPdfDb;
 }
 
-TPdfDatabase * TPdfDatabase::Load(LPBYTE pbFileData, size_t cbFileData, FILETIME & ft, bool bFastCheck)
+TPdfDatabase * TPdfDatabase::Load(LPBYTE pbFileData, size_t cbFileData, FILETIME & ft, bool bFastCheck, bool bMappedView, LPCWSTR szFileName)
 {
     TPdfDatabase * pPdfDb = NULL;
     TPdfBlob PdfFile(pbFileData, cbFileData);
@@ -256,7 +246,29 @@ TPdfDatabase * TPdfDatabase::Load(LPBYTE pbFileData, size_t cbFileData, FILETIME
                     return PDF_PVOID_TRUE;
 
                 // Construct the PDF Database object
-                pPdfDb = new TPdfDatabase(pbPdfBegin, pbPdfEnd, ft);
+                if((pPdfDb = new TPdfDatabase(pbFileData, pbPdfBegin, pbPdfEnd, ft, bMappedView)) != NULL)
+                {
+                    // If the same file has been listed before, the files are listed from the catalog cache
+                    if(szFileName != NULL && pPdfDb->LoadCatalogCache(szFileName, pbFileData, cbFileData, ft) == ERROR_SUCCESS)
+                        return pPdfDb;
+
+                    // Load the cross-reference table. If it's missing or broken,
+                    // we will fall back to the sequential scan of the file
+                    try
+                    {
+                        pPdfDb->LoadCrossReference();
+                    }
+                    catch(std::bad_alloc)
+                    {
+                        pPdfDb->m_Catalog.clear();
+                    }
+
+                    // For the sequential scan, find the object headers in parallel
+                    if(pPdfDb->m_Catalog.size() == 0)
+                    {
+                        pPdfDb->FindObjectHeaders();
+                    }
+                }
             }
         }
     }
@@ -268,14 +280,47 @@ TPdfDatabase * TPdfDatabase::Load(LPBYTE pbFileData, size_t cbFileData, FILETIME
 //-----------------------------------------------------------------------------
 // Member functions
 
-TPdfDatabase::TPdfDatabase(LPBYTE pbPdfBegin, LPBYTE pbPdfEnd, FILETIME & ft) : TPdfBlob(pbPdfBegin, pbPdfEnd, true)
+TPdfDatabase::TPdfDatabase(LPBYTE pbFileBegin, LPBYTE pbPdfBegin, LPBYTE pbPdfEnd, FILETIME & ft, bool bMappedView) : TPdfBlob(pbFileBegin, pbPdfEnd, !bMappedView)
 {
     // Initialize the object
     InitializeCriticalSection(&m_Lock);
+    InitializeCriticalSection(&m_DecodedLock);
     InitializeListHead(&m_Files);
+    InitializeListHead(&m_DecodedFiles);
+    memset(&m_DecodedStats, 0, sizeof(TPdfDecodedStats));
+    m_DecodedBytes = 0;
     m_MagicSignature = PDF_MAGIC_SIGNATURE;
+    m_nNextObject = 0;
+    m_nNextHeader = 0;
+    m_pDecodeTasks = NULL;
+    m_nNextLoaded = 0;
+    m_bAllLoaded = false;
+    m_bListComplete = false;
+    m_nIndexedFiles = 0;
+    m_bIndexComplete = true;
+    m_pLastFile = NULL;
+    m_pbMappedView = bMappedView ? pbFileBegin : NULL;
+    m_pCache = NULL;
+    m_pCacheEntries = NULL;
+    m_nCacheEntries = 0;
+    m_bListFromCache = false;
+    memset(&m_CacheKey, 0, sizeof(TPdfCacheHeader));
+    m_szCacheFile[0] = 0;
+    m_szFileName[0] = 0;
+    m_dwResolveDepth = 0;
+    m_dwSections = 0;
+    m_XrefOffset = 0;
     m_dwFiles = 0;
     m_dwRefs = 1;
+    InitializeListHead(&m_SharedEntry);
+    memset(&m_FileId, 0, sizeof(TPdfFileId));
+    m_dwHandles = 0;
+    m_dwClosedTime = 0;
+
+    // The blob contains the whole file, so the xref offsets can be applied directly.
+    // A view of a mapped file is used as-is, other data are copied.
+    // The sequential scan starts right after the "%PDF-1.x" header line
+    SetPosition(pbData + (pbPdfBegin - pbFileBegin));
 
     // Fill-in the PDF information
     FileTimeToDosFTime(m_FileTime, ft);
@@ -287,19 +332,38 @@ TPdfDatabase::~TPdfDatabase()
     assert(m_dwRefs == 0);
     RemoveAllFiles();
 
+    // The streams of the files pointed to the view, so it can only be unmapped now
+    if(m_pbMappedView != NULL)
+    {
+        FreeData();
+        UnmapViewOfFile(m_pbMappedView);
+        m_pbMappedView = NULL;
+    }
+
+    // Unmap the catalog cache
+    if(m_pCache != NULL)
+    {
+        UnmapViewOfFile(m_pCache);
+        m_pCache = NULL;
+    }
+
     // Free the rest of the object
+    DeleteCriticalSection(&m_DecodedLock);
     DeleteCriticalSection(&m_Lock);
 }
 
 TPdfDatabase * TPdfDatabase::FromHandle(HANDLE hHandle)
 {
+    TPdfArchive * pArchive;
     TPdfDatabase * pPdfDb;
 
     if(hHandle != NULL && hHandle != INVALID_HANDLE_VALUE)
     {
-        pPdfDb = static_cast<TPdfDatabase *>(hHandle);
-        if(pPdfDb->m_MagicSignature == PDF_MAGIC_SIGNATURE)
+        pArchive = static_cast<TPdfArchive *>(hHandle);
+        if(pArchive->m_MagicSignature == PDF_ARCHIVE_SIGNATURE)
         {
+            pPdfDb = pArchive->m_pPdfDb;
+            assert(pPdfDb->m_MagicSignature == PDF_MAGIC_SIGNATURE);
             EnterCriticalSection(&pPdfDb->m_Lock);
             pPdfDb->AddRef();
             return pPdfDb;
@@ -342,6 +406,16 @@ void TPdfDatabase::RemoveAllFiles()
     PLIST_ENTRY pHeadEntry = &m_Files;
     PLIST_ENTRY pListEntry;
 
+    // The decoded object streams hold references to their files
+    RemoveDecodedFiles();
+    FreeObjectStreams();
+
+    // Clear the list and the index of the files
+    m_Listed.clear();
+    m_FileIndex.clear();
+    m_nIndexedFiles = 0;
+    m_pLastFile = NULL;
+
     for(pListEntry = m_Files.Flink; pListEntry != pHeadEntry; )
     {
         // Get the reference to the file
@@ -354,245 +428,2199 @@ void TPdfDatabase::RemoveAllFiles()
     }
 }
 
-TPdfFile * TPdfDatabase::OpenNextFile()
+TPdfFile * TPdfDatabase::OpenNextFile(size_t & nNextFile)
 {
-    TPdfFile * pPdfFile = NULL;
+    TPdfFile * pPdfFile;
+
+    // Files that have already been listed through another archive handle are in the list
+    if(nNextFile < m_Listed.size())
+        return m_Listed[nNextFile++];
+
+    // Load the next file from the PDF
+    if(m_bListComplete || (pPdfFile = LoadNextFile()) == NULL)
+    {
+        m_bListComplete = true;
+        return NULL;
+    }
 
+    // Remember the file for the other archive handles
     try
     {
-        if((pPdfFile = OpenNextFile_SEQ()) != NULL)
-        {
-            InsertFile(pPdfFile);
-            pPdfFile->Release();
-        }
+        m_Listed.push_back(pPdfFile);
+        nNextFile++;
     }
     catch(std::bad_alloc)
     {
-        pPdfFile = NULL;
+        // The file is still returned, only the other handles won't see it
     }
     return pPdfFile;
 }
 
-TPdfFile * TPdfDatabase::ReferenceFile(LPCTSTR szPlainName)
+TPdfFile * TPdfDatabase::LoadNextFile()
 {
-    PLIST_ENTRY pHeadEntry = &m_Files;
-    PLIST_ENTRY pListEntry = &m_Files;
-    LPCTSTR szExtension = GetFileExtension(szPlainName);
-    LPCTSTR szFileIndex;
-    LPTSTR szEndPtr = NULL;
-    DWORD dwObjectId;
-    TCHAR szBuffer[32];
+    TPdfFile * pPdfFile = NULL;
+    DWORD dwThreads = TPdfDecodePool::GetThreadCount(g_Options.dwDecodeThreads);
 
-    // Check the digits after the last dash
-    szFileIndex = _tcsrchr(szPlainName, _T('-'));
-    if(szFileIndex > szPlainName && (szFileIndex + 1) < szExtension && isdigit(szFileIndex[1]))
+    // With more threads, all objects are loaded at once and the streams are decoded in parallel.
+    // Files listed from the catalog cache are decoded when extracted
+    if(dwThreads > 1 && m_bAllLoaded == false && m_bListFromCache == false)
+        LoadAllObjects(dwThreads);
+
+    // Return the files in the order in which they were loaded
+    if(m_bAllLoaded)
     {
-        // Skip the dash
-        if(szExtension - (szFileIndex = szFileIndex + 1) <= 10)
+        if(m_nNextLoaded < m_Loaded.size())
         {
-            // Convert the string to integer
-            StringCchCopyN(szBuffer, _countof(szBuffer), szFileIndex, (szExtension - szFileIndex));
-            dwObjectId = _tcstol(szBuffer, &szEndPtr, 10);
-
-            // Check the end of the integer
-            if(szEndPtr[0] == 0)
+            pPdfFile = m_Loaded[m_nNextLoaded++];
+        }
+    }
+    else
+    {
+        try
+        {
+            // Use the catalog cache or the cross-reference catalog, if we have one
+            if(m_bListFromCache)
+                pPdfFile = OpenNextFile_CACHE();
+            else
+                pPdfFile = (m_Catalog.size() != 0) ? OpenNextFile_XREF() : OpenNextFile_SEQ();
+
+            // Insert the file to the list. Its decoded data go to the LRU list
+            if(pPdfFile != NULL)
             {
-                // Find that file in the PDF
-                for(pListEntry = pHeadEntry->Flink; pListEntry != pHeadEntry; pListEntry = pListEntry->Flink)
-                {
-                    TPdfFile * pPdfFile = CONTAINING_RECORD(pListEntry, TPdfFile, m_Entry);
-
-                    if(pPdfFile->m_dwObjectId == dwObjectId)
-                    {
-                        return pPdfFile;
-                    }
-                }
+                InsertFile(pPdfFile);
+                InsertDecodedFile(pPdfFile);
+                pPdfFile->Release();
             }
         }
+        catch(std::bad_alloc)
+        {
+            // The list of files is incomplete, so it must not be cached
+            m_szCacheFile[0] = 0;
+            pPdfFile = NULL;
+        }
     }
-    return NULL;
+
+    // Make the file findable by ReferenceFile
+    if(pPdfFile != NULL)
+    {
+        IndexFile(pPdfFile);
+    }
+
+    // After the last file, save the list of files to the catalog cache
+    if(pPdfFile == NULL && m_szCacheFile[0] != 0)
+    {
+        SaveCatalogCache();
+        m_szCacheFile[0] = 0;
+    }
+    return pPdfFile;
 }
 
-void TPdfDatabase::UnlockAndRelease()
+static size_t GetFileHash(DWORD dwObjectId, DWORD dwRevision)
 {
-    Release();
-    LeaveCriticalSection(&m_Lock);
+    return (size_t)((dwObjectId * 0x9E3779B1) ^ (dwRevision * 0x85EBCA6B));
 }
 
-TPdfFile * TPdfDatabase::OpenNextFile_SEQ()
+// Inserts the file to the hash table. If there is a file with the same name, the first one wins
+static void InsertFileToIndex(std::vector<TPdfFile *> & FileIndex, size_t & nIndexedFiles, TPdfFile * pPdfFile)
 {
-    TPdfFile * pPdfFile;
+    size_t nMask = FileIndex.size() - 1;
 
-    // Try to locate the next object
-    while(!IsEof())
+    for(size_t i = GetFileHash(pPdfFile->m_dwObjectId, pPdfFile->m_dwRevision) & nMask; ; i = (i + 1) & nMask)
     {
-        // Check if this may be an object header
-        if(CheckBeginOfObject() != NULL)
-        {
-            if((pPdfFile = LoadPdfObject()) != NULL)
-            {
-                return pPdfFile;
-            }
-        }
-        else
+        if(FileIndex[i] == NULL)
         {
-            // Search the next 0x0A character
-            if(FindEndOfLine() == NULL)
-                break;
+            FileIndex[i] = pPdfFile;
+            nIndexedFiles++;
+            return;
         }
+
+        if(FileIndex[i]->m_dwObjectId == pPdfFile->m_dwObjectId && FileIndex[i]->m_dwRevision == pPdfFile->m_dwRevision)
+            return;
     }
-    return NULL;
 }
 
-TPdfFile * TPdfDatabase::LoadPdfObject()
+void TPdfDatabase::IndexFile(TPdfFile * pPdfFile)
 {
-    TPdfFile * pPdfFile = NULL;
-    LPBYTE pbObjectEnd;
-    LPSTR szObjParams;
-    int nObjectId = 0;
+    std::vector<TPdfFile *> NewIndex;
+    size_t nIndexedFiles = 0;
 
-    // Parse the header of the object
-    if(ParseBeginOfObject(nObjectId) == NULL)
-        return NULL;
+    // The file that has just been returned is most likely to be extracted next
+    m_pLastFile = pPdfFile;
 
-    // Load the object parameters
-    if((szObjParams = LoadObjectParameters()) != NULL)
+    if(m_bIndexComplete)
     {
-        // We only accept objects that are streams
-        // Either there is "stream" or "endobj". Note that not all PDFs have "stream\x0d\x0a".
-        // Example: 001f7e150598548000e088d61a8bc2806271d215b776c88fd9aa7793aaee2b01
-        if(IsBeginOfStream())
+        try
         {
-            // We need to save the pointer to the begin of the object
-            LPBYTE pbObjectPtr = pbPtr;
-
-            // Because the object length is pretty unreliable, we need to estimate the object length manually.
-            if((pbObjectEnd = FindEndOfStream(szObjParams)) != NULL)
+            // Keep the hash table at most half full
+            if((m_nIndexedFiles + 1) * 2 > m_FileIndex.size())
             {
-                // Calculate the length of the object
-                if((pPdfFile = new TPdfFile(pbObjectPtr, pbObjectEnd, nObjectId)) != NULL)
+                NewIndex.resize(max(m_FileIndex.size() * 2, (size_t)0x100));
+                for(size_t i = 0; i < m_FileIndex.size(); i++)
                 {
-                    if(pPdfFile->Load(szObjParams) != ERROR_SUCCESS)
+                    if(m_FileIndex[i] != NULL)
                     {
-                        pPdfFile->Release();
-                        pPdfFile = NULL;
+                        InsertFileToIndex(NewIndex, nIndexedFiles, m_FileIndex[i]);
                     }
                 }
+
+                m_FileIndex.swap(NewIndex);
+                m_nIndexedFiles = nIndexedFiles;
             }
 
-            // Skip the "endstream", if any
-            SkipEndOfStream();
+            // Insert the file
+            InsertFileToIndex(m_FileIndex, m_nIndexedFiles, pPdfFile);
+        }
+        catch(std::bad_alloc)
+        {
+            // FindFile will search the list of files instead
+            m_bIndexComplete = false;
         }
-
-        // Free the object parameters
-        HeapFree(g_hHeap, 0, szObjParams);
     }
-
-    // Skip the "endobj", if any
-    SkipEndOfObject();
-    return pPdfFile;
-}
-
-LPBYTE TPdfDatabase::CheckBeginOfObject()
-{
-    TPdfBlob TempBlob;
-    LPBYTE pbSavePtr;
-    LPBYTE pbResult = NULL;
-    int nObjectId = 0;
-
-    // Skip all EOLs
-    pbSavePtr = SkipEndOfLine();
-
-    // Check for "# # obj"
-    if(ParseBeginOfObject(nObjectId))
-        pbResult = pbSavePtr;
-    SetPosition(pbSavePtr);
-
-    // If failed, restore the position of the current pointer
-    return pbResult;
 }
 
-LPBYTE TPdfDatabase::ParseBeginOfObject(int & nObjectId)
+TPdfFile * TPdfDatabase::FindFile(DWORD dwObjectId, DWORD dwRevision)
 {
-    LPCSTR szCharPtr;
-    char szOneLine[256];
-    int nDummy = 0;
+    PLIST_ENTRY pHeadEntry = &m_Files;
+    PLIST_ENTRY pListEntry;
+    size_t nMask = m_FileIndex.size() - 1;
 
-    // Load the whole line
-    if((pbPtr = LoadOneLine(szOneLine, _countof(szOneLine))) == NULL)
-        return NULL;
-    szCharPtr = szOneLine;
+    // The file that has just been returned by ReadHeader is the most likely one
+    if(m_pLastFile != NULL && m_pLastFile->m_dwObjectId == dwObjectId && m_pLastFile->m_dwRevision == dwRevision)
+        return m_pLastFile;
 
-    // Load the object ID
-    if((szCharPtr = LoadOneInt(szCharPtr, nObjectId)) == NULL)
+    // Look in the hash table
+    if(m_bIndexComplete)
+    {
+        for(size_t i = GetFileHash(dwObjectId, dwRevision) & nMask; m_FileIndex.size() != 0 && m_FileIndex[i] != NULL; i = (i + 1) & nMask)
+        {
+            if(m_FileIndex[i]->m_dwObjectId == dwObjectId && m_FileIndex[i]->m_dwRevision == dwRevision)
+            {
+                return m_FileIndex[i];
+            }
+        }
         return NULL;
+    }
 
-    // Load the second integer
-    if((szCharPtr = LoadOneInt(szCharPtr, nDummy)) == NULL)
-        return NULL;
+    // Look in the list of files
+    for(pListEntry = pHeadEntry->Flink; pListEntry != pHeadEntry; pListEntry = pListEntry->Flink)
+    {
+        TPdfFile * pPdfFile = CONTAINING_RECORD(pListEntry, TPdfFile, m_Entry);
 
-    // Check for the "obj"
-    return (strcmp(SkipSpaces(szCharPtr), "obj") == 0) ? pbPtr : NULL;
+        if(pPdfFile->m_dwObjectId == dwObjectId && pPdfFile->m_dwRevision == dwRevision)
+        {
+            return pPdfFile;
+        }
+    }
+    return NULL;
 }
 
-LPSTR TPdfDatabase::LoadObjectParameters()
+DWORD TPdfDatabase::LoadAllObjects(DWORD dwThreads)
 {
-    LPSTR szObjectParameters = NULL;
-
-    // Check if there is an object specification
-    if(CheckData("<<", 2))
-    {
-        LPBYTE pbParamsBegin = pbPtr;
-        DWORD dwNestCount = 1;
+    std::vector<TPdfDecodeTask> Tasks;
+    std::vector<TPdfFile *> Failed;
+    TPdfFile * pPdfFile;
+    size_t nLoaded = 0;
+    DWORD dwErrCode = ERROR_SUCCESS;
+    bool bDecoded = false;
 
-        // Skip the opening sequence
-        pbPtr += 2;
+    // From now on, OpenNextFile only returns the loaded files
+    m_bAllLoaded = true;
 
-        // Keep looking for end of the object
-        while(pbPtr < (pbEnd - 2))
+    try
+    {
+        // Load all objects. The streams are queued instead of being decoded
+        m_pDecodeTasks = &Tasks;
+        while((pPdfFile = (m_Catalog.size() != 0) ? OpenNextFile_XREF() : OpenNextFile_SEQ()) != NULL)
         {
-            // Objects may be nested
-            if(pbPtr[0] == '<' && pbPtr[1] == '<')
-            {
-                pbPtr += 2;
-                dwNestCount++;
-                continue;
-            }
+            InsertFile(pPdfFile);
+            pPdfFile->Release();
+            m_Loaded.push_back(pPdfFile);
+        }
+        m_pDecodeTasks = NULL;
 
-            if(pbPtr[0] == '>' && pbPtr[1] == '>')
-            {
-                // Can't go to negative nest level
-                if(dwNestCount == 0)
-                    return NULL;
-                pbPtr += 2;
+        // Decode all queued streams. The list of the failed ones is allocated before
+        Failed.reserve(Tasks.size());
+        TPdfDecodePool(Tasks).Run(dwThreads);
+        bDecoded = true;
+    }
+    catch(std::bad_alloc)
+    {
+        m_pDecodeTasks = NULL;
+        m_szCacheFile[0] = 0;
+        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    }
 
-                // If we are at the closing sign, allocate the buffer and return the string
-                if(dwNestCount-- == 1)
-                {
-                    size_t ccObjectParameters = (pbPtr - pbParamsBegin);
+    // Collect the files that failed to decode. The tasks can't be paired with the loaded files
+    // by their position, because not every loaded file has a task
+    if(bDecoded)
+    {
+        for(size_t i = 0; i < Tasks.size(); i++)
+        {
+            if(Tasks[i].dwErrCode != ERROR_SUCCESS)
+                Failed.push_back(Tasks[i].pPdfFile);
+        }
+        std::sort(Failed.begin(), Failed.end());
+    }
 
-                    // Allocate buffer with the object parameters
-                    szObjectParameters = (LPSTR)HeapAlloc(g_hHeap, 0, ccObjectParameters + 1);
-                    if(szObjectParameters != NULL)
-                    {
-                        memcpy(szObjectParameters, pbParamsBegin, ccObjectParameters);
-                        szObjectParameters[ccObjectParameters] = 0;
-                    }
+    // Remove the files that failed to decode, like LoadPdfObject does.
+    // If the streams haven't been decoded at all, no file is kept
+    for(size_t i = 0; i < m_Loaded.size(); i++)
+    {
+        pPdfFile = m_Loaded[i];
 
-                    // Skip the end of the line and return what we got
-                    SkipPdfSpaces();
-                    SkipEndOfLine();
-                    break;
-                }
-                continue;
-            }
-            pbPtr++;
+        if(bDecoded == false || std::binary_search(Failed.begin(), Failed.end(), pPdfFile))
+        {
+            pPdfFile->Release();
+            continue;
         }
+        m_Loaded[nLoaded++] = pPdfFile;
     }
-    return szObjectParameters;
+    m_Loaded.resize(nLoaded);
+    return dwErrCode;
 }
 
-LPBYTE TPdfDatabase::IsBeginOfStream()
+DWORD TPdfDatabase::QueueDecodeTask(TPdfFile * pPdfFile, const TPdfDict & ObjParams)
+{
+    TPdfDecodeTask Task;
+
+    // Until the task is done, the file counts as failed
+    Task.pPdfFile = pPdfFile;
+    Task.dwErrCode = ERROR_CAN_NOT_COMPLETE;
+    Task.bPrepare = g_Options.bLazyDecode;
+    Task.bExactSize = g_Options.bExactSizes;
+
+    // The object parameters point to the PDF data, so they stay valid
+    try
+    {
+        Task.ObjParams = ObjParams;
+        m_pDecodeTasks->push_back(Task);
+    }
+    catch(std::bad_alloc)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    return ERROR_SUCCESS;
+}
+
+TPdfFile * TPdfDatabase::ReferenceFile(LPCTSTR szFileName)
+{
+    TPdfFile * pPdfFile;
+    LPCTSTR szPlainName = GetPlainName(szFileName);
+    LPCTSTR szExtension = GetFileExtension(szPlainName);
+    LPCTSTR szFileIndex;
+    LPTSTR szEndPtr = NULL;
+    DWORD dwRevision = 0;
+    DWORD dwObjectId;
+    TCHAR szBuffer[32];
+
+    // Files of older revisions are in the "rev-N" folders
+    if(szPlainName > szFileName)
+    {
+        LPCTSTR szFolderName = szPlainName - 1;
+
+        while(szFolderName > szFileName && szFolderName[-1] != _T('\\') && szFolderName[-1] != _T('/'))
+            szFolderName--;
+        if(!_tcsnicmp(szFolderName, _T("rev-"), 4))
+            dwRevision = _tcstol(szFolderName + 4, NULL, 10);
+    }
+
+    // Check the digits after the last dash
+    szFileIndex = _tcsrchr(szPlainName, _T('-'));
+    if(szFileIndex > szPlainName && (szFileIndex + 1) < szExtension && isdigit(szFileIndex[1]))
+    {
+        // Skip the dash
+        if(szExtension - (szFileIndex = szFileIndex + 1) <= 10)
+        {
+            // Convert the string to integer
+            StringCchCopyN(szBuffer, _countof(szBuffer), szFileIndex, (szExtension - szFileIndex));
+            dwObjectId = _tcstol(szBuffer, &szEndPtr, 10);
+
+            // Check the end of the integer
+            if(szEndPtr[0] == 0)
+            {
+                // Find that file in the PDF. If the revision folder doesn't match any,
+                // the folder name is not ours, so try the live revision
+                for(;;)
+                {
+                    if((pPdfFile = FindFile(dwObjectId, dwRevision)) != NULL)
+                        return pPdfFile;
+
+                    if(dwRevision == 0)
+                        break;
+                    dwRevision = 0;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+void TPdfDatabase::UnlockAndRelease()
+{
+    Release();
+    LeaveCriticalSection(&m_Lock);
+}
+
+//-----------------------------------------------------------------------------
+// Decoded data of the files. They are kept in the LRU list within the budget,
+// the evicted ones are decoded again from the PDF data when needed.
+
+DWORD TPdfDatabase::DecodeFile(TPdfFile * pPdfFile)
+{
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER StartTime;
+    LARGE_INTEGER EndTime;
+    DWORD dwErrCode;
+
+    // Already decoded: Just move the file to the end of the LRU list
+    if(pPdfFile->IsDecoded())
+    {
+        m_DecodedStats.Hits++;
+        InsertDecodedFile(pPdfFile);
+        return ERROR_SUCCESS;
+    }
+
+    // Decode the file and measure how long it took
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&StartTime);
+    dwErrCode = pPdfFile->Decode();
+    QueryPerformanceCounter(&EndTime);
+
+    m_DecodedStats.Misses++;
+    m_DecodedStats.DecodeTime += (ULONGLONG)(EndTime.QuadPart - StartTime.QuadPart) * 1000000 / (ULONGLONG)Frequency.QuadPart;
+
+    if(dwErrCode == ERROR_SUCCESS)
+        InsertDecodedFile(pPdfFile);
+    return dwErrCode;
+}
+
+DWORD TPdfDatabase::OpenFileStream(TPdfFile * pPdfFile, TPdfFilterChain & Chain)
+{
+    DWORD dwErrCode;
+
+    // Decoded data are read from memory, the other files are decoded while being read
+    if(pPdfFile->IsDecoded())
+        m_DecodedStats.Hits++;
+    else
+        m_DecodedStats.Misses++;
+
+    // Files that can't be streamed are decoded to memory by OpenStream
+    if((dwErrCode = pPdfFile->OpenStream(Chain)) == ERROR_SUCCESS)
+        InsertDecodedFile(pPdfFile);
+    return dwErrCode;
+}
+
+void TPdfDatabase::InsertDecodedFile(TPdfFile * pPdfFile)
+{
+    std::map<DWORD, TPdfObjectStream>::iterator iter;
+
+    // Only allocated data that can be decoded again are subject to eviction.
+    // Data of plain streams point to the PDF file, so they cost nothing.
+    if(pPdfFile->IsDecoded() && pPdfFile->bAllocated && pPdfFile->CanDecodeAgain())
+    {
+        EnterCriticalSection(&m_DecodedLock);
+
+        // Objects are sliced from the decoded object streams, so these must stay
+        iter = m_ObjStreams.find(pPdfFile->m_dwObjectId);
+        if(iter == m_ObjStreams.end() || iter->second.pPdfFile != pPdfFile)
+        {
+            // Move the file to the end of the LRU list
+            if(pPdfFile->m_DecodedEntry.Flink != NULL)
+                RemoveEntryList(&pPdfFile->m_DecodedEntry);
+            else
+                m_DecodedBytes += pPdfFile->Size();
+            InsertTailList(&m_DecodedFiles, &pPdfFile->m_DecodedEntry);
+
+            // Free the least recently used data that don't fit the budget
+            m_DecodedStats.PeakBytes = max(m_DecodedStats.PeakBytes, m_DecodedBytes);
+            EvictDecodedFiles(pPdfFile);
+        }
+
+        LeaveCriticalSection(&m_DecodedLock);
+    }
+}
+
+void TPdfDatabase::EvictDecodedFiles(TPdfFile * pKeepFile)
+{
+    ULONGLONG MaxBytes = (ULONGLONG)g_Options.dwDecodedCacheSize * 0x100000;
+    TPdfFile * pPdfFile;
+
+    // The file that has just been used stays, even if it is bigger than the budget
+    while(MaxBytes != 0 && m_DecodedBytes > MaxBytes && m_DecodedFiles.Flink != &m_DecodedFiles)
+    {
+        pPdfFile = CONTAINING_RECORD(m_DecodedFiles.Flink, TPdfFile, m_DecodedEntry);
+        if(pPdfFile == pKeepFile)
+            break;
+
+        // Remove the file from the LRU list and free its decoded data
+        RemoveEntryList(&pPdfFile->m_DecodedEntry);
+        pPdfFile->m_DecodedEntry.Flink = pPdfFile->m_DecodedEntry.Blink = NULL;
+        m_DecodedBytes -= pPdfFile->Size();
+        m_DecodedStats.Evictions++;
+        pPdfFile->Unload();
+    }
+}
+
+void TPdfDatabase::RemoveDecodedFiles()
+{
+    PLIST_ENTRY pListEntry;
+
+#ifdef _DEBUG
+    // Report how the decoded data were used
+    if(m_DecodedStats.Hits != 0 || m_DecodedStats.Misses != 0)
+    {
+        WCHAR szMessage[256];
+
+        StringCchPrintfW(szMessage, _countof(szMessage), L"wcx_pdf: Decoded data: %I64u hits, %I64u misses (%I64u ms decoding), %I64u evictions, %I64u KB peak\n",
+                         m_DecodedStats.Hits,
+                         m_DecodedStats.Misses,
+                         m_DecodedStats.DecodeTime / 1000,
+                         m_DecodedStats.Evictions,
+                         m_DecodedStats.PeakBytes / 1024);
+        OutputDebugStringW(szMessage);
+    }
+#endif  // _DEBUG
+
+    // Unlink all files from the LRU list. Their data are freed together with the files
+    while((pListEntry = m_DecodedFiles.Flink) != &m_DecodedFiles)
+    {
+        RemoveEntryList(pListEntry);
+        pListEntry->Flink = pListEntry->Blink = NULL;
+    }
+
+    memset(&m_DecodedStats, 0, sizeof(TPdfDecodedStats));
+    m_DecodedBytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Cross-reference table
+
+static bool CompareObjectId(const TPdfObjectRef & Ref1, const TPdfObjectRef & Ref2)
+{
+    // For the same object, the newer section must go first.
+    // Within the same section (hybrid files), in-use entries take precedence over free ones
+    if(Ref1.dwObjectId == Ref2.dwObjectId)
+    {
+        if(Ref1.dwSection == Ref2.dwSection)
+            return (Ref1.bInUse && !Ref2.bInUse);
+        return (Ref1.dwSection < Ref2.dwSection);
+    }
+    return (Ref1.dwObjectId < Ref2.dwObjectId);
+}
+
+static ULONGLONG LoadXrefField(LPBYTE pbField, size_t cbField, ULONGLONG DefaultValue)
+{
+    ULONGLONG Value = 0;
+
+    // Zero-width fields have default values
+    if(cbField == 0)
+        return DefaultValue;
+
+    // Fields are stored in big-endian order
+    for(size_t i = 0; i < cbField; i++)
+        Value = (Value << 8) | pbField[i];
+    return Value;
+}
+
+static DWORD ApplyPngPredictor(TPdfBlob & Output, TPdfBlob & Input, size_t nColumns)
+{
+    LPBYTE pbPrevRow = NULL;
+    size_t nRows;
+    DWORD dwErrCode;
+
+    // Each row has at least one column
+    if(nColumns == 0)
+        return ERROR_BAD_FORMAT;
+    nRows = Input.Size() / (nColumns + 1);
+
+    // Each row begins with the predictor type byte
+    if((dwErrCode = Output.Resize(nRows * nColumns)) != ERROR_SUCCESS)
+        return dwErrCode;
+
+    // The xref streams always have one byte per pixel
+    for(size_t nRow = 0; nRow < nRows; nRow++)
+    {
+        LPBYTE pbInput = Input.pbData + nRow * (nColumns + 1);
+        LPBYTE pbRow = Output.pbData + nRow * nColumns;
+        BYTE PredictorType = *pbInput++;
+
+        for(size_t i = 0; i < nColumns; i++)
+        {
+            BYTE Left = (i > 0) ? pbRow[i - 1] : 0;
+            BYTE Up = (pbPrevRow != NULL) ? pbPrevRow[i] : 0;
+            BYTE UpLeft = (pbPrevRow != NULL && i > 0) ? pbPrevRow[i - 1] : 0;
+
+            switch(PredictorType)
+            {
+                case 0:     // None
+                    pbRow[i] = pbInput[i];
+                    break;
+
+                case 1:     // Sub
+                    pbRow[i] = pbInput[i] + Left;
+                    break;
+
+                case 2:     // Up
+                    pbRow[i] = pbInput[i] + Up;
+                    break;
+
+                case 3:     // Average
+                    pbRow[i] = pbInput[i] + (BYTE)((Left + Up) / 2);
+                    break;
+
+                case 4:     // Paeth
+                {
+                    int p  = Left + Up - UpLeft;
+                    int pa = abs(p - Left);
+                    int pb = abs(p - Up);
+                    int pc = abs(p - UpLeft);
+
+                    pbRow[i] = pbInput[i] + (BYTE)((pa <= pb && pa <= pc) ? Left : (pb <= pc) ? Up : UpLeft);
+                    break;
+                }
+
+                default:
+                    return ERROR_BAD_FORMAT;
+            }
+        }
+        pbPrevRow = pbRow;
+    }
+    return ERROR_SUCCESS;
+}
+
+static bool CompareObjectOffset(const TPdfObjectRef & Ref1, const TPdfObjectRef & Ref2)
+{
+    return (Ref1.ObjectOffset < Ref2.ObjectOffset);
+}
+
+LPBYTE TPdfDatabase::FindStartXref()
+{
+    LPBYTE pbStartXref = pbEnd - 9;
+    size_t nCharCount = 0;
+
+    // The "startxref" keyword is near the end of the file. Don't go too far.
+    while(pbStartXref > pbData && nCharCount < 0x400)
+    {
+        if(pbStartXref[0] == 's' && !memcmp(pbStartXref, "startxref", 9))
+            return pbStartXref + 9;
+        nCharCount++;
+        pbStartXref--;
+    }
+    return NULL;
+}
+
+DWORD TPdfDatabase::LoadXrefTable(DWORD dwSection, TPdfDict & Trailer)
+{
+    TPdfObjectRef ObjRef = {0};
+    ULONGLONG FirstObject = 0;
+    ULONGLONG ObjectCount = 0;
+    ULONGLONG ObjectOffset = 0;
+    ULONGLONG Generation = 0;
+
+    // Skip the "xref" keyword
+    pbPtr += 4;
+    ObjRef.dwSection = dwSection;
+
+    // Load all subsections. Each one begins with "first-object object-count"
+    while(LoadInteger(FirstObject) && LoadInteger(ObjectCount))
+    {
+        // Sanity check for the object count
+        if(ObjectCount > (ULONGLONG)(pbEnd - pbPtr) / 18)
+            return ERROR_BAD_FORMAT;
+
+        // Load all entries. Each of them is "nnnnnnnnnn ggggg n"
+        for(ULONGLONG i = 0; i < ObjectCount; i++)
+        {
+            if(!LoadInteger(ObjectOffset) || !LoadInteger(Generation))
+                return ERROR_BAD_FORMAT;
+            if(SkipWhiteSpaces() >= pbEnd || (pbPtr[0] != 'n' && pbPtr[0] != 'f'))
+                return ERROR_BAD_FORMAT;
+
+            // Insert the entry to the catalog
+            ObjRef.ObjectOffset = ObjectOffset;
+            ObjRef.dwObjectId = (DWORD)(FirstObject + i);
+            ObjRef.dwGeneration = (DWORD)(Generation);
+            ObjRef.bInUse = (*pbPtr++ == 'n');
+            m_Catalog.push_back(ObjRef);
+        }
+    }
+
+    // The table must be followed by the trailer dictionary
+    if(SkipWhiteSpaces() + 7 > pbEnd || memcmp(pbPtr, "trailer", 7))
+        return ERROR_BAD_FORMAT;
+    pbPtr += 7;
+    SkipWhiteSpaces();
+
+    // Load the trailer dictionary
+    if(LoadObjectParameters(Trailer) == NULL)
+        return ERROR_BAD_FORMAT;
+    return ERROR_SUCCESS;
+}
+
+DWORD TPdfDatabase::LoadXrefStream(DWORD dwSection, TPdfDict & Trailer)
+{
+    std::vector<ULONGLONG> Widths;
+    std::vector<ULONGLONG> Index;
+    TPdfObjectRef ObjRef = {0};
+    TPdfFile * pXrefData = NULL;
+    TPdfDict DecodeParms;
+    TPdfDict ObjParams;
+    TPdfBlob XrefData;
+    LPBYTE pbStreamBegin;
+    LPBYTE pbStreamEnd;
+    DWORD dwErrCode = ERROR_BAD_FORMAT;
+    char szType[32];
+    int nObjectId = 0;
+    int nPredictor = 1;
+    int nColumns = 1;
+    int nSize = 0;
+
+    // The stream is an ordinary object "N G obj << /Type /XRef ... >> stream"
+    if(ParseBeginOfObject(nObjectId) == NULL)
+        return ERROR_BAD_FORMAT;
+    if(LoadObjectParameters(ObjParams) == NULL)
+        return ERROR_BAD_FORMAT;
+    ObjRef.dwSection = dwSection;
+
+    // Check the type of the object and load the widths of the fields
+    ObjParams.GetName("/Type", szType, _countof(szType));
+    ObjParams.GetInt("/Size", nSize);
+    if(!strcmp(szType, "/XRef") && ObjParams.GetArray("/W", Widths) && Widths.size() == 3 && IsBeginOfStream())
+    {
+        size_t cbEntry = (size_t)(Widths[0] + Widths[1] + Widths[2]);
+
+        // Default value of the /Index is [0 Size]
+        if(!ObjParams.GetArray("/Index", Index) || Index.size() == 0)
+        {
+            Index.push_back(0);
+            Index.push_back(nSize);
+        }
+
+        // Decode the stream data. Note that the "/Length" in xref streams is always direct.
+        pbStreamBegin = pbPtr;
+        if(cbEntry != 0 && Widths[0] <= 8 && Widths[1] <= 8 && Widths[2] <= 8 && (pbStreamEnd = FindEndOfStream(ObjParams)) != NULL)
+        {
+            if((pXrefData = new(m_Arena) TPdfFile(pbStreamBegin, pbStreamEnd, nObjectId)) != NULL)
+            {
+                if((dwErrCode = pXrefData->Load(ObjParams)) == ERROR_SUCCESS)
+                {
+                    // Xref streams are usually compressed with the PNG "Up" predictor.
+                    // Each predicted row must be one entry. Other predictors are not supported
+                    ObjParams.GetDecodeParms(0, DecodeParms);
+                    DecodeParms.GetInt("/Predictor", nPredictor, 1);
+                    DecodeParms.GetInt("/Columns", nColumns, 1);
+                    if(nPredictor >= 10 && nPredictor <= 15 && nColumns > 0 && (size_t)nColumns == cbEntry)
+                        dwErrCode = ApplyPngPredictor(XrefData, *pXrefData, (size_t)nColumns);
+                    else if(nPredictor == 1)
+                        XrefData.MoveFrom(*pXrefData);
+                    else
+                        dwErrCode = ERROR_BAD_FORMAT;
+                }
+                pXrefData->Release();
+            }
+        }
+
+        // Parse the entries. Each subsection in the /Index has a pair of "first-object object-count"
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            LPBYTE pbEntry = XrefData.pbData;
+
+            for(size_t i = 0; i + 1 < Index.size(); i += 2)
+            {
+                for(ULONGLONG j = 0; j < Index[i + 1]; j++, pbEntry += cbEntry)
+                {
+                    LPBYTE pbField2 = pbEntry + Widths[0];
+                    LPBYTE pbField3 = pbField2 + Widths[1];
+                    ULONGLONG EntryType;
+
+                    // Check whether we are still within the data
+                    if(pbEntry + cbEntry > XrefData.pbEnd)
+                        break;
+                    EntryType = LoadXrefField(pbEntry, (size_t)Widths[0], 1);
+                    ObjRef.dwObjectId = (DWORD)(Index[i] + j);
+
+                    switch(EntryType)
+                    {
+                        case 0:     // Free object
+                            ObjRef.ObjectOffset = 0;
+                            ObjRef.dwGeneration = (DWORD)LoadXrefField(pbField3, (size_t)Widths[2], 0);
+                            ObjRef.dwObjStmId = ObjRef.dwObjStmIndex = 0;
+                            ObjRef.bInUse = false;
+                            break;
+
+                        case 1:     // Uncompressed object
+                            ObjRef.ObjectOffset = LoadXrefField(pbField2, (size_t)Widths[1], 0);
+                            ObjRef.dwGeneration = (DWORD)LoadXrefField(pbField3, (size_t)Widths[2], 0);
+                            ObjRef.dwObjStmId = ObjRef.dwObjStmIndex = 0;
+                            ObjRef.bInUse = true;
+                            break;
+
+                        case 2:     // Compressed object, stored in an object stream
+                            ObjRef.ObjectOffset = 0;
+                            ObjRef.dwGeneration = 0;
+                            ObjRef.dwObjStmId = (DWORD)LoadXrefField(pbField2, (size_t)Widths[1], 0);
+                            ObjRef.dwObjStmIndex = (DWORD)LoadXrefField(pbField3, (size_t)Widths[2], 0);
+                            ObjRef.bInUse = true;
+                            break;
+
+                        default:    // Unknown types shall be ignored
+                            continue;
+                    }
+
+                    m_Catalog.push_back(ObjRef);
+                }
+            }
+        }
+    }
+
+    // The stream dictionary also serves as the trailer
+    if(dwErrCode == ERROR_SUCCESS)
+        Trailer = ObjParams;
+    return dwErrCode;
+}
+
+bool TPdfDatabase::VerifyObjectRef(const TPdfObjectRef & ObjRef)
+{
+    LPBYTE pbSavePtr = pbPtr;
+    bool bResult;
+    int nObjectId = 0;
+
+    // Compressed objects are verified when their object stream is loaded
+    if(ObjRef.dwObjStmId != 0)
+        return true;
+
+    // The offset must be within the file
+    if(ObjRef.ObjectOffset >= (ULONGLONG)(pbEnd - pbData))
+        return false;
+
+    // Check for "N G obj" of the same object
+    SetPosition(pbData + (size_t)ObjRef.ObjectOffset);
+    SkipWhiteSpaces();
+    bResult = (ParseBeginOfObject(nObjectId) != NULL && (DWORD)nObjectId == ObjRef.dwObjectId);
+    SetPosition(pbSavePtr);
+    return bResult;
+}
+
+bool TPdfDatabase::VerifyCatalog()
+{
+    // Every in-use entry must point to the header of the proper object
+    for(size_t i = 0; i < m_Catalog.size(); i++)
+    {
+        if(!VerifyObjectRef(m_Catalog[i]))
+            return false;
+    }
+    return true;
+}
+
+// If pPrevCache is given, only the xref sections appended after the cached file are loaded.
+// The numbers of all objects in these sections, including the free ones, go to pUpdatedIds.
+DWORD TPdfDatabase::LoadCrossReference(const TPdfCacheHeader * pPrevCache, std::vector<DWORD> * pUpdatedIds)
+{
+    std::vector<ULONGLONG> XrefOffsets;
+    LPBYTE pbSavePtr = pbPtr;
+    ULONGLONG XrefOffset = 0;
+    DWORD dwPrevSections = (pPrevCache != NULL) ? pPrevCache->dwSections : 0;
+    DWORD dwErrCode = ERROR_BAD_FORMAT;
+    DWORD dwSections = 0;
+    bool bReachedPrev = false;
+
+    // Locate the "startxref" and load the offset of the newest xref section
+    if((pbPtr = FindStartXref()) != NULL && LoadInteger(XrefOffset))
+    {
+        // Load all xref sections, chained by the "/Prev" entry in the trailer
+        m_XrefOffset = XrefOffset;
+        for(DWORD dwSection = 0; dwSection + dwPrevSections < PDF_MAX_XREF_SECTIONS; dwSection++)
+        {
+            TPdfDict Trailer;
+            LONGLONG nXrefStmOffset = 0;
+            LONGLONG nPrevOffset = 0;
+
+            // The sections of the cached file are already known
+            if(pPrevCache != NULL && XrefOffset < pPrevCache->FileSize)
+            {
+                bReachedPrev = (XrefOffset == pPrevCache->XrefOffset);
+                dwErrCode = ERROR_SUCCESS;
+                break;
+            }
+
+            // Check the offset for validity and for infinite loops
+            if(XrefOffset >= (ULONGLONG)(pbEnd - pbData))
+                break;
+            if(std::find(XrefOffsets.begin(), XrefOffsets.end(), XrefOffset) != XrefOffsets.end())
+                break;
+            XrefOffsets.push_back(XrefOffset);
+
+            // The section is either a classic "xref" table or a cross-reference stream (PDF 1.5+)
+            SetPosition(pbData + (size_t)XrefOffset);
+            SkipWhiteSpaces();
+            if(CheckData("xref", 4))
+            {
+                if((dwErrCode = LoadXrefTable(dwSection, Trailer)) != ERROR_SUCCESS)
+                    break;
+
+                // Hybrid files have additional entries in a cross-reference stream
+                if(Trailer.GetInt("/XRefStm", nXrefStmOffset) && 0 < nXrefStmOffset && nXrefStmOffset < (pbEnd - pbData))
+                {
+                    TPdfDict XrefStmTrailer;
+
+                    SetPosition(pbData + (size_t)nXrefStmOffset);
+                    SkipWhiteSpaces();
+                    LoadXrefStream(dwSection, XrefStmTrailer);
+                }
+            }
+            else
+            {
+                if((dwErrCode = LoadXrefStream(dwSection, Trailer)) != ERROR_SUCCESS)
+                    break;
+            }
+
+            // Move to the previous xref section, if any
+            dwSections = dwSection + 1;
+            if(!Trailer.GetInt("/Prev", nPrevOffset) || nPrevOffset < 0)
+                nPrevOffset = -1;
+            if(nPrevOffset == -1)
+                break;
+            XrefOffset = (ULONGLONG)nPrevOffset;
+        }
+    }
+
+    // The chain of the appended sections must end with the newest section of the cached file
+    if(pPrevCache != NULL && bReachedPrev == false)
+        dwErrCode = ERROR_BAD_FORMAT;
+
+    // Remember all objects that have been updated
+    if(dwErrCode == ERROR_SUCCESS && pUpdatedIds != NULL)
+    {
+        for(size_t i = 0; i < m_Catalog.size(); i++)
+            pUpdatedIds->push_back(m_Catalog[i].dwObjectId);
+        std::sort(pUpdatedIds->begin(), pUpdatedIds->end());
+        pUpdatedIds->erase(std::unique(pUpdatedIds->begin(), pUpdatedIds->end()), pUpdatedIds->end());
+    }
+
+    // Keep only the newest version of each object in the live catalog. Free entries hide older versions too.
+    // Older versions of uncompressed objects go to the history, so they can be shown as older revisions
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        std::vector<TPdfObjectRef> Catalog;
+        size_t nNewest = 0;
+
+        std::stable_sort(m_Catalog.begin(), m_Catalog.end(), CompareObjectId);
+        for(size_t i = 0; i < m_Catalog.size(); i++)
+        {
+            const TPdfObjectRef & ObjRef = m_Catalog[i];
+
+            if(i == 0 || ObjRef.dwObjectId != m_Catalog[i - 1].dwObjectId)
+            {
+                if(ObjRef.bInUse && (ObjRef.ObjectOffset != 0 || ObjRef.dwObjStmId != 0))
+                {
+                    Catalog.push_back(ObjRef);
+                }
+                nNewest = i;
+                continue;
+            }
+
+            // Older version of the object. Ignore entries that repeat an offset of a newer version
+            if(ObjRef.bInUse && ObjRef.dwObjStmId == 0 && ObjRef.ObjectOffset != 0)
+            {
+                bool bSuperseded = true;
+
+                for(size_t j = nNewest; j < i; j++)
+                {
+                    if(m_Catalog[j].bInUse && m_Catalog[j].ObjectOffset == ObjRef.ObjectOffset)
+                    {
+                        bSuperseded = false;
+                        break;
+                    }
+                }
+
+                if(bSuperseded && VerifyObjectRef(ObjRef))
+                {
+                    m_History.push_back(ObjRef);
+                }
+            }
+        }
+
+        // Objects will be loaded in the order in which they are in the file
+        std::sort(Catalog.begin(), Catalog.end(), CompareObjectOffset);
+        std::sort(m_History.begin(), m_History.end(), CompareObjectOffset);
+        m_Catalog.swap(Catalog);
+        m_dwSections = dwSections + dwPrevSections;
+
+        // Verify whether the catalog entries point to the objects
+        if(!VerifyCatalog())
+            dwErrCode = ERROR_FILE_CORRUPT;
+
+        // Create the index for looking up objects by their number
+        for(size_t i = 0; i < m_Catalog.size(); i++)
+            m_ObjectIndex.push_back(std::make_pair(m_Catalog[i].dwObjectId, i));
+        std::sort(m_ObjectIndex.begin(), m_ObjectIndex.end());
+    }
+
+    // If anything went wrong, we will use the sequential scan
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        m_ObjectIndex.clear();
+        m_History.clear();
+        m_Catalog.clear();
+        m_dwSections = 0;
+    }
+    m_nNextObject = 0;
+    SetPosition(pbSavePtr);
+    return dwErrCode;
+}
+
+//-----------------------------------------------------------------------------
+// Object streams and indirect references
+
+const TPdfObjectRef * TPdfDatabase::FindObject(DWORD dwObjectId)
+{
+    std::vector<std::pair<DWORD, size_t> >::iterator iter;
+
+    // The index is sorted by the object number
+    iter = std::lower_bound(m_ObjectIndex.begin(), m_ObjectIndex.end(), std::make_pair(dwObjectId, (size_t)0));
+    if(iter != m_ObjectIndex.end() && iter->first == dwObjectId)
+        return &m_Catalog[iter->second];
+    return NULL;
+}
+
+TPdfObjectStream * TPdfDatabase::LoadObjectStream(DWORD dwObjStmId)
+{
+    std::map<DWORD, TPdfObjectStream>::iterator iter;
+    const TPdfObjectRef * pObjRef;
+    TPdfFile * pPdfFile;
+    LPBYTE pbSavePtr = pbPtr;
+
+    // Was the object stream already decoded?
+    if((iter = m_ObjStreams.find(dwObjStmId)) != m_ObjStreams.end())
+        return &iter->second;
+
+    // Object streams cannot be stored in another object streams
+    if((pObjRef = FindObject(dwObjStmId)) == NULL || pObjRef->dwObjStmId != 0)
+        return NULL;
+    if(m_dwResolveDepth >= PDF_MAX_RESOLVE_DEPTH)
+        return NULL;
+
+    // Load the object. If it is an object stream, it will be inserted to the map
+    SetPosition(pbData + (size_t)pObjRef->ObjectOffset);
+    SkipWhiteSpaces();
+    m_dwResolveDepth++;
+    if((pPdfFile = LoadPdfObject()) != NULL)
+        pPdfFile->Release();
+    m_dwResolveDepth--;
+    SetPosition(pbSavePtr);
+
+    // Give the object stream, if it was inserted
+    iter = m_ObjStreams.find(dwObjStmId);
+    return (iter != m_ObjStreams.end()) ? &iter->second : NULL;
+}
+
+void TPdfDatabase::InsertObjectStream(TPdfFile * pPdfFile, const TPdfDict & ObjParams)
+{
+    std::vector<size_t> Offsets;
+    std::vector<DWORD> ObjectIds;
+    TPdfBlob Header(pPdfFile->pbData, pPdfFile->pbEnd);
+    ULONGLONG ObjectId = 0;
+    ULONGLONG ObjectOffset = 0;
+    int nObjects = 0;
+    int nFirst = 0;
+
+    // Don't insert the same object stream twice
+    if(m_ObjStreams.find(pPdfFile->m_dwObjectId) != m_ObjStreams.end())
+        return;
+
+    // Get the number of objects and the offset of the first one
+    ObjParams.GetInt("/N", nObjects);
+    ObjParams.GetInt("/First", nFirst);
+    if(nObjects <= 0 || nFirst <= 0 || (size_t)nFirst > Header.Size())
+        return;
+
+    // The header of the stream contains pairs of "object-number offset"
+    for(int i = 0; i < nObjects; i++)
+    {
+        if(!Header.LoadInteger(ObjectId) || !Header.LoadInteger(ObjectOffset))
+            break;
+        if(ObjectOffset > (ULONGLONG)(Header.Size() - nFirst))
+            break;
+
+        ObjectIds.push_back((DWORD)ObjectId);
+        Offsets.push_back((size_t)(nFirst + ObjectOffset));
+    }
+
+    // Keep the decoded data. Objects are sliced from it without copying
+    TPdfObjectStream & ObjStm = m_ObjStreams[pPdfFile->m_dwObjectId];
+    ObjStm.ObjectIds.swap(ObjectIds);
+    ObjStm.Offsets.swap(Offsets);
+    ObjStm.pPdfFile = pPdfFile;
+    pPdfFile->AddRef();
+}
+
+void TPdfDatabase::FreeObjectStreams()
+{
+    std::map<DWORD, TPdfObjectStream>::iterator iter;
+
+    for(iter = m_ObjStreams.begin(); iter != m_ObjStreams.end(); iter++)
+        iter->second.pPdfFile->Release();
+    m_ObjStreams.clear();
+}
+
+DWORD TPdfDatabase::LoadIndirectObject(DWORD dwObjectId, TPdfBlob & Object)
+{
+    const TPdfObjectRef * pObjRef;
+    TPdfObjectStream * pObjStm;
+
+    // Find the object in the catalog
+    if((pObjRef = FindObject(dwObjectId)) == NULL)
+        return ERROR_FILE_NOT_FOUND;
+
+    // Compressed object: Give the slice of the decoded object stream
+    if(pObjRef->dwObjStmId != 0)
+    {
+        DWORD dwIndex = pObjRef->dwObjStmIndex;
+
+        if((pObjStm = LoadObjectStream(pObjRef->dwObjStmId)) == NULL)
+            return ERROR_FILE_CORRUPT;
+        if(dwIndex >= pObjStm->ObjectIds.size() || pObjStm->ObjectIds[dwIndex] != dwObjectId)
+            return ERROR_FILE_CORRUPT;
+
+        // The object ends where the next one begins
+        LPBYTE pbObjBegin = pObjStm->pPdfFile->pbData + pObjStm->Offsets[dwIndex];
+        LPBYTE pbObjEnd = pObjStm->pPdfFile->pbEnd;
+        if((dwIndex + 1) < pObjStm->Offsets.size() && pObjStm->Offsets[dwIndex + 1] >= pObjStm->Offsets[dwIndex])
+            pbObjEnd = pObjStm->pPdfFile->pbData + pObjStm->Offsets[dwIndex + 1];
+        return Object.SetData(pbObjBegin, pbObjEnd, false);
+    }
+    else
+    {
+        TPdfBlob Header(pbData + (size_t)pObjRef->ObjectOffset, pbEnd);
+        ULONGLONG ObjectId = 0;
+        ULONGLONG Generation = 0;
+
+        // Uncompressed object: Skip the "N G obj" and give the rest of the file.
+        // The caller only parses as much as it needs.
+        if(!Header.LoadInteger(ObjectId) || !Header.LoadInteger(Generation) || ObjectId != dwObjectId)
+            return ERROR_FILE_CORRUPT;
+        Header.SkipWhiteSpaces();
+        if(!Header.CheckData("obj", 3))
+            return ERROR_FILE_CORRUPT;
+        return Object.SetData(Header.pbPtr + 3, pbEnd, false);
+    }
+}
+
+bool TPdfDatabase::GetIndirectVariableInt(const TPdfDict & ObjParams, LPCSTR szVariableName, LONGLONG & RefValue)
+{
+    TPdfBlob Object;
+    ULONGLONG Value = 0;
+    DWORD dwObjectId = 0;
+    bool bResult = false;
+
+    // Is the value an indirect reference ("N G R")?
+    if(m_ObjectIndex.size() && m_dwResolveDepth < PDF_MAX_RESOLVE_DEPTH && ObjParams.GetRef(szVariableName, dwObjectId))
+    {
+        m_dwResolveDepth++;
+        if(LoadIndirectObject(dwObjectId, Object) == ERROR_SUCCESS && Object.LoadInteger(Value) && Value <= 0x7FFFFFFFFFFFFFFFULL)
+        {
+            RefValue = (LONGLONG)Value;
+            bResult = true;
+        }
+        m_dwResolveDepth--;
+    }
+
+    // Direct value
+    return bResult ? true : ObjParams.GetInt(szVariableName, RefValue);
+}
+
+//-----------------------------------------------------------------------------
+// Catalog cache. After the PDF has been listed, the list of files is saved
+// to the cache directory, so the next open of the same file doesn't scan it again
+
+// Extensions of the files in the catalog cache, by their index
+static LPCTSTR CacheExtensions[] =
+{
+    _T(".dat"), _T(".xml"), _T(".tif"), _T(".pbm"), _T(".jpg"), _T(".pdf")
+};
+
+// 64-bit FNV-1a hash
+static ULONGLONG HashData(ULONGLONG Hash, LPCVOID pvData, size_t cbData)
+{
+    LPBYTE pbData = (LPBYTE)pvData;
+
+    for(size_t i = 0; i < cbData; i++)
+        Hash = (Hash ^ pbData[i]) * 0x100000001B3ULL;
+    return Hash;
+}
+
+// Hash of the begin and the end of the first cbFileData bytes of the PDF file
+static ULONGLONG GetFingerprint(LPBYTE pbFileData, size_t cbFileData)
+{
+    ULONGLONG Fingerprint = 0xCBF29CE484222325ULL;
+    size_t cbFingerprint = min(cbFileData, (size_t)PDF_CACHE_FINGERPRINT);
+
+    Fingerprint = HashData(Fingerprint, pbFileData, cbFingerprint);
+    Fingerprint = HashData(Fingerprint, pbFileData + cbFileData - cbFingerprint, cbFingerprint);
+    return Fingerprint;
+}
+
+static bool CompareCacheEntries(const TPdfCacheEntry & Entry1, const TPdfCacheEntry & Entry2)
+{
+    return (Entry1.ObjectOffset < Entry2.ObjectOffset);
+}
+
+// Describes the file for the catalog cache. Files without the position of the object can't be cached
+static bool GetCacheEntry(TPdfFile * pPdfFile, LPBYTE pbFileData, TPdfCacheEntry & Entry)
+{
+    memset(&Entry, 0, sizeof(TPdfCacheEntry));
+
+    // We need to know where the object parameters are, so the file can be decoded later
+    if(pPdfFile->m_pbObject == NULL || pPdfFile->m_pbParamsBegin == NULL || (ULONGLONG)(pPdfFile->m_pbParamsEnd - pPdfFile->m_pbParamsBegin) > 0xFFFFFFFF)
+        return false;
+
+    // The extension is stored as an index
+    while(Entry.dwExtension < _countof(CacheExtensions) && _tcscmp(pPdfFile->m_szExtension, CacheExtensions[Entry.dwExtension]))
+        Entry.dwExtension++;
+    if(Entry.dwExtension >= _countof(CacheExtensions))
+        return false;
+
+    Entry.ObjectOffset = (ULONGLONG)(pPdfFile->m_pbObject - pbFileData);
+    Entry.RawOffset = (ULONGLONG)(pPdfFile->m_pbRawData - pbFileData);
+    Entry.RawSize = (ULONGLONG)(pPdfFile->m_pbRawEnd - pPdfFile->m_pbRawData);
+    Entry.FileSize = pPdfFile->FileSize();
+    Entry.ParamsOffset = (ULONGLONG)(pPdfFile->m_pbParamsBegin - pbFileData);
+    Entry.cbParams = (DWORD)(pPdfFile->m_pbParamsEnd - pPdfFile->m_pbParamsBegin);
+    Entry.dwObjectId = pPdfFile->m_dwObjectId;
+    Entry.dwRevision = pPdfFile->m_dwRevision;
+    Entry.dwObjectRevision = pPdfFile->m_dwRevision;
+    return true;
+}
+
+// Options that change the file list
+static DWORD GetCacheOptions()
+{
+    DWORD dwOptions = 0;
+
+    if(g_Options.bShowRevisions)
+        dwOptions |= PDF_CACHE_SHOW_REVISIONS;
+    if(g_Options.bLazyDecode)
+        dwOptions |= PDF_CACHE_LAZY_DECODE;
+    if(g_Options.bExactSizes)
+        dwOptions |= PDF_CACHE_EXACT_SIZES;
+    return dwOptions;
+}
+
+DWORD TPdfDatabase::LoadCatalogCache(LPCWSTR szFileName, LPBYTE pbFileData, size_t cbFileData, FILETIME & ft)
+{
+    TPdfCacheHeader * pCache = NULL;
+    LARGE_INTEGER CacheSize = {0};
+    ULONGLONG PathHash = 0xCBF29CE484222325ULL;
+    size_t nLength;
+    HANDLE hFile;
+    HANDLE hMap;
+
+    // Is the catalog cache enabled?
+    if(g_Options.szCacheDir[0] == 0)
+        return ERROR_NOT_SUPPORTED;
+
+    // The cache file is named by the hash of the full path of the PDF. Windows paths are case-insensitive
+    nLength = GetFullPathNameW(szFileName, _countof(m_szFileName), m_szFileName, NULL);
+    if(nLength == 0 || nLength >= _countof(m_szFileName))
+        return ERROR_BUFFER_OVERFLOW;
+    for(size_t i = 0; i < nLength; i++)
+    {
+        WCHAR chOneChar = towupper(m_szFileName[i]);
+        PathHash = HashData(PathHash, &chOneChar, sizeof(WCHAR));
+    }
+    StringCchCopyW(m_szCacheFile, _countof(m_szCacheFile), g_Options.szCacheDir);
+    AddBackslash(m_szCacheFile, _countof(m_szCacheFile));
+    nLength = wcslen(m_szCacheFile);
+    StringCchPrintfW(m_szCacheFile + nLength, _countof(m_szCacheFile) - nLength, L"%016I64X.pdfcat", PathHash);
+
+    // Identity of the PDF file. The header and the trailer at the begin and the end
+    // of the file are hashed too, because updates may keep the size and the time
+    m_CacheKey.dwSignature = PDF_CACHE_SIGNATURE;
+    m_CacheKey.dwVersion = PDF_CACHE_VERSION;
+    m_CacheKey.dwOptions = GetCacheOptions();
+    m_CacheKey.FileSize = cbFileData;
+    m_CacheKey.FileTime = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    m_CacheKey.Fingerprint = GetFingerprint(pbFileData, cbFileData);
+    m_CacheKey.cchFileName = (DWORD)wcslen(m_szFileName);
+
+    // Map the cache file, if there is any
+    hFile = CreateFileW(m_szCacheFile, FILE_READ_DATA, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if(hFile != INVALID_HANDLE_VALUE)
+    {
+        if(GetFileSizeEx(hFile, &CacheSize) && (ULONGLONG)CacheSize.QuadPart >= sizeof(TPdfCacheHeader) && (ULONGLONG)CacheSize.QuadPart <= (SIZE_T)(-1))
+        {
+            if((hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL)
+            {
+                pCache = (TPdfCacheHeader *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(hMap);
+            }
+        }
+        CloseHandle(hFile);
+    }
+
+    // The cache must belong to this very file and it must have been made with the same options
+    if(pCache != NULL)
+    {
+        TPdfCacheHeader CacheKey = m_CacheKey;
+        LPCWSTR szCachedName = (LPCWSTR)((TPdfCacheEntry *)(pCache + 1) + pCache->dwEntries);
+        ULONGLONG ExpectedSize = sizeof(TPdfCacheHeader) + (ULONGLONG)pCache->dwEntries * sizeof(TPdfCacheEntry) + (CacheKey.cchFileName + 1) * sizeof(WCHAR);
+
+        CacheKey.dwEntries = pCache->dwEntries;
+        CacheKey.dwSections = pCache->dwSections;
+        CacheKey.XrefOffset = pCache->XrefOffset;
+        if((ULONGLONG)CacheSize.QuadPart == ExpectedSize && !_wcsnicmp(szCachedName, m_szFileName, CacheKey.cchFileName + 1))
+        {
+            if(!memcmp(pCache, &CacheKey, sizeof(TPdfCacheHeader)))
+            {
+                // The files will be listed from the cache, so there's nothing to save
+                m_pCache = pCache;
+                m_pCacheEntries = (TPdfCacheEntry *)(pCache + 1);
+                m_nCacheEntries = pCache->dwEntries;
+                m_bListFromCache = true;
+                m_nNextObject = 0;
+                m_szCacheFile[0] = 0;
+                return ERROR_SUCCESS;
+            }
+
+            // If the PDF has only grown by incremental updates, the cached file must be its unchanged begin
+            CacheKey.FileSize = pCache->FileSize;
+            CacheKey.FileTime = pCache->FileTime;
+            CacheKey.Fingerprint = pCache->Fingerprint;
+            if(pCache->FileSize < cbFileData && pCache->Fingerprint == GetFingerprint(pbFileData, (size_t)pCache->FileSize))
+            {
+                if(!memcmp(pCache, &CacheKey, sizeof(TPdfCacheHeader)) && LoadAppendedObjects(pCache) == ERROR_SUCCESS)
+                {
+                    // The merged list of files will be saved to the cache after it's listed
+                    UnmapViewOfFile(pCache);
+                    return ERROR_SUCCESS;
+                }
+            }
+        }
+        UnmapViewOfFile(pCache);
+    }
+    return ERROR_FILE_NOT_FOUND;
+}
+
+ULONGLONG TPdfDatabase::GetHeaderOffset(ULONGLONG ObjectOffset)
+{
+    LPBYTE pbSavePtr = pbPtr;
+    ULONGLONG HeaderOffset;
+
+    // Xref entries may point to the white space before the object header
+    SetPosition(pbData + (size_t)ObjectOffset);
+    HeaderOffset = (ULONGLONG)(SkipWhiteSpaces() - pbData);
+    SetPosition(pbSavePtr);
+    return HeaderOffset;
+}
+
+DWORD TPdfDatabase::LoadAppendedObjects(const TPdfCacheHeader * pPrevCache)
+{
+    const TPdfCacheEntry * pPrevEntries = (const TPdfCacheEntry *)(pPrevCache + 1);
+    std::vector<std::pair<DWORD, ULONGLONG> > NewObjects;
+    std::vector<TPdfCacheEntry> Superseded;
+    std::vector<TPdfCacheEntry> History;
+    std::vector<DWORD> UpdatedIds;
+    std::vector<DWORD> KeptIds;
+    TPdfCacheEntry Entry;
+    size_t nCachedLive;
+    size_t nCachedHistory;
+    TPdfFile * pPdfFile;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Files found by the sequential scan are not tied to the xref sections, so they are scanned again
+    if(pPrevCache->dwSections == 0)
+        return ERROR_NOT_SUPPORTED;
+
+    // Load only the xref sections appended after the cached file.
+    // If they don't chain to the cached file, the whole PDF is loaded again.
+    try
+    {
+        if((dwErrCode = LoadCrossReference(pPrevCache, &UpdatedIds)) != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+    catch(std::bad_alloc)
+    {
+        m_ObjectIndex.clear();
+        m_History.clear();
+        m_Catalog.clear();
+        m_dwSections = 0;
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    try
+    {
+        // Positions of the uncompressed objects in the appended sections, by object number
+        for(size_t i = 0; i < m_Catalog.size(); i++)
+        {
+            if(m_Catalog[i].dwObjStmId == 0)
+                NewObjects.push_back(std::make_pair(m_Catalog[i].dwObjectId, GetHeaderOffset(m_Catalog[i].ObjectOffset)));
+        }
+        for(size_t i = 0; i < m_History.size(); i++)
+            NewObjects.push_back(std::make_pair(m_History[i].dwObjectId, GetHeaderOffset(m_History[i].ObjectOffset)));
+        std::sort(NewObjects.begin(), NewObjects.end());
+
+        // Cached files of the objects that have not been updated stay as they are
+        for(DWORD i = 0; i < pPrevCache->dwEntries; i++)
+        {
+            Entry = pPrevEntries[i];
+
+            if(std::binary_search(UpdatedIds.begin(), UpdatedIds.end(), Entry.dwObjectId))
+            {
+                const TPdfObjectRef * pObjRef = FindObject(Entry.dwObjectId);
+
+                // The appended section only repeats the live object
+                if(Entry.dwRevision == 0 && pObjRef != NULL && pObjRef->dwObjStmId == 0 && GetHeaderOffset(pObjRef->ObjectOffset) == Entry.ObjectOffset)
+                {
+                    Entry.dwObjectRevision = m_dwSections - pObjRef->dwSection;
+                    KeptIds.push_back(Entry.dwObjectId);
+                    m_CacheEntries.push_back(Entry);
+                    continue;
+                }
+
+                // The object is repeated by an appended section, so it will be loaded from there
+                if(std::binary_search(NewObjects.begin(), NewObjects.end(), std::make_pair(Entry.dwObjectId, Entry.ObjectOffset)))
+                    continue;
+
+                // The live object has been superseded, so it's an older revision now
+                if(Entry.dwRevision == 0)
+                {
+                    Entry.dwRevision = Entry.dwObjectRevision;
+                    if(g_Options.bShowRevisions)
+                        Superseded.push_back(Entry);
+                    continue;
+                }
+            }
+
+            if(Entry.dwRevision == 0)
+                m_CacheEntries.push_back(Entry);
+            else
+                History.push_back(Entry);
+        }
+        std::sort(KeptIds.begin(), KeptIds.end());
+
+        // The cache has the live files sorted, followed by the older revisions sorted
+        nCachedLive = m_CacheEntries.size();
+        nCachedHistory = History.size();
+        History.insert(History.end(), Superseded.begin(), Superseded.end());
+        std::inplace_merge(History.begin(), History.begin() + nCachedHistory, History.end(), CompareCacheEntries);
+        nCachedHistory = History.size();
+
+        // Load the appended objects of the live revision
+        for(size_t i = 0; i < m_Catalog.size() && dwErrCode == ERROR_SUCCESS; i++)
+        {
+            const TPdfObjectRef & ObjRef = m_Catalog[i];
+
+            if(ObjRef.dwObjStmId == 0 && !std::binary_search(KeptIds.begin(), KeptIds.end(), ObjRef.dwObjectId))
+            {
+                SetPosition(pbData + (size_t)ObjRef.ObjectOffset);
+                SkipWhiteSpaces();
+                if((pPdfFile = LoadPdfObject()) != NULL)
+                {
+                    if(GetCacheEntry(pPdfFile, pbData, Entry))
+                    {
+                        Entry.dwObjectRevision = m_dwSections - ObjRef.dwSection;
+                        m_CacheEntries.push_back(Entry);
+                    }
+                    else
+                    {
+                        dwErrCode = ERROR_NOT_SUPPORTED;
+                    }
+                    pPdfFile->Release();
+                }
+            }
+        }
+
+        // Load the superseded versions from the appended sections
+        for(size_t i = 0; i < m_History.size() && g_Options.bShowRevisions && dwErrCode == ERROR_SUCCESS; i++)
+        {
+            const TPdfObjectRef & ObjRef = m_History[i];
+
+            SetPosition(pbData + (size_t)ObjRef.ObjectOffset);
+            SkipWhiteSpaces();
+            if((pPdfFile = LoadPdfObject(m_dwSections - ObjRef.dwSection)) != NULL)
+            {
+                if(GetCacheEntry(pPdfFile, pbData, Entry))
+                    History.push_back(Entry);
+                else
+                    dwErrCode = ERROR_NOT_SUPPORTED;
+                pPdfFile->Release();
+            }
+        }
+
+        // The files are listed in the same order as if the whole PDF was loaded:
+        // the live objects by their position in the file, then the older revisions.
+        // The cached entries are already sorted, so only the loaded ones are merged in.
+        std::sort(m_CacheEntries.begin() + nCachedLive, m_CacheEntries.end(), CompareCacheEntries);
+        std::inplace_merge(m_CacheEntries.begin(), m_CacheEntries.begin() + nCachedLive, m_CacheEntries.end(), CompareCacheEntries);
+        std::sort(History.begin() + nCachedHistory, History.end(), CompareCacheEntries);
+        std::inplace_merge(History.begin(), History.begin() + nCachedHistory, History.end(), CompareCacheEntries);
+        m_CacheEntries.insert(m_CacheEntries.end(), History.begin(), History.end());
+    }
+    catch(std::bad_alloc)
+    {
+        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // On failure, forget everything and let the whole PDF be loaded
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        m_CacheEntries.clear();
+        m_ObjectIndex.clear();
+        m_History.clear();
+        m_Catalog.clear();
+        m_dwSections = 0;
+        FreeObjectStreams();
+        return dwErrCode;
+    }
+
+    // List the files from the merged entries
+    m_pCacheEntries = (m_CacheEntries.size() != 0) ? &m_CacheEntries[0] : NULL;
+    m_nCacheEntries = m_CacheEntries.size();
+    m_bListFromCache = true;
+    m_nNextObject = 0;
+    return ERROR_SUCCESS;
+}
+
+DWORD TPdfDatabase::SaveCatalogCache()
+{
+    std::vector<TPdfCacheEntry> Entries;
+    TPdfCacheHeader Header = m_CacheKey;
+    PLIST_ENTRY pHeadEntry = &m_Files;
+    PLIST_ENTRY pListEntry;
+    HANDLE hFile;
+    WCHAR szTempFile[MAX_PATH];
+    DWORD dwWritten = 0;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    try
+    {
+        // Files merged with the appended objects already have their entries.
+        // Only the sizes may have changed, if the files were extracted in the meantime.
+        if(m_bListFromCache)
+        {
+            for(size_t i = 0; i < m_CacheEntries.size(); i++)
+            {
+                TPdfCacheEntry Entry = m_CacheEntries[i];
+                TPdfFile * pPdfFile;
+
+                if((pPdfFile = FindFile(Entry.dwObjectId, Entry.dwRevision)) != NULL)
+                {
+                    Entry.FileSize = pPdfFile->FileSize();
+                    Entries.push_back(Entry);
+                }
+            }
+        }
+        else
+        {
+            // The files are in the list in the order in which they have been listed
+            for(pListEntry = pHeadEntry->Flink; pListEntry != pHeadEntry; pListEntry = pListEntry->Flink)
+            {
+                TPdfFile * pPdfFile = CONTAINING_RECORD(pListEntry, TPdfFile, m_Entry);
+                const TPdfObjectRef * pObjRef;
+                TPdfCacheEntry Entry;
+
+                if(!GetCacheEntry(pPdfFile, pbData, Entry))
+                    return ERROR_NOT_SUPPORTED;
+
+                // Remember the revision of the live objects, for when they get superseded
+                if(Entry.dwRevision == 0 && (pObjRef = FindObject(Entry.dwObjectId)) != NULL)
+                    Entry.dwObjectRevision = m_dwSections - pObjRef->dwSection;
+                Entries.push_back(Entry);
+            }
+        }
+    }
+    catch(std::bad_alloc)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Write the cache to a temporary file first, so that nobody maps a half-written cache
+    Header.dwEntries = (DWORD)Entries.size();
+    Header.dwSections = m_dwSections;
+    Header.XrefOffset = m_XrefOffset;
+    CreateDirectoryW(g_Options.szCacheDir, NULL);
+    StringCchPrintfW(szTempFile, _countof(szTempFile), L"%s.%u", m_szCacheFile, GetCurrentProcessId());
+    hFile = CreateFileW(szTempFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+    if(hFile == INVALID_HANDLE_VALUE)
+        return GetLastError();
+
+    // Write the header, the entries and the name of the PDF file
+    if(!WriteFile(hFile, &Header, sizeof(TPdfCacheHeader), &dwWritten, NULL))
+        dwErrCode = GetLastError();
+    if(dwErrCode == ERROR_SUCCESS && Entries.size() != 0 && !WriteFile(hFile, &Entries[0], (DWORD)(Entries.size() * sizeof(TPdfCacheEntry)), &dwWritten, NULL))
+        dwErrCode = GetLastError();
+    if(dwErrCode == ERROR_SUCCESS && !WriteFile(hFile, m_szFileName, (Header.cchFileName + 1) * sizeof(WCHAR), &dwWritten, NULL))
+        dwErrCode = GetLastError();
+    CloseHandle(hFile);
+
+    // Replace the previous cache of the file, if any
+    if(dwErrCode == ERROR_SUCCESS && !MoveFileExW(szTempFile, m_szCacheFile, MOVEFILE_REPLACE_EXISTING))
+        dwErrCode = GetLastError();
+    if(dwErrCode != ERROR_SUCCESS)
+        DeleteFileW(szTempFile);
+    return dwErrCode;
+}
+
+TPdfFile * TPdfDatabase::OpenNextFile_CACHE()
+{
+    TPdfFile * pPdfFile;
+    ULONGLONG DataSize = (ULONGLONG)(pbEnd - pbData);
+
+    // The stream data are not touched. The files are decoded when extracted
+    while(m_nNextObject < m_nCacheEntries)
+    {
+        const TPdfCacheEntry & Entry = m_pCacheEntries[m_nNextObject++];
+
+        // Don't trust the cache blindly
+        if(Entry.ObjectOffset > DataSize)
+            continue;
+        if(Entry.RawOffset > DataSize || Entry.RawSize > DataSize - Entry.RawOffset)
+            continue;
+        if(Entry.ParamsOffset > DataSize || Entry.cbParams > DataSize - Entry.ParamsOffset)
+            continue;
+        if(Entry.dwExtension >= _countof(CacheExtensions))
+            continue;
+
+        // Create the file the same way as it was listed before
+        LPBYTE pbRawData = pbData + (size_t)Entry.RawOffset;
+        if((pPdfFile = new(m_Arena) TPdfFile(pbRawData, pbRawData + (size_t)Entry.RawSize, Entry.dwObjectId, &m_Arena)) != NULL)
+        {
+            pPdfFile->m_pbObject = pbData + (size_t)Entry.ObjectOffset;
+            pPdfFile->m_pbParamsBegin = pbData + (size_t)Entry.ParamsOffset;
+            pPdfFile->m_pbParamsEnd = pPdfFile->m_pbParamsBegin + Entry.cbParams;
+            pPdfFile->m_szExtension = CacheExtensions[Entry.dwExtension];
+            pPdfFile->m_szFileType = _T("stream");
+            pPdfFile->m_dwRevision = Entry.dwRevision;
+            pPdfFile->m_FileSize = Entry.FileSize;
+            return pPdfFile;
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Databases shared by the archive handles. Total Commander opens the same PDF
+// for listing, for extraction and for viewing, so all handles of an unchanged
+// file use the same database with its file list and decoded data. After the last
+// handle is closed, the database is kept open for a while for the next open.
+
+struct TPdfSharedList
+{
+    TPdfSharedList()
+    {
+        InitializeCriticalSection(&Lock);
+        InitializeListHead(&Databases);
+        hTimerQueue = NULL;
+        hTimer = NULL;
+        dwKept = 0;
+        bShutdown = false;
+    }
+
+    // The kept databases are closed by TPdfDatabase::Shutdown, not here.
+    // The static destructors run under the loader lock, where the timer can't be waited for
+
+    CRITICAL_SECTION Lock;                  // Guards the list and the handle counts of the databases
+    LIST_ENTRY Databases;                   // Shared databases, the most recently used first
+    HANDLE hTimerQueue;                     // Timer queue of our own, so that the shutdown can wait for its callbacks
+    HANDLE hTimer;                          // Timer that closes the kept databases when they expire
+    DWORD dwKept;                           // Number of databases that have no archive handles
+    bool bShutdown;                         // true = the DLL is being unloaded, no more timers are created
+};
+
+static TPdfSharedList SharedList;
+
+static VOID CALLBACK KeepOpenTimerProc(PVOID /* lpParameter */, BOOLEAN /* bTimerFired */)
+{
+    TPdfDatabase::CloseKeptDatabases(false, true);
+}
+
+static bool GetFileId(LPCWSTR szFileName, TPdfFileId & FileId)
+{
+    BY_HANDLE_FILE_INFORMATION FileInfo;
+    HANDLE hFile;
+    bool bResult = false;
+
+    hFile = CreateFileW(szFileName, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if(hFile != INVALID_HANDLE_VALUE)
+    {
+        if(GetFileInformationByHandle(hFile, &FileInfo))
+        {
+            // Some file systems don't have stable file IDs. Such files are not shared
+            memset(&FileId, 0, sizeof(TPdfFileId));
+            FileId.FileIndex = ((ULONGLONG)FileInfo.nFileIndexHigh << 32) | FileInfo.nFileIndexLow;
+            FileId.FileSize = ((ULONGLONG)FileInfo.nFileSizeHigh << 32) | FileInfo.nFileSizeLow;
+            FileId.FileTime = ((ULONGLONG)FileInfo.ftLastWriteTime.dwHighDateTime << 32) | FileInfo.ftLastWriteTime.dwLowDateTime;
+            FileId.dwVolumeSerial = FileInfo.dwVolumeSerialNumber;
+            FileId.dwOptions = GetCacheOptions();
+            bResult = (FileId.FileIndex != 0);
+        }
+        CloseHandle(hFile);
+    }
+    return bResult;
+}
+
+HANDLE TPdfDatabase::OpenArchive(LPCWSTR szFileName)
+{
+    TPdfDatabase * pPdfDb = NULL;
+    TPdfArchive * pArchive;
+    PLIST_ENTRY pListEntry;
+    TPdfFileId FileId;
+    bool bShared;
+
+    // Create the archive handle
+    if((pArchive = new TPdfArchive) == NULL)
+        return NULL;
+    pArchive->m_MagicSignature = PDF_ARCHIVE_SIGNATURE;
+    pArchive->m_nNextFile = 0;
+
+    // Look for the database of the same unchanged file
+    if((bShared = GetFileId(szFileName, FileId)) == true)
+    {
+        EnterCriticalSection(&SharedList.Lock);
+        for(pListEntry = SharedList.Databases.Flink; pListEntry != &SharedList.Databases; pListEntry = pListEntry->Flink)
+        {
+            TPdfDatabase * pSharedDb = CONTAINING_RECORD(pListEntry, TPdfDatabase, m_SharedEntry);
+
+            if(!memcmp(&pSharedDb->m_FileId, &FileId, sizeof(TPdfFileId)))
+            {
+                if(pSharedDb->m_dwHandles++ == 0)
+                    SharedList.dwKept--;
+                RemoveEntryList(&pSharedDb->m_SharedEntry);
+                InsertHeadList(&SharedList.Databases, &pSharedDb->m_SharedEntry);
+                pPdfDb = pSharedDb;
+                break;
+            }
+        }
+        LeaveCriticalSection(&SharedList.Lock);
+    }
+
+    // Open the PDF file, if we don't have it yet
+    if(pPdfDb == NULL)
+    {
+        if((pPdfDb = Open(szFileName, false)) == NULL)
+        {
+            delete pArchive;
+            return NULL;
+        }
+
+        // Make the database findable by the next opens of the file
+        pPdfDb->m_dwHandles = 1;
+        if(bShared)
+        {
+            pPdfDb->m_FileId = FileId;
+            EnterCriticalSection(&SharedList.Lock);
+            InsertHeadList(&SharedList.Databases, &pPdfDb->m_SharedEntry);
+            LeaveCriticalSection(&SharedList.Lock);
+        }
+    }
+
+    // The reference of the database is owned by all its handles together
+    pArchive->m_pPdfDb = pPdfDb;
+    return (HANDLE)(pArchive);
+}
+
+bool TPdfDatabase::CloseArchive(HANDLE hHandle)
+{
+    TPdfArchive * pArchive;
+    TPdfDatabase * pPdfDb;
+    bool bCloseDatabase = false;
+    bool bKeepDatabase = false;
+
+    // Check the archive handle
+    if(hHandle == NULL || hHandle == INVALID_HANDLE_VALUE)
+        return false;
+    pArchive = static_cast<TPdfArchive *>(hHandle);
+    if(pArchive->m_MagicSignature != PDF_ARCHIVE_SIGNATURE)
+        return false;
+
+    // Free the handle
+    pPdfDb = pArchive->m_pPdfDb;
+    pArchive->m_MagicSignature = 0;
+    delete pArchive;
+
+    // After the last handle, the shared database is kept for a while
+    EnterCriticalSection(&SharedList.Lock);
+    if(--pPdfDb->m_dwHandles == 0)
+    {
+        if(pPdfDb->m_SharedEntry.Flink != &pPdfDb->m_SharedEntry)
+        {
+            pPdfDb->m_dwClosedTime = GetTickCount();
+            SharedList.dwKept++;
+            bKeepDatabase = true;
+        }
+        else
+        {
+            bCloseDatabase = true;
+        }
+    }
+    LeaveCriticalSection(&SharedList.Lock);
+
+    // Force-close all loaded files and release the database to make it go away
+    if(bCloseDatabase)
+    {
+        pPdfDb->RemoveAllFiles();
+        pPdfDb->Release();
+    }
+
+    // Close the kept databases that are over the limit, and plan closing the others
+    if(bKeepDatabase)
+    {
+        CloseKeptDatabases(false, false);
+    }
+    return true;
+}
+
+void TPdfDatabase::CloseKeptDatabases(bool bCloseAll, bool bTimerCallback)
+{
+    TPdfDatabase * pPdfDb;
+    PLIST_ENTRY pListEntry;
+    LIST_ENTRY ClosedList;
+    HANDLE hTimerQueue;
+    HANDLE hOldTimer;
+    DWORD dwKeepOpenTime = g_Options.dwKeepOpenTime * 1000;
+    DWORD dwTickCount = GetTickCount();
+    DWORD dwNextDueTime = 0;
+    DWORD dwKept = 0;
+    bool bListEmpty;
+
+    // Take the expired databases out of the list. The most recently used ones are kept
+    InitializeListHead(&ClosedList);
+    EnterCriticalSection(&SharedList.Lock);
+    for(pListEntry = SharedList.Databases.Flink; pListEntry != &SharedList.Databases; )
+    {
+        pPdfDb = CONTAINING_RECORD(pListEntry, TPdfDatabase, m_SharedEntry);
+        pListEntry = pListEntry->Flink;
+
+        if(pPdfDb->m_dwHandles == 0)
+        {
+            DWORD dwElapsed = dwTickCount - pPdfDb->m_dwClosedTime;
+
+            if(bCloseAll || dwElapsed >= dwKeepOpenTime || dwKept >= PDF_MAX_KEPT_DATABASES)
+            {
+                RemoveEntryList(&pPdfDb->m_SharedEntry);
+                InsertTailList(&ClosedList, &pPdfDb->m_SharedEntry);
+                SharedList.dwKept--;
+            }
+            else
+            {
+                if(dwNextDueTime == 0 || (dwKeepOpenTime - dwElapsed) < dwNextDueTime)
+                    dwNextDueTime = dwKeepOpenTime - dwElapsed;
+                dwKept++;
+            }
+        }
+    }
+
+    // Plan closing of the databases that are still kept. The previous timer is deleted below
+    hOldTimer = SharedList.hTimer;
+    SharedList.hTimer = NULL;
+    if(dwKept != 0 && SharedList.bShutdown == false)
+    {
+        if(SharedList.hTimerQueue == NULL)
+            SharedList.hTimerQueue = CreateTimerQueue();
+        if(SharedList.hTimerQueue != NULL && !CreateTimerQueueTimer(&SharedList.hTimer, SharedList.hTimerQueue, KeepOpenTimerProc, NULL, dwNextDueTime, 0, WT_EXECUTEONLYONCE))
+            SharedList.hTimer = NULL;
+    }
+    hTimerQueue = SharedList.hTimerQueue;
+    bListEmpty = IsListEmpty(&SharedList.Databases);
+    LeaveCriticalSection(&SharedList.Lock);
+
+    // Delete the previous timer outside the lock, because its callback may be waiting for the lock.
+    // The callback can't wait for itself, so it only cancels the timer
+    if(hOldTimer != NULL)
+    {
+        DeleteTimerQueueTimer(hTimerQueue, hOldTimer, bTimerCallback ? NULL : INVALID_HANDLE_VALUE);
+    }
+
+    // Close the databases outside the lock. Unmapping a big file may take a while
+    for(pListEntry = ClosedList.Flink; pListEntry != &ClosedList; )
+    {
+        pPdfDb = CONTAINING_RECORD(pListEntry, TPdfDatabase, m_SharedEntry);
+        pListEntry = pListEntry->Flink;
+
+        InitializeListHead(&pPdfDb->m_SharedEntry);
+        pPdfDb->RemoveAllFiles();
+        pPdfDb->Release();
+    }
+
+    // When no PDF is open anymore, the scratch pools of the ended threads are not needed.
+    // At exit, the pools are freed by themselves
+    if(bListEmpty && bCloseAll == false)
+    {
+        TPdfScratch::FreeSpares();
+    }
+}
+
+void TPdfDatabase::Shutdown()
+{
+    HANDLE hTimerQueue;
+
+    // No more timers from now on. The pending timer is deleted together with the queue
+    EnterCriticalSection(&SharedList.Lock);
+    SharedList.bShutdown = true;
+    SharedList.hTimer = NULL;
+    hTimerQueue = SharedList.hTimerQueue;
+    SharedList.hTimerQueue = NULL;
+    LeaveCriticalSection(&SharedList.Lock);
+
+    // Cancel the timer and wait until its callback, if running, has finished
+    if(hTimerQueue != NULL)
+    {
+        DeleteTimerQueueEx(hTimerQueue, INVALID_HANDLE_VALUE);
+    }
+
+    // Nothing can use the kept databases anymore
+    CloseKeptDatabases(true, false);
+    DeleteCriticalSection(&SharedList.Lock);
+}
+
+//-----------------------------------------------------------------------------
+// Loading the objects
+
+TPdfFile * TPdfDatabase::OpenNextFile_XREF()
+{
+    std::map<DWORD, TPdfObjectStream>::iterator iter;
+    TPdfFile * pPdfFile;
+
+    // Load the objects of the live revision directly from their offsets
+    while(m_nNextObject < m_Catalog.size())
+    {
+        const TPdfObjectRef & ObjRef = m_Catalog[m_nNextObject++];
+
+        // Objects from object streams are never streams themselves
+        if(ObjRef.dwObjStmId != 0)
+            continue;
+
+        // If this is an object stream that has already been decoded, don't decode it again
+        if((iter = m_ObjStreams.find(ObjRef.dwObjectId)) != m_ObjStreams.end() && iter->second.pPdfFile->m_pPdfDb == NULL)
+        {
+            iter->second.pPdfFile->AddRef();
+            return iter->second.pPdfFile;
+        }
+
+        // Move to the begin of the object and load it
+        SetPosition(pbData + (size_t)ObjRef.ObjectOffset);
+        SkipWhiteSpaces();
+        if((pPdfFile = LoadPdfObject()) != NULL)
+        {
+            return pPdfFile;
+        }
+    }
+
+    // If enabled, continue with the superseded versions of the objects.
+    // Revisions are numbered from the oldest one (1) to the live one.
+    while(g_Options.bShowRevisions && (m_nNextObject - m_Catalog.size()) < m_History.size())
+    {
+        const TPdfObjectRef & ObjRef = m_History[m_nNextObject++ - m_Catalog.size()];
+
+        // Move to the begin of the object and load it
+        SetPosition(pbData + (size_t)ObjRef.ObjectOffset);
+        SkipWhiteSpaces();
+        if((pPdfFile = LoadPdfObject(m_dwSections - ObjRef.dwSection)) != NULL)
+        {
+            return pPdfFile;
+        }
+    }
+    return NULL;
+}
+
+DWORD TPdfDatabase::FindObjectHeaders()
+{
+    std::vector<TPdfScanChunk> Chunks;
+    HANDLE hThreads[MAXIMUM_WAIT_OBJECTS];
+    size_t nHeaders = 0;
+    size_t cbChunk;
+    DWORD dwThreads = GetScanThreadCount(pbEnd - pbPtr);
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // With one thread, the sequential scan finds the headers itself
+    if(dwThreads < 2)
+        return ERROR_SUCCESS;
+
+    try
+    {
+        // Split the rest of the file to chunks
+        Chunks.resize(dwThreads);
+        cbChunk = (pbEnd - pbPtr) / dwThreads;
+        for(DWORD i = 0; i < dwThreads; i++)
+        {
+            Chunks[i].pPdfBlob = this;
+            Chunks[i].pbChunkBegin = pbPtr + i * cbChunk;
+            Chunks[i].pbChunkEnd = (i == dwThreads - 1) ? pbEnd : (pbPtr + (i + 1) * cbChunk);
+            Chunks[i].dwErrCode = ERROR_SUCCESS;
+        }
+
+        // Scan all chunks. If a thread can't be created, scan the chunk in this thread
+        for(DWORD i = 0; i < dwThreads; i++)
+        {
+            if((hThreads[i] = CreateThread(NULL, 0, FindObjectHeadersWorker, &Chunks[i], 0, NULL)) == NULL)
+                FindObjectHeadersWorker(&Chunks[i]);
+        }
+
+        // Wait for all threads to finish
+        for(DWORD i = 0; i < dwThreads; i++)
+        {
+            if(hThreads[i] != NULL)
+            {
+                WaitForSingleObject(hThreads[i], INFINITE);
+                CloseHandle(hThreads[i]);
+            }
+        }
+
+        // Merge the candidates. The chunks are in order, so the merged list is sorted
+        for(DWORD i = 0; i < dwThreads; i++)
+        {
+            if(Chunks[i].dwErrCode != ERROR_SUCCESS)
+                dwErrCode = Chunks[i].dwErrCode;
+            nHeaders += Chunks[i].Headers.size();
+        }
+
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            m_ObjHeaders.reserve(nHeaders);
+            for(DWORD i = 0; i < dwThreads; i++)
+                m_ObjHeaders.insert(m_ObjHeaders.end(), Chunks[i].Headers.begin(), Chunks[i].Headers.end());
+        }
+    }
+    catch(std::bad_alloc)
+    {
+        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // On failure, the sequential scan will do the job
+    if(dwErrCode != ERROR_SUCCESS)
+        m_ObjHeaders.clear();
+    return dwErrCode;
+}
+
+LPBYTE TPdfDatabase::FindNextObjectKeyword(bool & bIsHeader)
+{
+    LPBYTE pbLineBegin;
+    LPBYTE pbKeyword;
+
+    // Use the candidates found by the parallel scan, if any
+    if(m_ObjHeaders.size() != 0)
+    {
+        while(m_nNextHeader < m_ObjHeaders.size())
+        {
+            const TPdfObjectHeader & Header = m_ObjHeaders[m_nNextHeader++];
+
+            // Skip the keywords that are inside the previously loaded objects
+            if((pbKeyword = pbData + Header.KeywordOffset) >= pbPtr)
+            {
+                // If the whole line is ahead of us, use the result of the parallel scan.
+                // Otherwise, the line begins within the previous object and must be checked again
+                if((pbLineBegin = pbData + Header.LineOffset) >= pbPtr)
+                {
+                    pbPtr = pbLineBegin;
+                    bIsHeader = Header.bIsHeader;
+                }
+                else
+                {
+                    bIsHeader = (CheckBeginOfObject() != NULL);
+                }
+                return pbKeyword;
+            }
+        }
+        return NULL;
+    }
+
+    // Find the next "obj" keyword
+    if((pbKeyword = FindKeyword(PDF_KEYWORD_OBJ)) != NULL)
+    {
+        // The object header "N G obj" is at the begin of the line
+        for(pbLineBegin = pbKeyword; pbLineBegin > pbPtr; pbLineBegin--)
+        {
+            if(pbLineBegin[-1] == 0x0A || pbLineBegin[-1] == 0x0D)
+                break;
+        }
+        pbPtr = pbLineBegin;
+
+        // Check if this may be an object header
+        bIsHeader = (CheckBeginOfObject() != NULL);
+    }
+    return pbKeyword;
+}
+
+TPdfFile * TPdfDatabase::OpenNextFile_SEQ()
+{
+    TPdfFile * pPdfFile;
+    LPBYTE pbKeyword;
+    bool bIsHeader = false;
+
+    // Jump from one "obj" keyword to another
+    while((pbKeyword = FindNextObjectKeyword(bIsHeader)) != NULL)
+    {
+        if(bIsHeader)
+        {
+            if((pPdfFile = LoadPdfObject()) != NULL)
+            {
+                return pPdfFile;
+            }
+        }
+        else
+        {
+            // Continue after the keyword
+            pbPtr = pbKeyword + 3;
+        }
+    }
+
+    // No more objects
+    pbPtr = pbEnd;
+    return NULL;
+}
+
+TPdfFile * TPdfDatabase::LoadPdfObject(DWORD dwRevision)
+{
+    TPdfFile * pPdfFile = NULL;
+    LPBYTE pbObject = pbPtr;
+    LPBYTE pbObjectEnd;
+    TPdfDict ObjParams;
+    char szObjType[32];
+    int nObjectId = 0;
+
+    // Parse the header of the object
+    if(ParseBeginOfObject(nObjectId) == NULL)
+        return NULL;
+
+    // Load the object parameters
+    if(LoadObjectParameters(ObjParams) != NULL)
+    {
+        // We only accept objects that are streams
+        // Either there is "stream" or "endobj". Note that not all PDFs have "stream\x0d\x0a".
+        // Example: 001f7e150598548000e088d61a8bc2806271d215b776c88fd9aa7793aaee2b01
+        if(IsBeginOfStream())
+        {
+            // We need to save the pointer to the begin of the object
+            LPBYTE pbObjectPtr = pbPtr;
+
+            // Because the object length is pretty unreliable, we need to estimate the object length manually.
+            if((pbObjectEnd = FindEndOfStream(ObjParams)) != NULL)
+            {
+                // Calculate the length of the object
+                if((pPdfFile = new(m_Arena) TPdfFile(pbObjectPtr, pbObjectEnd, nObjectId, &m_Arena)) != NULL)
+                {
+                    bool bObjStm = (ObjParams.GetName("/Type", szObjType, _countof(szObjType)) && !strcmp(szObjType, "/ObjStm"));
+                    DWORD dwErrCode;
+
+                    // Remember where the object and its parameters are, for the catalog cache
+                    pPdfFile->m_pbObject = pbObject;
+                    pPdfFile->m_pbParamsBegin = ObjParams.m_pbBegin;
+                    pPdfFile->m_pbParamsEnd = ObjParams.m_pbEnd;
+
+                    // In the lazy mode, the stream is only decoded when extracted.
+                    // Object streams are always decoded, because we need the objects inside.
+                    // When all objects are loaded at once, the streams are decoded by the decode pool,
+                    // except those loaded while looking for an object stream. They are released right away.
+                    if(m_pDecodeTasks != NULL && m_dwResolveDepth == 0 && !bObjStm)
+                        dwErrCode = QueueDecodeTask(pPdfFile, ObjParams);
+                    else if(g_Options.bLazyDecode && !bObjStm)
+                        dwErrCode = pPdfFile->Prepare(ObjParams, g_Options.bExactSizes);
+                    else
+                        dwErrCode = pPdfFile->Load(ObjParams);
+
+                    if(dwErrCode != ERROR_SUCCESS)
+                    {
+                        pPdfFile->Release();
+                        pPdfFile = NULL;
+                    }
+                    else
+                    {
+                        pPdfFile->m_dwRevision = dwRevision;
+                    }
+
+                    // Object streams of the live revision are kept, so the objects inside can be referenced
+                    if(pPdfFile != NULL && dwRevision == 0 && bObjStm)
+                    {
+                        InsertObjectStream(pPdfFile, ObjParams);
+                    }
+                }
+            }
+
+            // Skip the "endstream", if any
+            SkipEndOfStream();
+        }
+    }
+
+    // Skip the "endobj", if any
+    SkipEndOfObject();
+    return pPdfFile;
+}
+
+LPBYTE TPdfDatabase::CheckBeginOfObject()
+{
+    TPdfBlob TempBlob;
+    LPBYTE pbSavePtr;
+    LPBYTE pbResult = NULL;
+    int nObjectId = 0;
+
+    // Skip all EOLs
+    pbSavePtr = SkipEndOfLine();
+
+    // Check for "# # obj"
+    if(ParseBeginOfObject(nObjectId))
+        pbResult = pbSavePtr;
+    SetPosition(pbSavePtr);
+
+    // If failed, restore the position of the current pointer
+    return pbResult;
+}
+
+LPBYTE TPdfDatabase::ParseBeginOfObject(int & nObjectId)
+{
+    return ParseObjectHeader(*this, nObjectId);
+}
+
+LPBYTE TPdfDatabase::LoadObjectParameters(TPdfDict & ObjParams)
+{
+    LPBYTE pbParamsBegin = pbPtr;
+    LPBYTE pbParamsEnd = NULL;
+    DWORD dwNestCount = 1;
+
+    // Check if there is an object specification
+    if(!CheckData("<<", 2))
+        return NULL;
+
+    // Parse the dictionary. The values point to the PDF data, so they are valid as long as the database
+    if((pbParamsEnd = ObjParams.Parse(pbParamsBegin, pbEnd)) == NULL)
+    {
+        // Broken dictionary (e.g. an unbalanced string). Find the end by counting the nested "<<" and ">>"
+        // and keep the entries that precede it
+        for(pbPtr += 2; pbPtr < (pbEnd - 2) && pbParamsEnd == NULL; pbPtr++)
+        {
+            // Objects may be nested
+            if(pbPtr[0] == '<' && pbPtr[1] == '<')
+            {
+                dwNestCount++;
+                pbPtr++;
+                continue;
+            }
+
+            // If we are at the closing sign, we have the end of the object
+            if(pbPtr[0] == '>' && pbPtr[1] == '>')
+            {
+                if(--dwNestCount == 0)
+                    pbParamsEnd = pbPtr + 2;
+                pbPtr++;
+            }
+        }
+
+        // Nothing found
+        if(pbParamsEnd == NULL)
+        {
+            pbPtr = pbParamsBegin;
+            return NULL;
+        }
+        ObjParams.Parse(pbParamsBegin, pbParamsEnd);
+    }
+
+    // Skip the end of the line and return what we got
+    pbPtr = pbParamsEnd;
+    SkipPdfSpaces();
+    SkipEndOfLine();
+    return pbParamsBegin;
+}
+
+LPBYTE TPdfDatabase::IsBeginOfStream()
 {
     // Is there enough space in the buffer?
     if((pbPtr + 8) < pbEnd)
@@ -611,19 +2639,21 @@ LPBYTE TPdfDatabase::IsBeginOfStream()
     return NULL;
 }
 
-LPBYTE TPdfDatabase::FindEndOfStream(LPCSTR szObjParams)
+LPBYTE TPdfDatabase::FindEndOfStream(const TPdfDict & ObjParams)
 {
     LPBYTE pbSavePtr = pbPtr;
     LPBYTE pbTestPtr = pbPtr;
     LPBYTE pbEndStream;
-    int nLength = 0;
+    LONGLONG nLength = 0;
 
-    // Try to get the compressed length
-    GetObjectVariableInt(szObjParams, "/Length", nLength);
+    // Try to get the compressed length. It may be an indirect reference
+    GetIndirectVariableInt(ObjParams, "/Length", nLength);
 
     // Try of there is "endstream" at the alleged length
-    if((pbTestPtr = pbPtr + nLength) < (pbEnd - 9))
+    if(0 <= nLength && (ULONGLONG)nLength + 9 < (ULONGLONG)(pbEnd - pbPtr))
     {
+        pbTestPtr = pbPtr + (size_t)nLength;
+
         // Remember the end of the file pointer
         pbEndStream = pbTestPtr;
 
@@ -640,34 +2670,34 @@ LPBYTE TPdfDatabase::FindEndOfStream(LPCSTR szObjParams)
     }
 
     // Ok, the length is unreliable. Search for "endstream" manually.
-    pbTestPtr = pbPtr;
-
     // Keep going until we find "endstream".
     // This may find a wrong end-of-stream if the object is e.g. an embedded PDF 
-    while(pbTestPtr < (pbEnd - 9))
+    pbEndStream = NULL;
+    while((pbTestPtr = FindKeyword(PDF_KEYWORD_ENDSTREAM)) != NULL)
     {
-        // Did we find end of the stream?
-        if(pbTestPtr[0] == 'e' && !memcmp(pbTestPtr, "endstream", 9))
-        {
-            // Check for "\x0D\x0Aendstream" (the most frequent end of the stream)
-            if((pbTestPtr - 2) > pbSavePtr && !memcmp(pbTestPtr - 2, "\n\rendstream", 11))
-                return pbTestPtr - 2;
+        // Check for "\x0D\x0Aendstream" (the most frequent end of the stream)
+        if((pbTestPtr - 2) > pbSavePtr && !memcmp(pbTestPtr - 2, "\n\rendstream", 11))
+            pbEndStream = pbTestPtr - 2;
 
-            // Check fort "\x0Aendstream" (0106a960deb6409afad94b696a2466c5ff883ad81b71d40663a220ca774b1bc1)
-            if((pbTestPtr - 1) > pbSavePtr && !memcmp(pbTestPtr - 1, "\nendstream", 10))
-                return pbTestPtr - 1;
+        // Check fort "\x0Aendstream" (0106a960deb6409afad94b696a2466c5ff883ad81b71d40663a220ca774b1bc1)
+        else if((pbTestPtr - 1) > pbSavePtr && !memcmp(pbTestPtr - 1, "\nendstream", 10))
+            pbEndStream = pbTestPtr - 1;
 
-            // Check for "\x0Dendstream" (0025ee1f882244e75b68c0c4ff185bfa678f13470c0254039bb46e648fc00e1e)
-            if((pbTestPtr - 1) > pbSavePtr && !memcmp(pbTestPtr - 1, "\rendstream", 10))
-                return pbTestPtr - 1;
-        }
+        // Check for "\x0Dendstream" (0025ee1f882244e75b68c0c4ff185bfa678f13470c0254039bb46e648fc00e1e)
+        else if((pbTestPtr - 1) > pbSavePtr && !memcmp(pbTestPtr - 1, "\rendstream", 10))
+            pbEndStream = pbTestPtr - 1;
 
         // Move one char fuhrter
-        pbTestPtr++;
+        pbPtr = pbTestPtr + 1;
+
+        // Found it. The sequential scan continues from the begin of the stream,
+        // because the "endstream" we found may belong to one of the next objects
+        if(pbEndStream != NULL)
+            break;
     }
 
-    // Not found
-    return NULL;
+    SetPosition(pbSavePtr);
+    return pbEndStream;
 }
 
 LPBYTE TPdfDatabase::SkipEndOfStream()
@@ -0,0 +1,237 @@
+/*****************************************************************************/
+/* TPdfDecodePool.cpp                     Copyright (c) Ladislav Zezula 2024 */
+/*---------------------------------------------------------------------------*/
+/* Work-stealing pool of threads for decoding PDF streams                    */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 16.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#include "wcx_pdf.h"
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+// Flate and LZW streams cost much more per byte than the other filters
+static ULONGLONG GetFilterWeight(PDFFL Filter)
+{
+    switch(Filter)
+    {
+        case PDFF_Flate:
+        case PDFF_LZW:
+            return 4;
+
+        case PDFF_Plain:
+        case PDFF_PlainXml:
+        case PDFF_DCT:
+            return 0;
+
+        default:
+            return 1;
+    }
+}
+
+static ULONGLONG GetDecodeWeight(TPdfDecodeTask & Task)
+{
+    TPdfFile * pPdfFile = Task.pPdfFile;
+    PDFFL Filters[PDF_MAX_FILTERS];
+    DWORD FilterIndexes[PDF_MAX_FILTERS];
+    ULONGLONG Weight = 1;
+    DWORD dwFilters = 0;
+
+    // Every filter in the chain processes about the same amount of data
+    pPdfFile->GetStreamFilters(Task.ObjParams, Filters, FilterIndexes, dwFilters);
+    for(DWORD i = 0; i < dwFilters; i++)
+        Weight += pPdfFile->PackSize() * GetFilterWeight(Filters[i]);
+    return Weight;
+}
+
+//-----------------------------------------------------------------------------
+// Constructor and destructor
+
+TPdfDecodePool::TPdfDecodePool(std::vector<TPdfDecodeTask> & Tasks) : m_Tasks(Tasks)
+{
+    m_Queues = NULL;
+    m_dwQueues = 0;
+}
+
+TPdfDecodePool::~TPdfDecodePool()
+{
+    if(m_Queues != NULL)
+    {
+        for(DWORD i = 0; i < m_dwQueues; i++)
+            DeleteCriticalSection(&m_Queues[i].Lock);
+        delete [] m_Queues;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+DWORD TPdfDecodePool::GetThreadCount(DWORD dwThreads)
+{
+    SYSTEM_INFO si;
+
+    // Zero means one thread per CPU
+    if(dwThreads == 0)
+    {
+        GetSystemInfo(&si);
+        dwThreads = si.dwNumberOfProcessors;
+    }
+    return dwThreads;
+}
+
+DWORD TPdfDecodePool::Run(DWORD dwThreads)
+{
+    std::vector<std::pair<ULONGLONG, size_t> > SortedTasks;
+    HANDLE hThreads[MAXIMUM_WAIT_OBJECTS];
+    TPdfDecodeWorker Workers[MAXIMUM_WAIT_OBJECTS];
+    ULONGLONG BatchWeight = 0;
+    size_t nBatchBegin = 0;
+
+    // Sort the tasks by their estimated cost. Equal costs keep the catalog order
+    SortedTasks.reserve(m_Tasks.size());
+    for(size_t i = 0; i < m_Tasks.size(); i++)
+        SortedTasks.push_back(std::make_pair(GetDecodeWeight(m_Tasks[i]), m_Tasks.size() - i));
+    std::sort(SortedTasks.begin(), SortedTasks.end());
+
+    // Big streams go first, each of them in its own batch.
+    // Small streams are grouped into batches, so that the threads don't fight for the queue lock
+    m_Order.reserve(SortedTasks.size());
+    for(size_t i = SortedTasks.size(); i > 0; i--)
+    {
+        m_Order.push_back(m_Tasks.size() - SortedTasks[i - 1].second);
+        BatchWeight += SortedTasks[i - 1].first;
+
+        if(BatchWeight >= PDF_DECODE_BATCH_SIZE || i == 1)
+        {
+            m_Batches.push_back(TPdfDecodeBatch(nBatchBegin, m_Order.size()));
+            nBatchBegin = m_Order.size();
+            BatchWeight = 0;
+        }
+    }
+
+    // Don't start more threads than there is work for
+    if(dwThreads > m_Batches.size())
+        dwThreads = (DWORD)m_Batches.size();
+    if(dwThreads > MAXIMUM_WAIT_OBJECTS)
+        dwThreads = MAXIMUM_WAIT_OBJECTS;
+    if(dwThreads == 0)
+        return ERROR_SUCCESS;
+
+    // Deal the batches to the queues, so that every thread starts with one of the big ones
+    m_Queues = new TPdfDecodeQueue[dwThreads];
+    for(m_dwQueues = 0; m_dwQueues < dwThreads; m_dwQueues++)
+        InitializeCriticalSection(&m_Queues[m_dwQueues].Lock);
+    for(size_t i = 0; i < m_Batches.size(); i++)
+        m_Queues[i % m_dwQueues].Batches.push_back(m_Batches[i]);
+
+    // Start the worker threads. The first queue is processed by this thread.
+    // If a thread can't be created, its queue will be stolen by the others.
+    for(DWORD i = 1; i < m_dwQueues; i++)
+    {
+        Workers[i].pPool = this;
+        Workers[i].dwQueue = i;
+        hThreads[i] = CreateThread(NULL, 0, WorkerThread, &Workers[i], 0, NULL);
+    }
+    ProcessBatches(0);
+
+    // Wait for all threads to finish
+    for(DWORD i = 1; i < m_dwQueues; i++)
+    {
+        if(hThreads[i] != NULL)
+        {
+            WaitForSingleObject(hThreads[i], INFINITE);
+            CloseHandle(hThreads[i]);
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+// Protected functions
+
+DWORD WINAPI TPdfDecodePool::WorkerThread(LPVOID lpParameter)
+{
+    TPdfDecodeWorker * pWorker = (TPdfDecodeWorker *)lpParameter;
+
+    pWorker->pPool->ProcessBatches(pWorker->dwQueue);
+
+    // Keep the scratch pool for the next thread
+    TPdfScratch::ReleaseThisThread();
+    return 0;
+}
+
+void TPdfDecodePool::ProcessBatches(DWORD dwQueue)
+{
+    TPdfScratch * pScratch = TPdfScratch::ForThisThread();
+    TPdfDecodeBatch Batch;
+
+    // The other threads of the pool keep the CPUs busy, so the streams are not decoded by more threads
+    if(pScratch != NULL)
+        pScratch->m_bPoolThread = (m_dwQueues > 1);
+
+    // Keep going until all queues are empty
+    while(PopBatch(dwQueue, Batch))
+    {
+        for(size_t i = Batch.first; i < Batch.second; i++)
+        {
+            DecodeTask(m_Tasks[m_Order[i]]);
+        }
+    }
+
+    if(pScratch != NULL)
+        pScratch->m_bPoolThread = false;
+}
+
+bool TPdfDecodePool::PopBatch(DWORD dwQueue, TPdfDecodeBatch & Batch)
+{
+    bool bResult = false;
+
+    // Take the biggest batch from the own queue
+    EnterCriticalSection(&m_Queues[dwQueue].Lock);
+    if(m_Queues[dwQueue].Batches.size() != 0)
+    {
+        Batch = m_Queues[dwQueue].Batches.front();
+        m_Queues[dwQueue].Batches.pop_front();
+        bResult = true;
+    }
+    LeaveCriticalSection(&m_Queues[dwQueue].Lock);
+
+    // If there's nothing left, steal the smallest batch from other queue.
+    // No tasks are added while running, so empty queues stay empty.
+    for(DWORD i = 1; i < m_dwQueues && bResult == false; i++)
+    {
+        TPdfDecodeQueue & Queue = m_Queues[(dwQueue + i) % m_dwQueues];
+
+        EnterCriticalSection(&Queue.Lock);
+        if(Queue.Batches.size() != 0)
+        {
+            Batch = Queue.Batches.back();
+            Queue.Batches.pop_back();
+            bResult = true;
+        }
+        LeaveCriticalSection(&Queue.Lock);
+    }
+    return bResult;
+}
+
+void TPdfDecodePool::DecodeTask(TPdfDecodeTask & Task)
+{
+    try
+    {
+        if(Task.bPrepare)
+            Task.dwErrCode = Task.pPdfFile->Prepare(Task.ObjParams, Task.bExactSize);
+        else
+            Task.dwErrCode = Task.pPdfFile->Load(Task.ObjParams);
+
+        // Let the database evict decoded data right away, so that they never exceed the budget
+        if(Task.dwErrCode == ERROR_SUCCESS)
+            Task.pPdfFile->m_pPdfDb->InsertDecodedFile(Task.pPdfFile);
+    }
+    catch(std::bad_alloc)
+    {
+        Task.dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    }
+}
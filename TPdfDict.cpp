@@ -0,0 +1,558 @@
+/*****************************************************************************/
+/* TPdfDict.cpp                           Copyright (c) Ladislav Zezula 2024 */
+/*---------------------------------------------------------------------------*/
+/* Tokenizer and parser of PDF dictionaries                                  */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 16.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#include "wcx_pdf.h"
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+// PDF white-space characters: NUL, TAB, LF, FF, CR and SPACE
+static bool IsPdfWhiteSpace(BYTE OneByte)
+{
+    return (OneByte == 0x00 || OneByte == 0x09 || OneByte == 0x0A || OneByte == 0x0C || OneByte == 0x0D || OneByte == 0x20);
+}
+
+static bool IsPdfDelimiter(BYTE OneByte)
+{
+    switch(OneByte)
+    {
+        case '(': case ')': case '<': case '>': case '[': case ']': case '{': case '}': case '/': case '%':
+            return true;
+    }
+    return false;
+}
+
+static bool IsPdfRegular(BYTE OneByte)
+{
+    return !IsPdfWhiteSpace(OneByte) && !IsPdfDelimiter(OneByte);
+}
+
+static int GetHexDigit(BYTE OneByte)
+{
+    if('0' <= OneByte && OneByte <= '9')
+        return OneByte - '0';
+    if('A' <= OneByte && OneByte <= 'F')
+        return OneByte - 'A' + 10;
+    if('a' <= OneByte && OneByte <= 'f')
+        return OneByte - 'a' + 10;
+    return -1;
+}
+
+// Loads one character of a name. The "#xx" sequences are decoded
+static LPBYTE LoadNameChar(LPBYTE pbPtr, LPBYTE pbEnd, BYTE & RefValue)
+{
+    if(pbPtr[0] == '#' && (pbPtr + 2) < pbEnd)
+    {
+        int nHiDigit = GetHexDigit(pbPtr[1]);
+        int nLoDigit = GetHexDigit(pbPtr[2]);
+
+        if(nHiDigit >= 0 && nLoDigit >= 0)
+        {
+            RefValue = (BYTE)((nHiDigit << 4) | nLoDigit);
+            return pbPtr + 3;
+        }
+    }
+
+    RefValue = pbPtr[0];
+    return pbPtr + 1;
+}
+
+static LPBYTE SkipRegularChars(LPBYTE pbPtr, LPBYTE pbEnd)
+{
+    while(pbPtr < pbEnd && IsPdfRegular(pbPtr[0]))
+        pbPtr++;
+    return pbPtr;
+}
+
+static LPBYTE SkipDigits(LPBYTE pbPtr, LPBYTE pbEnd)
+{
+    while(pbPtr < pbEnd && '0' <= pbPtr[0] && pbPtr[0] <= '9')
+        pbPtr++;
+    return pbPtr;
+}
+
+static bool IsKeywordToken(LPBYTE pbBegin, LPBYTE pbEnd, LPCSTR szKeyword)
+{
+    size_t nLength = strlen(szKeyword);
+
+    return ((size_t)(pbEnd - pbBegin) == nLength && !_strnicmp((LPCSTR)pbBegin, szKeyword, nLength));
+}
+
+// Integer part of a number, the same way like atoi does
+static LONGLONG LoadNumber(const TPdfValue & Value)
+{
+    LPBYTE pbPtr = Value.pbBegin;
+    LONGLONG nSignValue = 1;
+    LONGLONG nValue = 0;
+
+    // Check for the sign
+    if(pbPtr < Value.pbEnd && (pbPtr[0] == '-' || pbPtr[0] == '+'))
+        nSignValue = (*pbPtr++ == '-') ? -1 : 1;
+
+    // Parse the number. Too big numbers stay at the maximum, so they never wrap to small ones
+    while(pbPtr < Value.pbEnd && '0' <= pbPtr[0] && pbPtr[0] <= '9')
+    {
+        nValue = (nValue <= (MAXLONGLONG - 9) / 10) ? (nValue * 10 + (pbPtr[0] - '0')) : MAXLONGLONG;
+        pbPtr++;
+    }
+    return nValue * nSignValue;
+}
+
+// Checks for the " G R" that follows the object number of an indirect reference
+static LPBYTE CheckReference(LPBYTE pbPtr, LPBYTE pbEnd)
+{
+    LPBYTE pbGeneration;
+
+    // Generation number
+    while(pbPtr < pbEnd && IsPdfWhiteSpace(pbPtr[0]))
+        pbPtr++;
+    if((pbGeneration = pbPtr) == (pbPtr = SkipDigits(pbPtr, pbEnd)))
+        return NULL;
+
+    // The "R" keyword
+    while(pbPtr < pbEnd && IsPdfWhiteSpace(pbPtr[0]))
+        pbPtr++;
+    if(pbPtr >= pbEnd || pbPtr[0] != 'R' || pbGeneration == pbPtr)
+        return NULL;
+    pbPtr++;
+
+    // The "R" must be a whole keyword
+    return (pbPtr >= pbEnd || !IsPdfRegular(pbPtr[0])) ? pbPtr : NULL;
+}
+
+// Skips the content of a nested dictionary or array, up to the closing sequence
+static LPBYTE SkipContainer(LPBYTE pbPtr, LPBYTE pbEnd, LPCSTR szClosing, DWORD dwNesting)
+{
+    size_t nLength = strlen(szClosing);
+    TPdfValue Value;
+    LPBYTE pbNext;
+
+    for(;;)
+    {
+        // Unterminated container ends at the end of the data
+        if((pbPtr = TPdfDict::SkipWhiteSpaces(pbPtr, pbEnd)) >= pbEnd)
+            return pbEnd;
+
+        // Closing bracket?
+        if((size_t)(pbEnd - pbPtr) >= nLength && !memcmp(pbPtr, szClosing, nLength))
+            return pbPtr + nLength;
+
+        // Skip the next value. Stray delimiters are skipped one by one
+        pbNext = TPdfDict::ParseValue(pbPtr, pbEnd, Value, dwNesting + 1);
+        pbPtr = (pbNext != NULL) ? pbNext : pbPtr + 1;
+    }
+}
+
+// Gives the range of the items of an array, without the brackets
+static bool GetArrayRange(const TPdfValue & Array, LPBYTE & pbPtr, LPBYTE & pbEnd)
+{
+    // Ignore the closing bracket
+    if(Array.Type != PDFV_Array)
+        return false;
+    pbPtr = Array.pbBegin + 1;
+    pbEnd = Array.pbEnd;
+    if(pbEnd > pbPtr && pbEnd[-1] == ']')
+        pbEnd--;
+    return true;
+}
+
+// Parses the next item of an array. Returns the pointer past the item, or NULL at the end of the array
+static LPBYTE GetNextArrayItem(LPBYTE pbPtr, LPBYTE pbEnd, TPdfValue & Item)
+{
+    LPBYTE pbNext;
+
+    // Stray delimiters are skipped one by one
+    while((pbPtr = TPdfDict::SkipWhiteSpaces(pbPtr, pbEnd)) < pbEnd)
+    {
+        if((pbNext = TPdfDict::ParseValue(pbPtr, pbEnd, Item)) != NULL)
+            return pbNext;
+        pbPtr++;
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Constructor
+
+TPdfDict::TPdfDict()
+{
+    m_nEntries = 0;
+    m_pbBegin = NULL;
+    m_pbEnd = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Tokenizer
+
+LPBYTE TPdfDict::SkipWhiteSpaces(LPBYTE pbPtr, LPBYTE pbEnd)
+{
+    while(pbPtr < pbEnd)
+    {
+        // Comments last until the end of the line
+        if(pbPtr[0] == '%')
+        {
+            while(pbPtr < pbEnd && pbPtr[0] != 0x0A && pbPtr[0] != 0x0D)
+                pbPtr++;
+            continue;
+        }
+
+        // Skip the white space
+        if(!IsPdfWhiteSpace(pbPtr[0]))
+            break;
+        pbPtr++;
+    }
+    return pbPtr;
+}
+
+LPBYTE TPdfDict::ParseValue(LPBYTE pbPtr, LPBYTE pbEnd, TPdfValue & Value, DWORD dwNesting)
+{
+    LPBYTE pbValueEnd;
+    DWORD dwParens = 1;
+
+    // Prepare the value
+    Value.pbBegin = Value.pbEnd = pbPtr;
+    Value.Type = PDFV_None;
+    if(pbPtr >= pbEnd)
+        return NULL;
+
+    switch(pbPtr[0])
+    {
+        case '/':       // Name. The "#xx" escapes are decoded when the name is compared or copied
+            Value.pbEnd = SkipRegularChars(pbPtr + 1, pbEnd);
+            Value.Type = PDFV_Name;
+            return Value.pbEnd;
+
+        case '(':       // Literal string. Balanced parentheses are allowed, the others are escaped by backslash
+            for(pbPtr++; pbPtr < pbEnd && dwParens != 0; pbPtr++)
+            {
+                if(pbPtr[0] == '\\')
+                    pbPtr++;
+                else if(pbPtr[0] == '(')
+                    dwParens++;
+                else if(pbPtr[0] == ')')
+                    dwParens--;
+            }
+            Value.pbEnd = min(pbPtr, pbEnd);
+            Value.Type = PDFV_String;
+            return Value.pbEnd;
+
+        case '<':       // Dictionary or hexadecimal string
+            if((pbPtr + 1) < pbEnd && pbPtr[1] == '<')
+            {
+                if(dwNesting >= PDF_MAX_NESTING)
+                    return NULL;
+                Value.pbEnd = SkipContainer(pbPtr + 2, pbEnd, ">>", dwNesting);
+                Value.Type = PDFV_Dict;
+                return Value.pbEnd;
+            }
+
+            while(pbPtr < pbEnd && pbPtr[0] != '>')
+                pbPtr++;
+            Value.pbEnd = min(pbPtr + 1, pbEnd);
+            Value.Type = PDFV_HexString;
+            return Value.pbEnd;
+
+        case '[':       // Array
+            if(dwNesting >= PDF_MAX_NESTING)
+                return NULL;
+            Value.pbEnd = SkipContainer(pbPtr + 1, pbEnd, "]", dwNesting);
+            Value.Type = PDFV_Array;
+            return Value.pbEnd;
+
+        case ')': case '>': case ']': case '{': case '}': case '%':
+            return NULL;
+    }
+
+    // Keywords and numbers are sequences of regular characters
+    pbValueEnd = SkipRegularChars(pbPtr, pbEnd);
+    Value.pbEnd = pbValueEnd;
+
+    // Numbers. Unsigned integer may be an object number of an indirect reference
+    if(('0' <= pbPtr[0] && pbPtr[0] <= '9') || pbPtr[0] == '-' || pbPtr[0] == '+' || pbPtr[0] == '.')
+    {
+        if(SkipDigits(pbPtr, pbValueEnd) == pbValueEnd && (Value.pbEnd = CheckReference(pbValueEnd, pbEnd)) != NULL)
+        {
+            Value.Type = PDFV_Ref;
+            return Value.pbEnd;
+        }
+
+        Value.pbEnd = pbValueEnd;
+        Value.Type = PDFV_Number;
+        return Value.pbEnd;
+    }
+
+    // Other keywords
+    if(IsKeywordToken(pbPtr, pbValueEnd, "true") || IsKeywordToken(pbPtr, pbValueEnd, "false"))
+        Value.Type = PDFV_Bool;
+    if(IsKeywordToken(pbPtr, pbValueEnd, "null"))
+        Value.Type = PDFV_Null;
+    return Value.pbEnd;
+}
+
+//-----------------------------------------------------------------------------
+// Parsing the dictionary
+
+LPBYTE TPdfDict::Parse(LPBYTE pbDictBegin, LPBYTE pbDictEnd)
+{
+    TPdfDictEntry Entry;
+    LPBYTE pbPtr = pbDictBegin + 2;
+    LPBYTE pbNext;
+
+    // Reset the dictionary
+    Clear();
+    m_pbBegin = pbDictBegin;
+
+    // The dictionary must begin with "<<"
+    if((pbDictBegin + 2) > pbDictEnd || pbDictBegin[0] != '<' || pbDictBegin[1] != '<')
+        return NULL;
+
+    for(;;)
+    {
+        // Unterminated dictionary. The entries loaded so far are kept
+        if((pbPtr = SkipWhiteSpaces(pbPtr, pbDictEnd)) >= pbDictEnd)
+        {
+            m_pbEnd = pbDictEnd;
+            return NULL;
+        }
+
+        // End of the dictionary?
+        if(pbPtr[0] == '>' && (pbPtr + 1) < pbDictEnd && pbPtr[1] == '>')
+            return (m_pbEnd = pbPtr + 2);
+
+        // Load the key. Anything else than a name is skipped
+        if((pbNext = ParseValue(pbPtr, pbDictEnd, Entry.Key)) == NULL || Entry.Key.Type != PDFV_Name)
+        {
+            pbPtr = (pbNext != NULL) ? pbNext : pbPtr + 1;
+            continue;
+        }
+
+        // Load the value. If the key has no value, it still goes to the table
+        pbPtr = SkipWhiteSpaces(pbNext, pbDictEnd);
+        if((pbNext = ParseValue(pbPtr, pbDictEnd, Entry.Value)) != NULL)
+            pbPtr = pbNext;
+
+        // Typical dictionaries fit the inline array, only the big ones need the vector
+        if(m_nEntries < PDF_DICT_INLINE_ENTRIES)
+            m_InlineEntries[m_nEntries] = Entry;
+        else
+            m_MoreEntries.push_back(Entry);
+        m_nEntries++;
+    }
+}
+
+void TPdfDict::Clear()
+{
+    m_MoreEntries.clear();
+    m_nEntries = 0;
+    m_pbBegin = m_pbEnd = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Querying the values
+
+bool TPdfDict::IsName(const TPdfValue & Value, LPCSTR szName)
+{
+    LPBYTE pbPtr = Value.pbBegin;
+    BYTE OneByte = 0;
+
+    // The name is compared including the leading slash
+    if(Value.Type != PDFV_Name)
+        return false;
+
+    // Compare the name with decoded "#xx" escapes
+    while(pbPtr < Value.pbEnd)
+    {
+        pbPtr = LoadNameChar(pbPtr, Value.pbEnd, OneByte);
+        if(szName[0] == 0 || (BYTE)(*szName++) != OneByte)
+            return false;
+    }
+    return (szName[0] == 0);
+}
+
+const TPdfValue * TPdfDict::Find(LPCSTR szKey) const
+{
+    // Dictionaries are small, a linear search is faster than anything else.
+    // If the key is present multiple times, the first one wins.
+    for(size_t i = 0; i < m_nEntries && i < PDF_DICT_INLINE_ENTRIES; i++)
+    {
+        if(IsName(m_InlineEntries[i].Key, szKey))
+            return &m_InlineEntries[i].Value;
+    }
+    for(size_t i = 0; i < m_MoreEntries.size(); i++)
+    {
+        if(IsName(m_MoreEntries[i].Key, szKey))
+            return &m_MoreEntries[i].Value;
+    }
+    return NULL;
+}
+
+bool TPdfDict::GetInt(LPCSTR szKey, int & RefValue, int nDefaultValue, bool bBoolAllowed) const
+{
+    const TPdfValue * pValue;
+    LONGLONG nValue;
+
+    if((pValue = Find(szKey)) != NULL)
+    {
+        // Integer, or the integer part of a real number. Numbers that don't fit are not valid
+        if(pValue->Type == PDFV_Number && pValue->pbBegin[0] != '.')
+        {
+            if((nValue = LoadNumber(*pValue)) >= INT_MIN && nValue <= INT_MAX)
+            {
+                RefValue = (int)nValue;
+                return true;
+            }
+        }
+
+        // Try to convert from Boolean, if allowed
+        if(bBoolAllowed && pValue->Type == PDFV_Bool)
+        {
+            RefValue = (pValue->pbBegin[0] == 't' || pValue->pbBegin[0] == 'T') ? 1 : 0;
+            return true;
+        }
+    }
+
+    // Supply default value
+    RefValue = nDefaultValue;
+    return false;
+}
+
+bool TPdfDict::GetInt(LPCSTR szKey, LONGLONG & RefValue, LONGLONG nDefaultValue) const
+{
+    const TPdfValue * pValue;
+
+    // Sizes and offsets may exceed 4 GB
+    if((pValue = Find(szKey)) != NULL && pValue->Type == PDFV_Number && pValue->pbBegin[0] != '.')
+    {
+        RefValue = LoadNumber(*pValue);
+        return true;
+    }
+
+    // Supply default value
+    RefValue = nDefaultValue;
+    return false;
+}
+
+bool TPdfDict::GetName(LPCSTR szKey, LPSTR szBuffer, size_t ccBuffer, LPCSTR szDefaultValue) const
+{
+    const TPdfValue * pValue;
+    LPSTR szBufferEnd = szBuffer + ccBuffer - 1;
+    BYTE OneByte = 0;
+
+    // Copy the name, including the leading slash
+    if((pValue = Find(szKey)) != NULL && pValue->Type == PDFV_Name && ccBuffer != 0)
+    {
+        for(LPBYTE pbPtr = pValue->pbBegin; pbPtr < pValue->pbEnd && szBuffer < szBufferEnd; )
+        {
+            pbPtr = LoadNameChar(pbPtr, pValue->pbEnd, OneByte);
+            *szBuffer++ = (char)OneByte;
+        }
+        szBuffer[0] = 0;
+        return true;
+    }
+
+    // Supply default value
+    if(szDefaultValue != NULL)
+        StringCchCopyA(szBuffer, ccBuffer, szDefaultValue);
+    return false;
+}
+
+bool TPdfDict::GetArray(LPCSTR szKey, std::vector<ULONGLONG> & Array) const
+{
+    const TPdfValue * pValue;
+    TPdfValue Item;
+    LPBYTE pbPtr;
+    LPBYTE pbEnd;
+
+    // Load all non-negative integers up to the first item that is not.
+    // The array is walked only once, big /Kids or /Index arrays would take long otherwise
+    if((pValue = Find(szKey)) != NULL && GetArrayRange(*pValue, pbPtr, pbEnd))
+    {
+        while((pbPtr = GetNextArrayItem(pbPtr, pbEnd, Item)) != NULL)
+        {
+            if(Item.Type != PDFV_Number || Item.pbBegin[0] == '-')
+                break;
+            Array.push_back((ULONGLONG)LoadNumber(Item));
+        }
+        return true;
+    }
+    return false;
+}
+
+bool TPdfDict::GetRef(LPCSTR szKey, DWORD & RefObjectId) const
+{
+    const TPdfValue * pValue;
+    LONGLONG nObjectId;
+
+    // Indirect reference has the form of "N G R"
+    if((pValue = Find(szKey)) != NULL && pValue->Type == PDFV_Ref)
+    {
+        if((nObjectId = LoadNumber(*pValue)) > 0 && nObjectId <= 0xFFFFFFFF)
+        {
+            RefObjectId = (DWORD)nObjectId;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TPdfDict::GetDict(LPCSTR szKey, TPdfDict & Dict) const
+{
+    const TPdfValue * pValue;
+
+    // Nested dictionaries are only parsed when needed
+    Dict.Clear();
+    if((pValue = Find(szKey)) != NULL && pValue->Type == PDFV_Dict)
+    {
+        Dict.Parse(pValue->pbBegin, pValue->pbEnd);
+        return true;
+    }
+    return false;
+}
+
+bool TPdfDict::GetDecodeParms(DWORD dwFilterIndex, TPdfDict & DecodeParms) const
+{
+    const TPdfValue * pValue;
+    TPdfValue Item;
+
+    // The "/DecodeParms" is either a dictionary or an array, parallel to the "/Filter" array
+    DecodeParms.Clear();
+    if((pValue = Find("/DecodeParms")) != NULL)
+    {
+        if(pValue->Type == PDFV_Dict)
+        {
+            DecodeParms.Parse(pValue->pbBegin, pValue->pbEnd);
+            return true;
+        }
+
+        if(pValue->Type == PDFV_Array && GetArrayItem(*pValue, dwFilterIndex, Item) && Item.Type == PDFV_Dict)
+        {
+            DecodeParms.Parse(Item.pbBegin, Item.pbEnd);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TPdfDict::GetArrayItem(const TPdfValue & Array, size_t nIndex, TPdfValue & Item)
+{
+    LPBYTE pbPtr;
+    LPBYTE pbEnd;
+
+    // Walk the items until we get to the requested one
+    if(GetArrayRange(Array, pbPtr, pbEnd))
+    {
+        while((pbPtr = GetNextArrayItem(pbPtr, pbEnd, Item)) != NULL)
+        {
+            if(nIndex-- == 0)
+                return true;
+        }
+    }
+    return false;
+}
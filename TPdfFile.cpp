@@ -9,30 +9,41 @@
 /*****************************************************************************/
 
 #include "wcx_pdf.h"
-#include "decode_ascii85.h"                     // Decoding ASCII85 data
 #include "decode_ccitt.h"                       // Decoding CCITTFax data
-#include "decode_lzw.h"                         // Decoding LZW data
-#include "decode_runlength.h"                   // Decoding run-length data
 #include "./zlib/zlib.h"                        // Decoding FlateDecode data
 
 //-----------------------------------------------------------------------------
 // Constructor and destructor
 
-TPdfFile::TPdfFile(LPBYTE pbData, LPBYTE pbEnd, DWORD dwObjectId) : TPdfBlob(pbData, pbEnd)
+TPdfFile::TPdfFile(LPBYTE pbData, LPBYTE pbEnd, DWORD dwObjectId, TPdfArena * pArena) : TPdfBlob(pbData, pbEnd)
 {
     m_Entry.Flink = m_Entry.Blink = NULL;
+    m_DecodedEntry.Flink = m_DecodedEntry.Blink = NULL;
     m_pPdfDb = NULL;
+    m_pArena = pArena;
     m_dwRefs = 1;
 
     // Setup the filters
     memset(m_Filters, 0, sizeof(m_Filters));
+    memset(m_FilterIndexes, 0, sizeof(m_FilterIndexes));
     m_dwFilters = 0;
 
     // Setup the object data
     m_szExtension = NULL;
     m_szFileType = NULL;
     m_dwObjectId = dwObjectId;
-    m_dwRawSize = 0;
+    m_dwRevision = 0;
+    m_RawSize = (ULONGLONG)(pbEnd - pbData);
+    m_FileSize = 0;
+
+    // Remember the raw data for lazy decoding
+    m_pbRawData = pbData;
+    m_pbRawEnd = pbEnd;
+    m_pbObject = NULL;
+    m_pbParamsBegin = NULL;
+    m_pbParamsEnd = NULL;
+    m_bDecoded = false;
+    m_bExactSize = false;
 }
 
 TPdfFile::~TPdfFile()
@@ -40,10 +51,143 @@ TPdfFile::~TPdfFile()
     if(m_pPdfDb != NULL)
     {
         RemoveEntryList(&m_Entry);
-        m_pPdfDb->Release();
     }
 }
 
+//-----------------------------------------------------------------------------
+// Local functions
+
+// Supplies the next chunk of the Flate stream to zlib
+static void InflateNextChunk(z_stream & z, LPBYTE & pbInput, LPBYTE pbInputEnd)
+{
+    if(z.avail_in == 0 && pbInput < pbInputEnd)
+    {
+        z.next_in  = (Bytef *)pbInput;
+        z.avail_in = (uInt)min((size_t)(pbInputEnd - pbInput), (size_t)PDF_ZLIB_CHUNK_SIZE);
+        pbInput += z.avail_in;
+    }
+}
+
+// Inflates the beginning of the Flate stream (or all of it, if bCountAll is true)
+// without keeping the output. Gives the first bytes and the decompressed size.
+static DWORD InflatePeek(TPdfBlob & Input, LPBYTE pbPeek, size_t cbPeek, ULONGLONG & RefTotalOut, bool bCountAll)
+{
+    z_stream z = {NULL};
+    ULONGLONG TotalOut = 0;
+    LPBYTE pbInput = Input.pbData;
+    DWORD dwErrCode = ERROR_SUCCESS;
+    BYTE Buffer[0x1000];
+    int nResult = Z_OK;
+
+    // Initialize the decompression
+    InflateNextChunk(z, pbInput, Input.pbEnd);
+    if(inflateInit2(&z, MAX_WBITS) != Z_OK)
+        return ERROR_VERSION_PARSE_ERROR;
+
+    // Decompress the data chunk by chunk. The z.total_out is only 32-bit on Windows
+    while(nResult == Z_OK)
+    {
+        size_t cbOutput;
+
+        InflateNextChunk(z, pbInput, Input.pbEnd);
+        z.next_out  = Buffer;
+        z.avail_out = sizeof(Buffer);
+        nResult = inflate(&z, Z_NO_FLUSH);
+        cbOutput = sizeof(Buffer) - z.avail_out;
+
+        // Copy the first bytes to the peek buffer
+        if(TotalOut < cbPeek)
+            memcpy(pbPeek + TotalOut, Buffer, min(cbPeek - (size_t)TotalOut, cbOutput));
+        TotalOut += cbOutput;
+        if(bCountAll == false && TotalOut >= cbPeek)
+            break;
+
+        // Truncated streams are accepted, like in DecodeObject_Flate
+        if(nResult == Z_OK && z.avail_in == 0 && pbInput == Input.pbEnd && z.avail_out != 0)
+            break;
+    }
+
+    // Z_BUF_ERROR means that no progress was possible (end of the input).
+    // Same as on extraction, that is only accepted if some data have been decoded
+    if(nResult == Z_BUF_ERROR && TotalOut != 0)
+        nResult = Z_STREAM_END;
+    if(nResult != Z_OK && nResult != Z_STREAM_END)
+        dwErrCode = ERROR_FILE_CORRUPT;
+    RefTotalOut = TotalOut;
+    inflateEnd(&z);
+    return dwErrCode;
+}
+
+// Number of color components of an image. 0 = not known
+static int GetColorComponents(const TPdfDict & ObjParams)
+{
+    const TPdfValue * pValue;
+    TPdfValue Family;
+
+    static const struct { LPCSTR szName; int nComponents; } ColorSpaces[] =
+    {
+        {"/DeviceGray", 1}, {"/G", 1}, {"/CalGray", 1}, {"/Indexed", 1}, {"/I", 1}, {"/Separation", 1},
+        {"/DeviceRGB", 3},  {"/RGB", 3}, {"/CalRGB", 3}, {"/Lab", 3},
+        {"/DeviceCMYK", 4}, {"/CMYK", 4}
+    };
+
+    // The color space is either a name or an array that begins with the family name.
+    // ICC-based and indirect color spaces are not known without loading other objects
+    if((pValue = ObjParams.Find("/ColorSpace")) == NULL)
+        return 0;
+    if(pValue->Type == PDFV_Name)
+        Family = *pValue;
+    else if(!TPdfDict::GetArrayItem(*pValue, 0, Family))
+        return 0;
+
+    for(size_t i = 0; i < _countof(ColorSpaces); i++)
+    {
+        if(TPdfDict::IsName(Family, ColorSpaces[i].szName))
+            return ColorSpaces[i].nComponents;
+    }
+    return 0;
+}
+
+// Size of the image samples, as given by the image dictionary. 0 = not an image or not known
+static ULONGLONG GetImageDataSize(const TPdfDict & ObjParams, const TPdfDict & DecodeParms)
+{
+    ULONGLONG RowSize;
+    char szSubtype[32];
+    int nWidth = 0;
+    int nHeight = 0;
+    int nBitsPerComponent = 8;
+    int nComponents = 1;
+    int nPredictor = 1;
+    int bImageMask = 0;
+
+    if(!ObjParams.GetName("/Subtype", szSubtype, _countof(szSubtype)) || strcmp(szSubtype, "/Image"))
+        return 0;
+    ObjParams.GetInt("/Width", nWidth);
+    ObjParams.GetInt("/Height", nHeight);
+    ObjParams.GetInt("/ImageMask", bImageMask, 0, true);
+
+    // Image masks always have one bit per pixel
+    if(bImageMask == 0)
+    {
+        ObjParams.GetInt("/BitsPerComponent", nBitsPerComponent, 8);
+        nComponents = GetColorComponents(ObjParams);
+    }
+    else
+    {
+        nBitsPerComponent = 1;
+    }
+
+    if(nWidth <= 0 || nHeight <= 0 || nComponents == 0 || nBitsPerComponent <= 0 || nBitsPerComponent > 16)
+        return 0;
+    RowSize = ((ULONGLONG)nWidth * nComponents * nBitsPerComponent + 7) / 8;
+
+    // The PNG predictors keep the predictor type byte at the begin of each row
+    DecodeParms.GetInt("/Predictor", nPredictor, 1);
+    if(nPredictor >= 10)
+        RowSize++;
+    return RowSize * nHeight;
+}
+
 //-----------------------------------------------------------------------------
 // Member functions
 
@@ -56,7 +200,13 @@ DWORD TPdfFile::Release()
 {
     if(m_dwRefs == 1)
     {
+        TPdfDatabase * pPdfDb = m_pPdfDb;
+
+        // The file lives in the arena of the database,
+        // so the database can only be released after the file is gone
         delete this;
+        if(pPdfDb != NULL)
+            pPdfDb->Release();
         return 0;
     }
 
@@ -70,124 +220,76 @@ void TPdfFile::SetOwner(TPdfDatabase * pPdfDb)
     m_pPdfDb = pPdfDb;
 }
 
-LPCSTR TPdfFile::GetStreamFilter(LPCSTR szPtr, size_t & RefLength)
+PDFFL TPdfFile::GetStreamFilter(const TPdfValue & Name)
 {
-    size_t nLength = 0;
-
-    // Skip spaces until we find the "/" character 
-    while(szPtr[0] != 0 && szPtr[0] != '/')
-        szPtr++;
-
-    // Did we find a filter name?
-    if(szPtr[0] == '/')
+    // Full names and abbreviations of the filters that we support
+    static const struct
     {
-        // Skip the opening slash
-        szPtr++;
-
-        // Copy the filter name
-        while('0' <= szPtr[nLength] && szPtr[nLength] <= 'z')
-            nLength++;
-
-        // Give the length of the filter name
-        RefLength = nLength;
-        return szPtr;
+        LPCSTR szName;
+        PDFFL Filter;
+    } Filters[] =
+    {
+        {"/FlateDecode",     PDFF_Flate},
+        {"/Fl",              PDFF_Flate},
+        {"/RunLengthDecode", PDFF_RunLength},
+        {"/RL",              PDFF_RunLength},
+        {"/ASCII85Decode",   PDFF_Ascii85},
+        {"/A85",             PDFF_Ascii85},
+        {"/ASCIIHexDecode",  PDFF_AsciiHex},
+        {"/AHx",             PDFF_AsciiHex},
+        {"/CCITTFaxDecode",  PDFF_CCITTFaxDecode},
+        {"/CCF",             PDFF_CCITTFaxDecode},
+        {"/DCTDecode",       PDFF_DCT},
+        {"/DCT",             PDFF_DCT},
+        {"/LZWDecode",       PDFF_LZW},
+    };
+
+    for(size_t i = 0; i < _countof(Filters); i++)
+    {
+        if(TPdfDict::IsName(Name, Filters[i].szName))
+            return Filters[i].Filter;
     }
-    return NULL;
+
+    // An unknown filter
+    return PDFF_Plain;
 }
 
-DWORD TPdfFile::GetStreamFilters(LPCSTR szObjParams, PDFFL * Filters, DWORD & RefFilterCount)
+DWORD TPdfFile::GetStreamFilters(const TPdfDict & ObjParams, PDFFL * Filters, DWORD * FilterIndexes, DWORD & RefFilterCount)
 {
+    const TPdfValue * pValue;
+    TPdfValue Item;
     DWORD dwFilters = 0;
-    char szFilters[64];
+    char szSubtype[32];
 
-    // Parse filters
-    if(GetObjectVariableString(szObjParams, "/Filter", szFilters, _countof(szFilters)))
+    // The filter is either a single name or an array of names.
+    // Unknown filters are skipped, but each filter keeps its position for its /DecodeParms
+    if((pValue = ObjParams.Find("/Filter")) != NULL)
     {
-        LPCSTR szPtr = szFilters;
-        size_t nLength = 0;
-
-        while((szPtr = GetStreamFilter(szPtr, nLength)) != NULL)
+        if(pValue->Type == PDFV_Name && GetStreamFilter(*pValue) != PDFF_Plain)
         {
-            //DWORD dwSaveFilters = dwFilters;
+            FilterIndexes[dwFilters] = 0;
+            Filters[dwFilters++] = GetStreamFilter(*pValue);
+        }
 
-            // Perform filter checking
-            switch(nLength)
+        if(pValue->Type == PDFV_Array)
+        {
+            for(size_t i = 0; dwFilters < PDF_MAX_FILTERS && TPdfDict::GetArrayItem(*pValue, i, Item); i++)
             {
-                case sizeof("Fl") - 1:
-                {
-                    if(!memcmp(szPtr, "Fl", nLength))
-                        Filters[dwFilters++] = PDFF_Flate;
-                    if(!memcmp(szPtr, "RL", nLength))
-                        Filters[dwFilters++] = PDFF_RunLength;
-                    break;
-                }
-                case sizeof("A85") - 1:
-                {
-                    if(!memcmp(szPtr, "A85", nLength))
-                        Filters[dwFilters++] = PDFF_Ascii85;
-                    if(!memcmp(szPtr, "AHx", nLength))
-                        Filters[dwFilters++] = PDFF_AsciiHex;
-                    if(!memcmp(szPtr, "CCF", nLength))
-                        Filters[dwFilters++] = PDFF_CCITTFaxDecode;
-                    if(!memcmp(szPtr, "DCT", nLength))
-                        Filters[dwFilters++] = PDFF_DCT;
-                    break;
-                }
-                case sizeof("DCTDecode") - 1:
-                {
-                    if(!memcmp(szPtr, "DCTDecode", nLength))
-                        Filters[dwFilters++] = PDFF_DCT;
-                    if(!memcmp(szPtr, "LZWDecode", nLength))
-                        Filters[dwFilters++] = PDFF_LZW;
-                    break;
-                }
-                case sizeof("FlateDecode") - 1:
+                if(GetStreamFilter(Item) != PDFF_Plain)
                 {
-                    if(!memcmp(szPtr, "FlateDecode", nLength))
-                        Filters[dwFilters++] = PDFF_Flate;
-                    break;
-                }
-                case sizeof("ASCII85Decode") - 1:
-                {
-                    if(!memcmp(szPtr, "ASCII85Decode", nLength))
-                        Filters[dwFilters++] = PDFF_Ascii85;
-                    break;
-                }
-                case sizeof("ASCIIHexDecode") - 1:
-                {
-                    if(!memcmp(szPtr, "ASCIIHexDecode", nLength))
-                        Filters[dwFilters++] = PDFF_AsciiHex;
-                    if(!memcmp(szPtr, "CCITTFaxDecode", nLength))
-                        Filters[dwFilters++] = PDFF_CCITTFaxDecode;
-                    break;
-                }
-                case sizeof("RunLengthDecode") - 1:
-                {
-                    if(!memcmp(szPtr, "RunLengthDecode", nLength))
-                        Filters[dwFilters++] = PDFF_RunLength;
-                    break;
+                    FilterIndexes[dwFilters] = (DWORD)i;
+                    Filters[dwFilters++] = GetStreamFilter(Item);
                 }
             }
-
-            // An unknown filter
-            //if(dwFilters == dwSaveFilters)
-            //{
-            //    assert(false);
-            //    return ERROR_BAD_FORMAT;
-            //}
-
-            // Move past the filter
-            szPtr += nLength;
         }
     }
 
-    if(GetObjectVariableString(szObjParams, "/Subtype", szFilters, _countof(szFilters)))
+    // If the subtype is XML, then its a XML :-)
+    if(ObjParams.GetName("/Subtype", szSubtype, _countof(szSubtype)) && !strcmp(szSubtype, "/XML"))
     {
-        if(strstr(szFilters, "/XML"))
-        {
-            Filters[0] = PDFF_PlainXml;
-            dwFilters = 1;
-        }
+        FilterIndexes[0] = 0;
+        Filters[0] = PDFF_PlainXml;
+        dwFilters = 1;
     }
 
     // Give the number of filters
@@ -195,22 +297,22 @@ DWORD TPdfFile::GetStreamFilters(LPCSTR szObjParams, PDFFL * Filters, DWORD & Re
     return ERROR_SUCCESS;
 }
 
-LPCTSTR TPdfFile::FileExtension()
+LPCTSTR TPdfFile::FileExtension(TPdfBlob & Data)
 {
     // If the subtype is XML, then its a XML :-)
     if(m_Filters[0] == PDFF_PlainXml)
         return _T(".xml");
 
-    if(CheckData("\x49\x49\x2a\x00", 0x04))
+    if(Data.CheckData("\x49\x49\x2a\x00", 0x04))
         return _T(".tif");
 
-    if(CheckData("P4\n", 0x03))
+    if(Data.CheckData("P4\n", 0x03))
         return _T(".pbm");
 
-    if(CheckData("\xFF\xD8\xFF", 0x03))
+    if(Data.CheckData("\xFF\xD8\xFF", 0x03))
         return _T(".jpg");
 
-    if(CheckData("%PDF-1.", 0x07))
+    if(Data.CheckData("%PDF-1.", 0x07))
         return _T(".pdf");
 
     return _T(".dat");
@@ -218,173 +320,303 @@ LPCTSTR TPdfFile::FileExtension()
 
 void TPdfFile::GetName(LPTSTR szBuffer, size_t cchBuffer)
 {
-    StringCchPrintf(szBuffer, cchBuffer, _T("object-%s-%08u%s"), m_szFileType, m_dwObjectId, m_szExtension);
+    // Objects from older revisions go to the "rev-N" folders
+    if(m_dwRevision != 0)
+        StringCchPrintf(szBuffer, cchBuffer, _T("rev-%u\\object-%s-%08u%s"), m_dwRevision, m_szFileType, m_dwObjectId, m_szExtension);
+    else
+        StringCchPrintf(szBuffer, cchBuffer, _T("object-%s-%08u%s"), m_szFileType, m_dwObjectId, m_szExtension);
+}
+
+// Gives the exact size of the data decoded by the given number of filters, if it is known
+// without decoding. Returns 0 if the size is not known
+size_t TPdfFile::GetExpectedSize(const TPdfDict & ObjParams, DWORD dwChainFilters)
+{
+    const TPdfValue * pValue;
+    TPdfValue Item;
+    TPdfDict DecodeParms;
+    LONGLONG DecodedLength = 0;
+    ULONGLONG ExpectedSize = 0;
+    size_t nFilterNames = 0;
+
+    // The filters after CCITT are not decoded by the chain
+    if(dwChainFilters != m_dwFilters || m_dwFilters == 0)
+        return 0;
+
+    // The file has been decoded before, or its decoded size has been counted
+    if(m_bExactSize)
+        return (m_FileSize < (size_t)(-1)) ? (size_t)m_FileSize : 0;
+
+    // The object parameters describe the data after all filters. If there is
+    // a filter that is not decoded by the chain or an unknown filter, they are useless
+    for(DWORD i = 0; i < m_dwFilters; i++)
+    {
+        if(m_Filters[i] == PDFF_Plain || m_Filters[i] == PDFF_PlainXml || m_Filters[i] == PDFF_DCT)
+            return 0;
+    }
+    if((pValue = ObjParams.Find("/Filter")) != NULL)
+    {
+        if(pValue->Type == PDFV_Name)
+            nFilterNames = 1;
+        while(TPdfDict::GetArrayItem(*pValue, nFilterNames, Item))
+            nFilterNames++;
+    }
+    if(nFilterNames != m_dwFilters)
+        return 0;
+
+    // Use the /DL (decoded length) or the size of the image samples
+    if(ObjParams.GetInt("/DL", DecodedLength) && DecodedLength > 0)
+    {
+        ExpectedSize = (ULONGLONG)DecodedLength;
+    }
+    else
+    {
+        ObjParams.GetDecodeParms(m_FilterIndexes[m_dwFilters - 1], DecodeParms);
+        ExpectedSize = GetImageDataSize(ObjParams, DecodeParms);
+    }
+
+    // Don't trust sizes that no filter can produce
+    if(ExpectedSize > (ULONGLONG)Size() * PDF_MAX_PREDICT_RATIO)
+        return 0;
+    return (size_t)ExpectedSize;
 }
 
-DWORD TPdfFile::Load(LPCSTR szObjParams)
+DWORD TPdfFile::Load(const TPdfDict & ObjParams)
 {
-    DWORD dwErrCode = ERROR_SUCCESS;
+    TPdfFilterChain Chain;
+    TPdfBlob Decoded;
+    DWORD dwCCITT;
+    DWORD dwErrCode;
 
     // Load the filters
-    GetStreamFilters(szObjParams, m_Filters, m_dwFilters);
+    GetStreamFilters(ObjParams, m_Filters, m_FilterIndexes, m_dwFilters);
+
+    // The CCITT decoder needs all its input at once. Filters after it are ignored
+    for(dwCCITT = 0; dwCCITT < m_dwFilters; dwCCITT++)
+    {
+        if(m_Filters[dwCCITT] == PDFF_CCITTFaxDecode)
+            break;
+    }
 
-    // Apply the filters
-    for(DWORD i = 0; i < m_dwFilters && dwErrCode == ERROR_SUCCESS; i++)
+    // Pull the data through the filters. The output buffer is sized by the expected size of the data
+    if((dwErrCode = Chain.Open(pbData, pbEnd, m_Filters, m_FilterIndexes, dwCCITT, ObjParams)) == ERROR_SUCCESS && !Chain.IsEmpty())
     {
-        TPdfBlob TempBlob;
+        if((dwErrCode = Chain.ReadAll(Decoded, GetExpectedSize(ObjParams, dwCCITT), m_pArena)) == ERROR_SUCCESS)
+        {
+            FreeData();
+            MoveFrom(Decoded);
+        }
+    }
+    Chain.Close();
 
-        // Move the content from data to the temporary blob
-        TempBlob.MoveFrom(*this);
+    // Apply the CCITT decoding
+    if(dwErrCode == ERROR_SUCCESS && dwCCITT < m_dwFilters)
+    {
+        TPdfDict DecodeParms;
 
-        // Apply the decoding
+        ObjParams.GetDecodeParms(m_FilterIndexes[dwCCITT], DecodeParms);
+        Decoded.MoveFrom(*this);
+        dwErrCode = DecodeObject_CCITT(Decoded, ObjParams, DecodeParms);
+    }
+
+    // Reset the position to the begin of the stream
+    ResetPosition();
+
+    // On success, generate the file name. If the file was prepared
+    // for lazy decoding, the name has already been given
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        // Supply the default extension
+        if(m_szExtension == NULL)
+            m_szExtension = FileExtension(*this);
+        m_szFileType = _T("stream");
+        m_FileSize = Size();
+        m_bExactSize = true;
+        m_bDecoded = true;
+
+        // Small decoded data are moved to the arena of the database, unless the filter chain has put them there.
+        // They stay there until the database is closed, so they are never evicted and decoded again
+        if(m_pArena != NULL && bAllocated && Size() <= PDF_ARENA_MAX_STREAM)
+        {
+            LPBYTE pbArenaData;
+
+            if((pbArenaData = (LPBYTE)m_pArena->Alloc(Size())) != NULL)
+            {
+                size_t cbData = Size();
+
+                memcpy(pbArenaData, pbData, cbData);
+                SetData(pbArenaData, pbArenaData + cbData, false);
+            }
+        }
+    }
+    return dwErrCode;
+}
+
+DWORD TPdfFile::Prepare(const TPdfDict & ObjParams, bool bExactSize)
+{
+    TPdfBlob PeekData;
+    ULONGLONG FileSize = Size();
+    ULONGLONG TotalOut = 0;
+    LONGLONG DecodedLength = 0;
+    DWORD dwFlateFilters = 0;
+    BYTE Peek[0x10] = {0};
+    int bImageMask = 0;
+
+    // Load the filters
+    GetStreamFilters(ObjParams, m_Filters, m_FilterIndexes, m_dwFilters);
+
+    // We can only name the file without decoding it if the first bytes of the output can be obtained cheaply.
+    // Other filter chains are decoded right away.
+    for(DWORD i = 0; i < m_dwFilters; i++)
+    {
         switch(m_Filters[i])
         {
             case PDFF_Plain:
             case PDFF_PlainXml:
             case PDFF_DCT:
-                MoveFrom(TempBlob);
-                break;
-
-            case PDFF_Ascii85:
-                dwErrCode = ascii85_decode(*this, TempBlob);
-                break;
-
-            case PDFF_AsciiHex:
-                dwErrCode = DecodeObject_AsciiHex(TempBlob);
                 break;
 
             case PDFF_Flate:
-                dwErrCode = DecodeObject_Flate(TempBlob);
-                break;
-
-            case PDFF_LZW:
-                dwErrCode = DecodeObject_LZW(TempBlob, szObjParams);
+                if(dwFlateFilters++ != 0)
+                    return Load(ObjParams);
                 break;
 
             case PDFF_CCITTFaxDecode:
-                dwErrCode = DecodeObject_CCITT(TempBlob, szObjParams);
-                goto __finalize;
-
-            case PDFF_RunLength:
-                dwErrCode = DecodeObject_RunLength(TempBlob);
+                if(m_dwFilters != 1)
+                    return Load(ObjParams);
                 break;
+
+            default:
+                return Load(ObjParams);
         }
+    }
 
-        // Reset the position to the begin of the stream
-        ResetPosition();
+    // The object parameters are needed for decoding. They are parsed again from the PDF data
+    if(m_pbParamsBegin == NULL)
+    {
+        m_pbParamsBegin = ObjParams.m_pbBegin;
+        m_pbParamsEnd = ObjParams.m_pbEnd;
     }
 
-__finalize:
+    // Determine the extension and the (estimated) size of the decoded data
+    if(dwFlateFilters != 0)
+    {
+        // Inflate the first few bytes. Inflate everything if the exact size is required.
+        if(InflatePeek(*this, Peek, sizeof(Peek), TotalOut, bExactSize) != ERROR_SUCCESS)
+            return Load(ObjParams);
+        PeekData.SetData(Peek, Peek + ((TotalOut < sizeof(Peek)) ? (size_t)TotalOut : sizeof(Peek)), false);
+        m_szExtension = FileExtension(PeekData);
+
+        // Without the counting pass, use the /DL (decoded length), if present.
+        // Otherwise, assume the compression ratio of 1:4, which is typical for PDF content
+        if(bExactSize)
+        {
+            FileSize = TotalOut;
+            m_bExactSize = true;
+        }
+        else if(ObjParams.GetInt("/DL", DecodedLength) && DecodedLength > 0)
+        {
+            FileSize = (ULONGLONG)DecodedLength;
+        }
+        else
+        {
+            FileSize = (ULONGLONG)Size() * 4;
+        }
+    }
+    else if(m_dwFilters != 0 && m_Filters[0] == PDFF_CCITTFaxDecode)
+    {
+        // CCITT data are wrapped into the TIFF file, unless it's an image mask
+        ObjParams.GetInt("/ImageMask", bImageMask, 0, true);
+        m_szExtension = bImageMask ? FileExtension(*this) : _T(".tif");
+        FileSize = bImageMask ? Size() : Size() + 0x100;
+    }
+    else
+    {
+        // The data are stored as-is
+        m_szExtension = FileExtension(*this);
+    }
 
-    // Reset the position to the begin of the stream
-    ResetPosition();
+    // The file can be named now
+    m_FileSize = FileSize;
+    m_szFileType = _T("stream");
+    return ERROR_SUCCESS;
+}
 
-    // On success, generate the file name
-    if(dwErrCode == ERROR_SUCCESS)
+DWORD TPdfFile::LoadObjParams(TPdfDict & ObjParams)
+{
+    // The files only know where their object parameters are
+    if(m_pbParamsBegin != NULL)
     {
-        // Supply the default extension
-        m_szExtension = FileExtension();
-        m_szFileType = _T("stream");
+        try
+        {
+            ObjParams.Parse(m_pbParamsBegin, m_pbParamsEnd);
+        }
+        catch(std::bad_alloc)
+        {
+            ObjParams.Clear();
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
     }
-    return dwErrCode;
+    return ERROR_SUCCESS;
 }
 
-DWORD TPdfFile::DecodeObject_AsciiHex(TPdfBlob & Input)
+DWORD TPdfFile::Decode()
 {
-    BYTE HexValue;
+    TPdfDict ObjParams;
+    DWORD dwErrCode;
 
-    // Make sure that there is enough size in the output blob
-    if(Resize(Input.Size() / 2) != ERROR_SUCCESS)
-        return ERROR_NOT_ENOUGH_MEMORY;
+    // Already decoded?
+    if(m_bDecoded)
+        return ERROR_SUCCESS;
 
-    // Sanity checks
-    assert(Input.pbPtr == Input.pbData);
-    assert(pbPtr == pbData);
+    // Make sure that we have the object parameters
+    if((dwErrCode = LoadObjParams(ObjParams)) != ERROR_SUCCESS)
+        return dwErrCode;
 
-    // Decode the data
-    while(Input.GetHexValue(HexValue) == ERROR_SUCCESS)
-        *pbPtr++ = HexValue;
-    return ERROR_SUCCESS;
+    // Decode the raw data
+    SetData(m_pbRawData, m_pbRawEnd, false);
+    if((dwErrCode = Load(ObjParams)) != ERROR_SUCCESS)
+        SetData(m_pbRawData, m_pbRawEnd, false);
+    return dwErrCode;
 }
 
-DWORD TPdfFile::DecodeObject_Flate(TPdfBlob & Input)
+DWORD TPdfFile::OpenStream(TPdfFilterChain & Chain)
 {
-    z_stream z = {NULL};
-    size_t cbSize = Input.Size() * 2;
-    DWORD dwErrCode = ERROR_VERSION_PARSE_ERROR;
-    bool bDecompressionComplete = false;
-
-    // Sanity checks
-    assert(Input.pbPtr == Input.pbData);
-    assert(pbPtr == pbData);
-
-    // Fill the stream structure for zlib
-    z.next_in   = (Bytef *)Input.pbData;
-    z.avail_in =  (uInt)Input.Size();
-    z.total_in  = (uLong)Input.Size();
-    z.next_out  = (Bytef *)pbData;
-    z.avail_out = (uInt)   Size();
-    z.total_out = 0;
-
-    // Perform the decompression
-    // Initialize the decompression
-    if(inflateInit2(&z, MAX_WBITS) == Z_OK)
+    TPdfDict ObjParams;
+    DWORD dwErrCode;
+
+    // Lazily decoded files are streamed from the raw data, unless there is a filter
+    // that needs all the data at once. Everything else is read from memory.
+    if(m_bDecoded == false)
     {
-        while(bDecompressionComplete == false && (dwErrCode = Resize(cbSize)) == ERROR_SUCCESS)
-        {
-            // Setup the output buffer
-            z.next_out  = (Bytef *)(pbData + z.total_out);
-            z.avail_out = (uInt)(Size() - z.total_out);
-            bDecompressionComplete = true;
+        if((dwErrCode = LoadObjParams(ObjParams)) != ERROR_SUCCESS)
+            return dwErrCode;
 
-            // Call zlib to decompress the data
-            switch(inflate(&z, Z_NO_FLUSH))
+        GetStreamFilters(ObjParams, m_Filters, m_FilterIndexes, m_dwFilters);
+        for(DWORD i = 0; i < m_dwFilters; i++)
+        {
+            if(m_Filters[i] == PDFF_CCITTFaxDecode)
             {
-                case Z_OK:
-                    if(z.avail_in != 0)
-                    {
-                        bDecompressionComplete = false;
-                        cbSize = cbSize * 2;
-                    }
-                    break;
-
-                case Z_STREAM_END:
-                    break;
-
-                default:
-                    dwErrCode = ERROR_FILE_CORRUPT;
-                    break;
+                if((dwErrCode = Decode()) != ERROR_SUCCESS)
+                    return dwErrCode;
+                return Chain.Open(pbData, pbEnd, NULL, NULL, 0, ObjParams);
             }
         }
-
-        // If everything went OK, we update the file size
-        if(dwErrCode == ERROR_SUCCESS)
-            pbEnd = pbData + z.total_out;
-        inflateEnd(&z);
-    }
-    else
-    {
-        dwErrCode = ERROR_VERSION_PARSE_ERROR;
+        return Chain.Open(m_pbRawData, m_pbRawEnd, m_Filters, m_FilterIndexes, m_dwFilters, ObjParams);
     }
-    return dwErrCode;
+    return Chain.Open(pbData, pbEnd, NULL, NULL, 0, ObjParams);
 }
 
-DWORD TPdfFile::DecodeObject_LZW(TPdfBlob & Input, LPCSTR szObjParams)
+void TPdfFile::Unload()
 {
-    int nEarlyChange = 1;
-
-    // Sanity checks
-    assert(Input.pbPtr == Input.pbData);
-    assert(pbPtr == pbData);
-
-    // Retrieve the early change
-    GetObjectVariableInt(szObjParams, "/EarlyChange", nEarlyChange, 1);
-
-    // Perform the LZW Decode
-    return LZWDecode(*this, Input, nEarlyChange);
+    // Only files that know their object parameters can be decoded again
+    if(m_bDecoded && CanDecodeAgain())
+    {
+        SetData(m_pbRawData, m_pbRawEnd, false);
+        m_bDecoded = false;
+    }
 }
 
-DWORD TPdfFile::DecodeObject_CCITT(TPdfBlob & Input, LPCSTR szObjParams)
+DWORD TPdfFile::DecodeObject_CCITT(TPdfBlob & Input, const TPdfDict & ObjParams, const TPdfDict & DecodeParms)
 {
     int nK = 0;
     int bEndOfLine = 0;
@@ -395,35 +627,16 @@ DWORD TPdfFile::DecodeObject_CCITT(TPdfBlob & Input, LPCSTR szObjParams)
     int nColumns = 1728;
     int nRows = 0;
 
-    // Retrieve the encoding parameters
-    GetObjectVariableInt(szObjParams, "/K", nK, 0);
-    GetObjectVariableInt(szObjParams, "/EndOfLine", bEndOfLine, 0);
-    GetObjectVariableInt(szObjParams, "/Columns", nColumns, 1728);
-    GetObjectVariableInt(szObjParams, "/Rows", nRows, 0);
-    GetObjectVariableInt(szObjParams, "/EncodedByteAlign", bEncodedByteAlign, 0, true);
-    GetObjectVariableInt(szObjParams, "/EndOfBlock", bEndOfBlock, 1);
-    GetObjectVariableInt(szObjParams, "/BlackIs1", bBlackIs1, 0, true);
-    GetObjectVariableInt(szObjParams, "/ImageMask", bImageMask, 0, true);
+    // Retrieve the encoding parameters. The image mask flag is in the stream dictionary
+    DecodeParms.GetInt("/K", nK, 0);
+    DecodeParms.GetInt("/EndOfLine", bEndOfLine, 0, true);
+    DecodeParms.GetInt("/Columns", nColumns, 1728);
+    DecodeParms.GetInt("/Rows", nRows, 0);
+    DecodeParms.GetInt("/EncodedByteAlign", bEncodedByteAlign, 0, true);
+    DecodeParms.GetInt("/EndOfBlock", bEndOfBlock, 1, true);
+    DecodeParms.GetInt("/BlackIs1", bBlackIs1, 0, true);
+    ObjParams.GetInt("/ImageMask", bImageMask, 0, true);
 
     // Decode the plain image
     return CCITT_Decode(*this, Input, nK, bEndOfLine, bEncodedByteAlign, bEndOfBlock, bBlackIs1, bImageMask, nColumns, nRows);
 }
-
-DWORD TPdfFile::DecodeObject_RunLength(TPdfBlob & Input)
-{
-    DWORD dwErrCode;
-
-    // Sanity checks
-    assert(Input.pbPtr == Input.pbData);
-    assert(pbPtr == pbData);
-
-    // Let the output data have at least twice the size of the input data
-    if((dwErrCode = Resize(Input.Size() * 2)) == ERROR_SUCCESS)
-    {
-        if((dwErrCode = runlength_decode(*this, Input)) == ERROR_SUCCESS)
-        {
-            pbEnd = pbPtr;
-        }
-    }
-    return dwErrCode;
-}
@@ -0,0 +1,877 @@
+/*****************************************************************************/
+/* TPdfFilter.cpp                         Copyright (c) Ladislav Zezula 2024 */
+/*---------------------------------------------------------------------------*/
+/* Pull-based chain of stream filters                                        */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#include "wcx_pdf.h"
+#include "decode_ascii85.h"                     // Decoding ASCII85 data
+#include "decode_flate.h"                       // Decoding whole FlateDecode streams
+#include "decode_lzw.h"                         // Decoding LZW data
+#include "decode_runlength.h"                   // Decoding run-length data
+#include "./zlib/zlib.h"                        // Decoding FlateDecode data
+
+//-----------------------------------------------------------------------------
+// Local structures
+
+// State of the ASCIIHex decoder between two chunks of data
+struct TPdfHexState
+{
+    ULONGLONG InputBytes;                   // Number of input bytes processed so far
+    ULONGLONG OutputBytes;                  // Number of output bytes given so far
+    BYTE FirstChar;                         // The first character of the pair
+    bool bHaveFirst;                        // true = the first character of the pair has been loaded
+    bool bStopped;                          // true = an invalid character has been found
+};
+
+// State of the Flate decoder between two chunks of data
+struct TPdfFlateState
+{
+    z_stream z;
+    ULONGLONG TotalOut;                     // The z.total_out is only 32-bit on Windows, so we count the output ourselves
+    bool bDrained;                          // The last inflate() consumed all input without filling the output
+    bool bInitialized;                      // inflateEnd must be called. Initialized states are reused by inflateReset
+};
+
+// One stage of the filter chain. Each stage pulls its input from the previous stage.
+// The first stage reads the raw stream data directly
+struct TPdfFilterStage
+{
+    TPdfFilterStage * pNext;                // Next free stage in the scratch pool
+    PDFFL Filter;                           // The filter applied by this stage
+    LPBYTE pbWindow;                        // Buffer for the output of the previous stage. Kept when the stage is reused
+    LPBYTE pbInput;                         // Input that hasn't been processed yet
+    LPBYTE pbInputEnd;
+    bool bEndOfInput;                       // true = there is no more input after pbInputEnd
+    bool bFinished;                         // true = the stage has given all its output
+
+    // Decoder states
+    TPdfHexState AsciiHex;
+    TPdfFlateState Flate;
+    ASCII85_STATE Ascii85;
+    RUNLENGTH_STATE RunLength;
+    LZWState Lzw;
+};
+
+// All scratch pools of the process
+struct TPdfScratchList
+{
+    TPdfScratchList()
+    {
+        InitializeCriticalSection(&Lock);
+        InitializeListHead(&Pools);
+        memset(&Stats, 0, sizeof(TPdfScratchStats));
+        dwTlsIndex = TlsAlloc();
+        dwSpares = 0;
+    }
+
+    ~TPdfScratchList();
+
+    CRITICAL_SECTION Lock;                  // Guards the list and the statistics
+    LIST_ENTRY Pools;                       // All scratch pools, the spare ones first
+    TPdfScratchStats Stats;                 // Statistics of the pools that have been given back
+    DWORD dwTlsIndex;                       // Thread local slot with the pool of the thread
+    DWORD dwSpares;                         // Number of pools that don't belong to any thread
+};
+
+static TPdfScratchList ScratchList;
+
+//-----------------------------------------------------------------------------
+// Local functions
+
+static void AddScratchStats(TPdfScratchStats & Target, TPdfScratchStats & Source)
+{
+    Target.BufferReuses  += Source.BufferReuses;
+    Target.BufferAllocs  += Source.BufferAllocs;
+    Target.StageReuses   += Source.StageReuses;
+    Target.StageAllocs   += Source.StageAllocs;
+    Target.ContextReuses += Source.ContextReuses;
+    Target.ContextAllocs += Source.ContextAllocs;
+    Target.PredictExact += Source.PredictExact;
+    Target.PredictTooSmall += Source.PredictTooSmall;
+    Target.PredictTooLarge += Source.PredictTooLarge;
+    Target.FlateWhole += Source.FlateWhole;
+    Target.FlateFallbacks += Source.FlateFallbacks;
+    Target.FlateParallel += Source.FlateParallel;
+    Target.FlateParallelFallbacks += Source.FlateParallelFallbacks;
+    memset(&Source, 0, sizeof(TPdfScratchStats));
+}
+
+#ifdef _DEBUG
+static void ReportScratchStats(const TPdfScratchStats & Stats)
+{
+    WCHAR szMessage[256];
+
+    // Report how many allocations the pools have saved
+    if(Stats.BufferAllocs != 0 || Stats.StageAllocs != 0 || Stats.ContextAllocs != 0)
+    {
+        StringCchPrintfW(szMessage, _countof(szMessage), L"wcx_pdf: Scratch pools: %I64u of %I64u buffers, %I64u of %I64u filter stages, %I64u of %I64u decoder contexts reused\n",
+                         Stats.BufferReuses,
+                         Stats.BufferReuses + Stats.BufferAllocs,
+                         Stats.StageReuses,
+                         Stats.StageReuses + Stats.StageAllocs,
+                         Stats.ContextReuses,
+                         Stats.ContextReuses + Stats.ContextAllocs);
+        OutputDebugStringW(szMessage);
+    }
+
+    // Report how good the predicted sizes of the decoded data were
+    if(Stats.PredictExact != 0 || Stats.PredictTooSmall != 0 || Stats.PredictTooLarge != 0)
+    {
+        StringCchPrintfW(szMessage, _countof(szMessage), L"wcx_pdf: Predicted sizes: %I64u exact, %I64u too small, %I64u too large\n",
+                         Stats.PredictExact,
+                         Stats.PredictTooSmall,
+                         Stats.PredictTooLarge);
+        OutputDebugStringW(szMessage);
+    }
+
+    // Report how many Flate streams have been decoded in one go
+    if(Stats.FlateWhole != 0 || Stats.FlateFallbacks != 0)
+    {
+        StringCchPrintfW(szMessage, _countof(szMessage), L"wcx_pdf: Whole-buffer inflate: %I64u streams, %I64u left to zlib\n",
+                         Stats.FlateWhole,
+                         Stats.FlateFallbacks);
+        OutputDebugStringW(szMessage);
+    }
+
+    // Report how many big Flate streams have been decoded by more threads
+    if(Stats.FlateParallel != 0 || Stats.FlateParallelFallbacks != 0)
+    {
+        StringCchPrintfW(szMessage, _countof(szMessage), L"wcx_pdf: Parallel inflate: %I64u streams, %I64u left to one thread\n",
+                         Stats.FlateParallel,
+                         Stats.FlateParallelFallbacks);
+        OutputDebugStringW(szMessage);
+    }
+}
+#endif  // _DEBUG
+
+static TPdfFilterStage * AcquireStage(TPdfScratch * pScratch)
+{
+    TPdfFilterStage * pStage;
+
+    // Take a stage from the pool. Its window and decoder contexts are kept
+    if(pScratch != NULL && (pStage = pScratch->m_pFreeStages) != NULL)
+    {
+        pScratch->m_pFreeStages = pStage->pNext;
+        pScratch->m_Stats.StageReuses++;
+        return pStage;
+    }
+
+    // Create a new one
+    if((pStage = new TPdfFilterStage) != NULL)
+    {
+        memset(pStage, 0, sizeof(TPdfFilterStage));
+        if(pScratch != NULL)
+            pScratch->m_Stats.StageAllocs++;
+    }
+    return pStage;
+}
+
+static void FreeStage(TPdfFilterStage * pStage)
+{
+    if(pStage->Flate.bInitialized)
+        inflateEnd(&pStage->Flate.z);
+    if(pStage->Lzw.pTable != NULL)
+        LZWFree(pStage->Lzw);
+    if(pStage->pbWindow != NULL)
+        HeapFree(g_hHeap, 0, pStage->pbWindow);
+    delete pStage;
+}
+
+static DWORD InitStage(TPdfScratchStats & Stats, TPdfFilterStage & Stage, PDFFL Filter, int nEarlyChange, bool bNeedWindow)
+{
+    // Reset the state of the previous use. The decoder contexts are reused
+    Stage.Filter = Filter;
+    Stage.pbInput = Stage.pbInputEnd = NULL;
+    Stage.bEndOfInput = false;
+    Stage.bFinished = false;
+
+    switch(Filter)
+    {
+        case PDFF_Ascii85:
+            ascii85_init(Stage.Ascii85);
+            break;
+
+        case PDFF_AsciiHex:
+            memset(&Stage.AsciiHex, 0, sizeof(TPdfHexState));
+            break;
+
+        case PDFF_Flate:
+            Stage.Flate.TotalOut = 0;
+            Stage.Flate.bDrained = false;
+            if(Stage.Flate.bInitialized && inflateReset(&Stage.Flate.z) == Z_OK)
+            {
+                Stats.ContextReuses++;
+                break;
+            }
+
+            // Create new zlib state
+            if(Stage.Flate.bInitialized)
+                inflateEnd(&Stage.Flate.z);
+            memset(&Stage.Flate.z, 0, sizeof(z_stream));
+            Stage.Flate.bInitialized = false;
+            if(inflateInit2(&Stage.Flate.z, MAX_WBITS) != Z_OK)
+                return ERROR_VERSION_PARSE_ERROR;
+            Stage.Flate.bInitialized = true;
+            Stats.ContextAllocs++;
+            break;
+
+        case PDFF_LZW:
+            if(Stage.Lzw.pTable != NULL)
+                Stats.ContextReuses++;
+            else
+                Stats.ContextAllocs++;
+            if(LZWInit(Stage.Lzw, nEarlyChange) != ERROR_SUCCESS)
+                return ERROR_NOT_ENOUGH_MEMORY;
+            break;
+
+        case PDFF_RunLength:
+            runlength_init(Stage.RunLength);
+            break;
+    }
+
+    // Every stage except the first one needs a window for the output of the previous one
+    if(bNeedWindow)
+    {
+        if(Stage.pbWindow != NULL)
+        {
+            Stats.ContextReuses++;
+            return ERROR_SUCCESS;
+        }
+
+        if((Stage.pbWindow = (LPBYTE)HeapAlloc(g_hHeap, 0, PDF_FILTER_WINDOW)) == NULL)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        Stats.ContextAllocs++;
+    }
+    return ERROR_SUCCESS;
+}
+
+// Decodes as much of the input as fits into the output. Returns ERROR_HANDLE_EOF when all data have been decoded
+static DWORD DecodeChunk_AsciiHex(TPdfHexState & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput)
+{
+    ULONGLONG OutputSize;
+
+    while(pbInput < pbInputEnd && pbOutput < pbOutputEnd)
+    {
+        BYTE OneChar = *pbInput++;
+
+        State.InputBytes++;
+
+        // After an invalid character, the rest of the input is only counted
+        if(State.bStopped)
+            continue;
+
+        // Skip EOLs before the pair
+        if(State.bHaveFirst == false)
+        {
+            if(OneChar != 0x0A && OneChar != 0x0D)
+            {
+                State.FirstChar = OneChar;
+                State.bHaveFirst = true;
+            }
+            continue;
+        }
+
+        // Each character must be within the range of 0x80
+        State.bHaveFirst = false;
+        if(State.FirstChar > 0x80 || OneChar > 0x80 || CharToByte[State.FirstChar] == 0xFF || CharToByte[OneChar] == 0xFF)
+        {
+            State.bStopped = true;
+            continue;
+        }
+
+        *pbOutput++ = (CharToByte[State.FirstChar] << 0x04) | CharToByte[OneChar];
+        State.OutputBytes++;
+    }
+
+    // The decoded data have always had half the size of the input (but at least one byte),
+    // the bytes that could not be decoded being zeros
+    if(pbInput >= pbInputEnd && bEndOfInput)
+    {
+        OutputSize = max(State.InputBytes / 2, 1);
+        while(State.OutputBytes < OutputSize && pbOutput < pbOutputEnd)
+        {
+            *pbOutput++ = 0;
+            State.OutputBytes++;
+        }
+        if(State.OutputBytes >= OutputSize)
+            return ERROR_HANDLE_EOF;
+    }
+    return ERROR_SUCCESS;
+}
+
+// Decodes as much of the input as fits into the output. Returns ERROR_HANDLE_EOF when all data have been decoded
+static DWORD DecodeChunk_Flate(TPdfFlateState & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput)
+{
+    z_stream & z = State.z;
+    int nResult;
+
+    while(pbOutput < pbOutputEnd)
+    {
+        uInt cbAvailIn;
+        uInt cbAvailOut;
+
+        // Get more input, if there is any. Truncated streams are accepted:
+        // if all data have been given to zlib and the output is not full, we are done
+        if(pbInput >= pbInputEnd)
+        {
+            if(bEndOfInput == false)
+                return ERROR_SUCCESS;
+            if(State.bDrained)
+                return ERROR_HANDLE_EOF;
+        }
+
+        // Streams bigger than 4 GB are given to zlib in chunks
+        z.next_in   = (Bytef *)pbInput;
+        z.avail_in  = cbAvailIn  = (uInt)min((size_t)(pbInputEnd - pbInput), (size_t)PDF_ZLIB_CHUNK_SIZE);
+        z.next_out  = (Bytef *)pbOutput;
+        z.avail_out = cbAvailOut = (uInt)min((size_t)(pbOutputEnd - pbOutput), (size_t)PDF_ZLIB_CHUNK_SIZE);
+
+        // Call zlib to decompress the data
+        nResult = inflate(&z, Z_NO_FLUSH);
+        pbInput += (cbAvailIn - z.avail_in);
+        pbOutput += (cbAvailOut - z.avail_out);
+        State.TotalOut += (cbAvailOut - z.avail_out);
+        State.bDrained = (nResult == Z_OK && z.avail_in == 0 && z.avail_out != 0);
+
+        // Z_BUF_ERROR means that the output buffer was exactly full at the end of the input
+        if(nResult == Z_STREAM_END)
+            return ERROR_HANDLE_EOF;
+        if(pbInput >= pbInputEnd && bEndOfInput)
+        {
+            if(State.bDrained)
+                return ERROR_HANDLE_EOF;
+            if(nResult == Z_BUF_ERROR && State.TotalOut != 0)
+                return ERROR_HANDLE_EOF;
+        }
+        if(nResult != Z_OK)
+            return ERROR_FILE_CORRUPT;
+    }
+    return ERROR_SUCCESS;
+}
+
+static size_t PredictSize(size_t cbRawData, DWORD dwRatio)
+{
+    ULONGLONG Predicted = ((ULONGLONG)cbRawData * dwRatio) / PDF_RATIO_ONE;
+
+    // Don't overflow the size_t on 32-bit platforms
+    return (Predicted < (size_t)(-1) / 2) ? (size_t)Predicted : (size_t)(-1) / 2;
+}
+
+static void LearnRatio(DWORD & dwRatio, size_t cbOutput, size_t cbRawData)
+{
+    ULONGLONG NewRatio = ((ULONGLONG)cbOutput * PDF_RATIO_ONE) / cbRawData;
+
+    // Outliers don't move the ratio too much
+    NewRatio = min(max(NewRatio, 1), PDF_MAX_PREDICT_RATIO * PDF_RATIO_ONE);
+    dwRatio = (dwRatio != 0) ? (DWORD)((dwRatio * 3 + NewRatio) / 4) : (DWORD)NewRatio;
+}
+
+static DWORD GrowBuffer(TPdfScratch * pScratch, TPdfBlob & Buffer, size_t cbNewSize)
+{
+    if(pScratch != NULL)
+        pScratch->m_Stats.BufferAllocs++;
+    return Buffer.Resize(cbNewSize);
+}
+
+static DWORD GetInflateThreadCount(TPdfScratch * pScratch)
+{
+    // The threads of a decode pool keep all CPUs busy already.
+    // Without the scratch pool, it's not known whether this is one of them
+    if(pScratch == NULL || pScratch->m_bPoolThread)
+        return 1;
+    return TPdfDecodePool::GetThreadCount(g_Options.dwDecodeThreads);
+}
+
+//-----------------------------------------------------------------------------
+// Scratch pools
+
+TPdfScratchList::~TPdfScratchList()
+{
+    PLIST_ENTRY pListEntry;
+
+    // No thread decodes anymore, so all pools can go
+    while((pListEntry = Pools.Flink) != &Pools)
+    {
+        TPdfScratch * pScratch = CONTAINING_RECORD(pListEntry, TPdfScratch, m_Entry);
+
+        RemoveEntryList(pListEntry);
+        AddScratchStats(Stats, pScratch->m_Stats);
+        delete pScratch;
+    }
+
+#ifdef _DEBUG
+    ReportScratchStats(Stats);
+#endif  // _DEBUG
+
+    if(dwTlsIndex != TLS_OUT_OF_INDEXES)
+        TlsFree(dwTlsIndex);
+    DeleteCriticalSection(&Lock);
+}
+
+TPdfScratch::TPdfScratch()
+{
+    memset(&m_Stats, 0, sizeof(TPdfScratchStats));
+    memset(m_Ratios, 0, sizeof(m_Ratios));
+    InitializeListHead(&m_Entry);
+    m_pFreeStages = NULL;
+    m_bSpare = false;
+    m_bPoolThread = false;
+}
+
+TPdfScratch::~TPdfScratch()
+{
+    TPdfFilterStage * pStage;
+
+    while((pStage = m_pFreeStages) != NULL)
+    {
+        m_pFreeStages = pStage->pNext;
+        FreeStage(pStage);
+    }
+}
+
+TPdfScratch * TPdfScratch::ForThisThread()
+{
+    TPdfScratch * pScratch;
+
+    // Without the thread local slot, nothing is pooled
+    if(ScratchList.dwTlsIndex == TLS_OUT_OF_INDEXES)
+        return NULL;
+    if((pScratch = (TPdfScratch *)TlsGetValue(ScratchList.dwTlsIndex)) != NULL)
+        return pScratch;
+
+    // Take a spare pool, or create a new one
+    EnterCriticalSection(&ScratchList.Lock);
+    if(ScratchList.dwSpares != 0)
+    {
+        pScratch = CONTAINING_RECORD(ScratchList.Pools.Flink, TPdfScratch, m_Entry);
+        RemoveEntryList(&pScratch->m_Entry);
+        InsertTailList(&ScratchList.Pools, &pScratch->m_Entry);
+        pScratch->m_bSpare = false;
+        ScratchList.dwSpares--;
+    }
+    else if((pScratch = new TPdfScratch) != NULL)
+    {
+        InsertTailList(&ScratchList.Pools, &pScratch->m_Entry);
+    }
+    LeaveCriticalSection(&ScratchList.Lock);
+
+    if(pScratch != NULL)
+        TlsSetValue(ScratchList.dwTlsIndex, pScratch);
+    return pScratch;
+}
+
+void TPdfScratch::ReleaseThisThread()
+{
+    TPdfScratch * pScratch;
+
+    // Does the thread have a pool?
+    if(ScratchList.dwTlsIndex == TLS_OUT_OF_INDEXES)
+        return;
+    if((pScratch = (TPdfScratch *)TlsGetValue(ScratchList.dwTlsIndex)) == NULL)
+        return;
+    TlsSetValue(ScratchList.dwTlsIndex, NULL);
+
+    // Keep the pool for the next thread, unless there are enough spares
+    EnterCriticalSection(&ScratchList.Lock);
+    AddScratchStats(ScratchList.Stats, pScratch->m_Stats);
+    RemoveEntryList(&pScratch->m_Entry);
+    if(ScratchList.dwSpares < PDF_SCRATCH_MAX_SPARES)
+    {
+        InsertHeadList(&ScratchList.Pools, &pScratch->m_Entry);
+        pScratch->m_bSpare = true;
+        ScratchList.dwSpares++;
+        pScratch = NULL;
+    }
+    LeaveCriticalSection(&ScratchList.Lock);
+
+    // Free the pool outside the lock
+    if(pScratch != NULL)
+        delete pScratch;
+}
+
+void TPdfScratch::FreeSpares()
+{
+    TPdfScratchStats Stats;
+    PLIST_ENTRY pListEntry;
+    LIST_ENTRY FreeList;
+
+    // The pool of this thread is not needed anymore either
+    ReleaseThisThread();
+
+    // Take all spare pools and the statistics
+    InitializeListHead(&FreeList);
+    EnterCriticalSection(&ScratchList.Lock);
+    while(ScratchList.dwSpares != 0)
+    {
+        pListEntry = ScratchList.Pools.Flink;
+        RemoveEntryList(pListEntry);
+        InsertTailList(&FreeList, pListEntry);
+        ScratchList.dwSpares--;
+    }
+    Stats = ScratchList.Stats;
+    memset(&ScratchList.Stats, 0, sizeof(TPdfScratchStats));
+    LeaveCriticalSection(&ScratchList.Lock);
+
+    // Free the pools outside the lock
+    while((pListEntry = FreeList.Flink) != &FreeList)
+    {
+        RemoveEntryList(pListEntry);
+        delete CONTAINING_RECORD(pListEntry, TPdfScratch, m_Entry);
+    }
+
+#ifdef _DEBUG
+    ReportScratchStats(Stats);
+#endif  // _DEBUG
+}
+
+//-----------------------------------------------------------------------------
+// Constructor and destructor
+
+TPdfFilterChain::TPdfFilterChain()
+{
+    memset(m_Stages, 0, sizeof(m_Stages));
+    m_dwStages = 0;
+    m_pbRawPtr = NULL;
+    m_pbRawEnd = NULL;
+    m_cbRawData = 0;
+}
+
+TPdfFilterChain::~TPdfFilterChain()
+{
+    Close();
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+DWORD TPdfFilterChain::Open(LPBYTE pbRawData, LPBYTE pbRawEnd, const PDFFL * Filters, const DWORD * FilterIndexes, DWORD dwFilters, const TPdfDict & ObjParams)
+{
+    TPdfScratch * pScratch = TPdfScratch::ForThisThread();
+    TPdfScratchStats Stats = {0};
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // The first stage reads the raw data
+    Close();
+    m_pbRawPtr = pbRawData;
+    m_pbRawEnd = pbRawEnd;
+    m_cbRawData = (pbRawEnd - pbRawData);
+
+    // Plain data need no stage
+    for(DWORD i = 0; i < dwFilters && i < PDF_MAX_FILTERS && dwErrCode == ERROR_SUCCESS; i++)
+    {
+        TPdfDict DecodeParms;
+        int nEarlyChange = 1;
+
+        switch(Filters[i])
+        {
+            case PDFF_Ascii85:
+            case PDFF_AsciiHex:
+            case PDFF_Flate:
+            case PDFF_RunLength:
+                break;
+
+            case PDFF_LZW:
+                ObjParams.GetDecodeParms(FilterIndexes[i], DecodeParms);
+                DecodeParms.GetInt("/EarlyChange", nEarlyChange, 1);
+                break;
+
+            default:
+                continue;
+        }
+
+        // The stages come from the scratch pool of this thread
+        if((m_Stages[m_dwStages] = AcquireStage(pScratch)) == NULL)
+        {
+            dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+            break;
+        }
+
+        dwErrCode = InitStage(Stats, *m_Stages[m_dwStages], Filters[i], nEarlyChange, (m_dwStages > 0));
+        m_dwStages++;
+    }
+
+    if(pScratch != NULL)
+        AddScratchStats(pScratch->m_Stats, Stats);
+    return dwErrCode;
+}
+
+DWORD TPdfFilterChain::Read(LPBYTE pbBuffer, size_t cbBuffer, size_t & cbRead)
+{
+    // Without any filters, the raw data are given as-is
+    if(m_dwStages == 0)
+    {
+        cbRead = min(cbBuffer, (size_t)(m_pbRawEnd - m_pbRawPtr));
+        memcpy(pbBuffer, m_pbRawPtr, cbRead);
+        m_pbRawPtr += cbRead;
+        return ERROR_SUCCESS;
+    }
+
+    // Pull the data through all stages
+    return ReadStage(m_dwStages - 1, pbBuffer, cbBuffer, cbRead);
+}
+
+DWORD TPdfFilterChain::ReadAll(TPdfBlob & Output, size_t cbExpected, TPdfArena * pArena)
+{
+    TPdfScratch * pScratch = TPdfScratch::ForThisThread();
+    TPdfBlob Buffer;
+    LPBYTE pbArenaData;
+    size_t cbPredicted = cbExpected;
+    size_t cbInitial = cbExpected + 1;
+    size_t cbOutput = 0;
+    size_t cbRead = 0;
+    DWORD dwErrCode = ERROR_SUCCESS;
+    DWORD dwThreads = 1;
+    DWORD dwRatio = 0;
+    bool bDecoded = false;
+
+    // Without the expected size, use the ratio learned from the previous streams with the same last filter.
+    // The first guess is twice the raw size. Guesses get some reserve, the exact size only gets
+    // one byte more, so that the last read gives less data than requested
+    if(cbExpected == 0)
+    {
+        if(pScratch != NULL && m_dwStages != 0)
+            dwRatio = pScratch->m_Ratios[m_Stages[m_dwStages - 1]->Filter];
+        cbPredicted = PredictSize(m_cbRawData, (dwRatio != 0) ? dwRatio : (2 * PDF_RATIO_ONE));
+        cbInitial = cbPredicted + (cbPredicted / 8) + 1;
+    }
+
+    // Experimental: A big single Flate stream may be decoded by more threads, to a buffer of its own.
+    // If that doesn't work, the data are decoded by one thread below
+    if(g_Options.bParallelInflate && m_cbRawData >= PDF_PARALLEL_INFLATE && m_dwStages == 1 && m_Stages[0]->Filter == PDFF_Flate && m_Stages[0]->bEndOfInput == false && (dwThreads = GetInflateThreadCount(pScratch)) > 1)
+    {
+        TPdfScratchStats Stats = {0};
+
+        if(flate_decode_parallel(m_pbRawPtr, m_pbRawEnd, Buffer, dwThreads, cbOutput) == ERROR_SUCCESS)
+        {
+            m_pbRawPtr = m_pbRawEnd;
+            m_Stages[0]->bEndOfInput = m_Stages[0]->bFinished = true;
+            Stats.FlateParallel++;
+            bDecoded = true;
+        }
+        else
+        {
+            Stats.FlateParallelFallbacks++;
+            cbOutput = 0;
+        }
+
+        if(pScratch != NULL)
+            AddScratchStats(pScratch->m_Stats, Stats);
+    }
+
+    // Decode to the output buffer of this thread. If the predicted size can't be allocated,
+    // start with twice the raw size
+    if(bDecoded == false)
+    {
+        if(pScratch != NULL)
+            Buffer.MoveFrom(pScratch->m_Buffer);
+        if(Buffer.Size() < cbInitial)
+        {
+            if((dwErrCode = GrowBuffer(pScratch, Buffer, cbInitial)) != ERROR_SUCCESS && cbInitial > m_cbRawData * 2)
+                dwErrCode = GrowBuffer(pScratch, Buffer, m_cbRawData * 2);
+        }
+        else if(pScratch != NULL)
+        {
+            pScratch->m_Stats.BufferReuses++;
+        }
+    }
+
+    // A single Flate stage that hasn't been read yet decodes the whole raw data at once.
+    // If the data don't fit or anything is wrong with them, the streaming zlib starts over,
+    // so that it decides what is accepted
+    if(dwErrCode == ERROR_SUCCESS && bDecoded == false && m_dwStages == 1 && m_Stages[0]->Filter == PDFF_Flate && m_Stages[0]->bEndOfInput == false)
+    {
+        TPdfScratchStats Stats = {0};
+
+        if(flate_decode_all(m_pbRawPtr, m_pbRawEnd, Buffer.pbData, Buffer.pbData + Buffer.Size(), cbOutput) == ERROR_SUCCESS)
+        {
+            m_pbRawPtr = m_pbRawEnd;
+            m_Stages[0]->bEndOfInput = m_Stages[0]->bFinished = true;
+            Stats.FlateWhole++;
+            bDecoded = true;
+        }
+        else
+        {
+            Stats.FlateFallbacks++;
+            cbOutput = 0;
+        }
+
+        if(pScratch != NULL)
+            AddScratchStats(pScratch->m_Stats, Stats);
+    }
+
+    // Double the buffer when full
+    while(dwErrCode == ERROR_SUCCESS && bDecoded == false)
+    {
+        if(cbOutput == Buffer.Size() && (dwErrCode = GrowBuffer(pScratch, Buffer, Buffer.Size() * 2)) != ERROR_SUCCESS)
+            break;
+        if((dwErrCode = Read(Buffer.pbData + cbOutput, Buffer.Size() - cbOutput, cbRead)) != ERROR_SUCCESS)
+            break;
+
+        // Less data than requested means the end of the data
+        cbOutput += cbRead;
+        if(cbOutput < Buffer.Size())
+            break;
+    }
+
+    // Learn the ratio for the next streams and remember how good the prediction was
+    if(dwErrCode == ERROR_SUCCESS && pScratch != NULL)
+    {
+        if(m_dwStages != 0 && m_cbRawData != 0)
+            LearnRatio(pScratch->m_Ratios[m_Stages[m_dwStages - 1]->Filter], cbOutput, m_cbRawData);
+
+        if(cbOutput == cbPredicted)
+            pScratch->m_Stats.PredictExact++;
+        else if(cbOutput > cbPredicted)
+            pScratch->m_Stats.PredictTooSmall++;
+        else
+            pScratch->m_Stats.PredictTooLarge++;
+    }
+
+    // Pooled buffers stay in the pool and their data are copied out,
+    // small data to the arena of the database. Big buffers are given away as they are
+    if(dwErrCode == ERROR_SUCCESS)
+    {
+        Output.FreeData();
+
+        if(pScratch != NULL && Buffer.Size() <= PDF_SCRATCH_MAX_BUFFER)
+        {
+            if(pArena != NULL && cbOutput <= PDF_ARENA_MAX_STREAM && (pbArenaData = (LPBYTE)pArena->Alloc(cbOutput)) != NULL)
+            {
+                memcpy(pbArenaData, Buffer.pbData, cbOutput);
+                Output.SetData(pbArenaData, pbArenaData + cbOutput, false);
+            }
+            else if((dwErrCode = Output.Resize(cbOutput)) == ERROR_SUCCESS)
+            {
+                memcpy(Output.pbData, Buffer.pbData, cbOutput);
+                Output.pbEnd = Output.pbData + cbOutput;
+            }
+        }
+        else
+        {
+            // Don't keep more than a half of the buffer unused, if the prediction was too large
+            if(cbOutput < Buffer.Size() / 2)
+                Buffer.Resize(cbOutput);
+            Buffer.pbEnd = Buffer.pbData + cbOutput;
+            Output.MoveFrom(Buffer);
+        }
+        Output.ResetPosition();
+    }
+
+    // Give the buffer back to the pool, unless the pool has kept its own one
+    if(pScratch != NULL && pScratch->m_Buffer.pbData == NULL && Buffer.Size() <= PDF_SCRATCH_MAX_BUFFER)
+        pScratch->m_Buffer.MoveFrom(Buffer);
+    return dwErrCode;
+}
+
+void TPdfFilterChain::Close()
+{
+    TPdfScratch * pScratch = NULL;
+
+    // Give the stages back to the scratch pool of this thread
+    for(DWORD i = 0; i < m_dwStages; i++)
+    {
+        TPdfFilterStage * pStage = m_Stages[i];
+
+        if(pScratch == NULL)
+            pScratch = TPdfScratch::ForThisThread();
+
+        if(pScratch != NULL)
+        {
+            pStage->pNext = pScratch->m_pFreeStages;
+            pScratch->m_pFreeStages = pStage;
+        }
+        else
+        {
+            FreeStage(pStage);
+        }
+        m_Stages[i] = NULL;
+    }
+
+    m_dwStages = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Protected functions
+
+DWORD TPdfFilterChain::ReadStage(DWORD dwStage, LPBYTE pbBuffer, size_t cbBuffer, size_t & cbRead)
+{
+    TPdfFilterStage & Stage = *m_Stages[dwStage];
+    LPBYTE pbOutput = pbBuffer;
+    LPBYTE pbOutputEnd = pbBuffer + cbBuffer;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Only less data than requested means the end of the data
+    while(pbOutput < pbOutputEnd && Stage.bFinished == false)
+    {
+        // Refill the input, if all of it has been processed
+        if(Stage.pbInput >= Stage.pbInputEnd && Stage.bEndOfInput == false)
+        {
+            if(dwStage == 0)
+            {
+                Stage.pbInput = m_pbRawPtr;
+                Stage.pbInputEnd = m_pbRawEnd;
+                Stage.bEndOfInput = true;
+            }
+            else
+            {
+                size_t cbWindow = 0;
+
+                if((dwErrCode = ReadStage(dwStage - 1, Stage.pbWindow, PDF_FILTER_WINDOW, cbWindow)) != ERROR_SUCCESS)
+                    break;
+                Stage.pbInput = Stage.pbWindow;
+                Stage.pbInputEnd = Stage.pbWindow + cbWindow;
+                Stage.bEndOfInput = (cbWindow < PDF_FILTER_WINDOW);
+            }
+        }
+
+        // Decode as much as possible
+        switch(Stage.Filter)
+        {
+            case PDFF_Ascii85:
+                dwErrCode = ascii85_decode(Stage.Ascii85, Stage.pbInput, Stage.pbInputEnd, pbOutput, pbOutputEnd, Stage.bEndOfInput);
+                break;
+
+            case PDFF_AsciiHex:
+                dwErrCode = DecodeChunk_AsciiHex(Stage.AsciiHex, Stage.pbInput, Stage.pbInputEnd, pbOutput, pbOutputEnd, Stage.bEndOfInput);
+                break;
+
+            case PDFF_Flate:
+                dwErrCode = DecodeChunk_Flate(Stage.Flate, Stage.pbInput, Stage.pbInputEnd, pbOutput, pbOutputEnd, Stage.bEndOfInput);
+                break;
+
+            case PDFF_LZW:
+                dwErrCode = LZWDecode(Stage.Lzw, Stage.pbInput, Stage.pbInputEnd, pbOutput, pbOutputEnd, Stage.bEndOfInput);
+                break;
+
+            case PDFF_RunLength:
+                dwErrCode = runlength_decode(Stage.RunLength, Stage.pbInput, Stage.pbInputEnd, pbOutput, pbOutputEnd, Stage.bEndOfInput);
+                break;
+        }
+
+        // The end of the data of this stage. The previous stages are still decoded
+        // to the end, so that an error in their data is reported
+        if(dwErrCode == ERROR_HANDLE_EOF)
+        {
+            Stage.bFinished = true;
+            dwErrCode = ERROR_SUCCESS;
+
+            while(dwStage > 0 && Stage.bEndOfInput == false && dwErrCode == ERROR_SUCCESS)
+            {
+                size_t cbWindow = 0;
+
+                dwErrCode = ReadStage(dwStage - 1, Stage.pbWindow, PDF_FILTER_WINDOW, cbWindow);
+                Stage.bEndOfInput = (cbWindow < PDF_FILTER_WINDOW);
+            }
+        }
+        if(dwErrCode != ERROR_SUCCESS)
+            break;
+    }
+
+    cbRead = (pbOutput - pbBuffer);
+    return dwErrCode;
+}
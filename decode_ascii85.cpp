@@ -21,57 +21,85 @@ FORCEINLINE DWORD BSWAP32(DWORD x)
            ((x >> 8) & 0x0000FF00) | ((x << 8) & 0x00FF0000));
 }
 
-DWORD ascii85_decode(TPdfBlob & Output, TPdfBlob & Input)
+// Moves the decoded bytes that are waiting to the output
+static void flush_pending(ASCII85_STATE & State, LPBYTE & pbOutput, LPBYTE pbOutputEnd)
+{
+    size_t copy_length = min(State.pending_end - State.pending_begin, (size_t)(pbOutputEnd - pbOutput));
+
+    memcpy(pbOutput, State.pending + State.pending_begin, copy_length);
+    State.pending_begin += copy_length;
+    pbOutput += copy_length;
+}
+
+static void set_pending(ASCII85_STATE & State, DWORD tuple_value, size_t length)
+{
+    tuple_value = BSWAP32(tuple_value);
+    memcpy(State.pending, &tuple_value, length);
+    State.pending_begin = 0;
+    State.pending_end = length;
+}
+
+void ascii85_init(ASCII85_STATE & State)
+{
+    memset(&State, 0, sizeof(ASCII85_STATE));
+}
+
+// Decodes as much of the input as fits into the output. Returns ERROR_HANDLE_EOF when all data have been decoded
+DWORD ascii85_decode(ASCII85_STATE & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput)
 {
-    size_t tuple_length = 0;
-    DWORD tuple_value = 0;
-    DWORD dwErrCode = ERROR_SUCCESS;
     BYTE ascii85_char = 0;
 
-    // Reset the pointer to the begin of the data
-    if((dwErrCode = Output.Resize(Input.Size())) != ERROR_SUCCESS)
-        return dwErrCode;
-    assert(Input.pbPtr == Input.pbData);
+    // Give the bytes from the previous call first
+    flush_pending(State, pbOutput, pbOutputEnd);
 
     // Perform the decoding loop
-    while(Input.GetOneByte(ascii85_char))
+    while(State.pending_begin == State.pending_end && State.terminated == false)
     {
+        // Do we need more data?
+        if(pbInput >= pbInputEnd)
+        {
+            if(bEndOfInput == false)
+                return ERROR_SUCCESS;
+            State.terminated = true;
+            break;
+        }
+        ascii85_char = *pbInput++;
+
         // Check for valid Ascii85 char
         if('!' <= ascii85_char && ascii85_char <= 'u')
         {
             // Keep loading characters up to ASCII85_CHUNK_SIZE
-            tuple_value = tuple_value * 85 + (ascii85_char - ASCII85_OFFSET);
-            tuple_length++;
+            State.tuple_value = State.tuple_value * 85 + (ascii85_char - ASCII85_OFFSET);
+            State.tuple_length++;
 
             // Flush if needed
-            if(tuple_length == ASCII85_CHUNK_SIZE)
+            if(State.tuple_length == ASCII85_CHUNK_SIZE)
             {
-                tuple_value = BSWAP32(tuple_value);
-                if((dwErrCode = Output.AppendBytes(&tuple_value, sizeof(tuple_value))) != ERROR_SUCCESS)
-                    return dwErrCode;
+                set_pending(State, State.tuple_value, sizeof(DWORD));
+                flush_pending(State, pbOutput, pbOutputEnd);
 
                 // Reset the tuple size
-                tuple_length = 0;
-                tuple_value = 0;
+                State.tuple_length = 0;
+                State.tuple_value = 0;
             }
         }
 
         else if(ascii85_char == 'z')
         {
             // Reset the tuple
-            tuple_length = 0;
-            tuple_value = 0;
+            State.tuple_length = 0;
+            State.tuple_value = 0;
 
             // Append four zeros to the output buffer
-            if((dwErrCode = Output.AppendBytes(&tuple_value, sizeof(tuple_value))) != ERROR_SUCCESS)
-                return dwErrCode;
+            set_pending(State, 0, sizeof(DWORD));
+            flush_pending(State, pbOutput, pbOutputEnd);
         }
 
         // Termination char: Flush the remaining bytes
         // However, we also accept if there is no termination char
         else if(ascii85_char == '~')
         {
-            break;
+            State.terminated = true;
         }
 
         //
@@ -80,23 +108,18 @@ DWORD ascii85_decode(TPdfBlob & Output, TPdfBlob & Input)
     }
 
     // If there is something left in the input buffer, flush it
-    if(tuple_length != 0)
+    if(State.terminated && State.tuple_length != 0)
     {
         // Calculate the tuple value
-        for(size_t i = tuple_length; i < ASCII85_CHUNK_SIZE; i++)
-            tuple_value = tuple_value * 85 + 84;
-        tuple_value = BSWAP32(tuple_value);
+        for(size_t i = State.tuple_length; i < ASCII85_CHUNK_SIZE; i++)
+            State.tuple_value = State.tuple_value * 85 + 84;
 
         // Append the tuple to the output
-        dwErrCode = Output.AppendBytes(&tuple_value, tuple_length - 1);
-    }
-
-    // Resize the output buffer to the actual size
-    if(dwErrCode == ERROR_SUCCESS)
-    {
-        assert((size_t)(Output.pbPtr - Output.pbData) <= Output.Size());
-        Output.pbEnd = Output.pbPtr;
+        set_pending(State, State.tuple_value, State.tuple_length - 1);
+        flush_pending(State, pbOutput, pbOutputEnd);
+        State.tuple_length = 0;
     }
 
-    return dwErrCode;
+    // Done when everything has been given to the output
+    return (State.terminated && State.pending_begin == State.pending_end) ? ERROR_HANDLE_EOF : ERROR_SUCCESS;
 }
@@ -16,6 +16,18 @@
 // Maximum length of the decoded data. Not stripping <~ and ~>
 #define ASCII85_DECODED_LENGTH(encoded_length)  (encoded_length * 4 / 5)
 
-DWORD ascii85_decode(TPdfBlob & Output, TPdfBlob & Input);
+// State of the decoder between two chunks of data
+struct ASCII85_STATE
+{
+    DWORD tuple_value;                      // Value of the tuple being loaded
+    size_t tuple_length;                    // Number of characters in the tuple
+    BYTE pending[4];                        // Decoded bytes that didn't fit into the output yet
+    size_t pending_begin;
+    size_t pending_end;
+    bool terminated;                        // The termination char or the end of the input has been reached
+};
+
+void  ascii85_init(ASCII85_STATE & State);
+DWORD ascii85_decode(ASCII85_STATE & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput);
 
 #endif // __DECODE_ASCII85_H__
\ No newline at end of file
@@ -0,0 +1,1288 @@
+/*****************************************************************************/
+/* decode_flate.cpp                       Copyright (c) Ladislav Zezula 2024 */
+/*---------------------------------------------------------------------------*/
+/* Whole-buffer decoder for FlateDecode (zlib) data. Both the input and the  */
+/* output are complete buffers, so the bits are loaded 64 at a time, and the */
+/* back-references are copied within the output, without any window.        */
+/* Big streams can be split to chunks that are decoded by more threads.      */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#include "wcx_pdf.h"
+#include "decode_flate.h"
+#include "./zlib/zlib.h"                        // adler32()
+
+//-----------------------------------------------------------------------------
+// Local defines
+
+#define FLATE_LITLEN_BITS       11              // Bits of the main literal/length table
+#define FLATE_DIST_BITS         8               // Bits of the main distance table
+#define FLATE_CODELEN_BITS      7               // Bits of the code length table (the longest code length code)
+#define FLATE_LITLEN_ENOUGH     2342            // Main table and the worst case of subtables (see zlib's "enough")
+#define FLATE_DIST_ENOUGH       402
+#define FLATE_MAX_CODE_BITS     15              // The longest Huffman code
+#define FLATE_NUM_LITLEN        288             // Number of the literal/length symbols
+#define FLATE_NUM_DIST          32              // Number of the distance symbols
+#define FLATE_NUM_CODELEN       19              // Number of the code length symbols
+#define FLATE_SAFE_BITS         48              // The longest length/distance pair: 15+5+15+13 bits
+#define FLATE_WINDOW_SIZE       0x8000          // Back-references reach at most this far
+#define FLATE_ADLER_BASE        65521           // Adler-32 sums are modulo this number
+#define FLATE_MIN_CHUNK_SIZE    0x400000        // Min compressed data decoded by one thread of the parallel inflate
+#define FLATE_INITIAL_WORDS     0x40000         // Initial size of the word buffer of a chunk, in bytes
+#define FLATE_INITIAL_BYTES     0x1000000       // Initial size of the byte buffer of a chunk
+#define FLATE_MARKER            0x100           // Decoded words from this value refer to the data before the chunk
+
+// Table entries: bits 0-4 = length of the code, bits 5-7 = kind of the entry,
+// bits 8-15 = literal or extra bits or subtable bits, bits 16-31 = second literal or base or subtable start
+#define FLATE_LITERAL           0x00            // One literal
+#define FLATE_LITERAL2          0x20            // Two literals, decoded with one lookup
+#define FLATE_LENGTH            0x40            // Length or distance with extra bits
+#define FLATE_END               0x60            // End of the block
+#define FLATE_SUBTABLE          0x80            // Longer code, continues in a subtable
+#define FLATE_INVALID           0xA0            // Code that must not appear in the data
+#define FLATE_KIND_MASK         0xE0
+#define FLATE_BITS_MASK         0x1F
+
+// Types of the Huffman tables
+#define FLATE_TABLE_CODELEN     0
+#define FLATE_TABLE_LITLEN      1
+#define FLATE_TABLE_DIST        2
+
+//-----------------------------------------------------------------------------
+// Local structures
+
+// Tables of one block with dynamic Huffman codes
+struct FLATE_TABLES
+{
+    DWORD LitLen[FLATE_LITLEN_ENOUGH];
+    DWORD Dist[FLATE_DIST_ENOUGH];
+    DWORD CodeLen[1 << FLATE_CODELEN_BITS];
+};
+
+// Tables of the fixed Huffman codes, built once when the DLL loads
+struct FLATE_FIXED_TABLES
+{
+    FLATE_FIXED_TABLES();
+
+    DWORD LitLen[1 << FLATE_LITLEN_BITS];
+    DWORD Dist[1 << FLATE_DIST_BITS];
+};
+
+// Position in the compressed data. The decoding functions keep it in local variables
+struct FLATE_BITSTREAM
+{
+    LPBYTE pbInput;                             // Next byte to be loaded to the bit buffer
+    LPBYTE pbInputEnd;                          // End of the compressed data
+    ULONGLONG BitBuffer;                        // Bits loaded, but not used yet
+    DWORD BitCount;                             // Number of the valid bits in the bit buffer
+    size_t cbOverrun;                           // Zero bytes loaded behind the end of the input
+};
+
+// One block of the compressed data, as given by its header
+struct FLATE_BLOCK
+{
+    DWORD * pLitLen;                            // Literal/length table. NULL = stored block
+    DWORD * pDist;                              // Distance table
+    LPBYTE pbStored;                            // Data of a stored block
+    DWORD dwStoredLength;                       // Length of a stored block
+    bool bFinalBlock;                           // The last block of the stream
+};
+
+// One chunk of the parallel inflate. Except for the first one, the chunks begin at a block
+// found by trying all bit positions. Back-references may reach into the preceding chunk,
+// whose data are not known yet, so the chunk is first decoded to words. Words from FLATE_MARKER
+// up are positions in the last 32 KB before the chunk. Once there are 32 KB of words without
+// any marker, nothing can refer to the preceding chunk anymore and the rest is decoded to bytes
+struct FLATE_CHUNK
+{
+    FLATE_BITSTREAM Stream;                     // Position of the decoder
+    LPBYTE pbDeflate;                           // Begin of the compressed data (behind the zlib header)
+    LPBYTE pbOutput;                            // Where the chunk's data go in the merged output
+    ULONGLONG StartBit;                         // Position of the first block of the chunk
+    ULONGLONG EndBit;                           // End of the range where the first block is searched for
+    ULONGLONG StopBit;                          // Position of the first block of the next chunk
+    TPdfBlob Words;                             // Begin of the decoded data, with markers
+    TPdfBlob Bytes;                             // Rest of the decoded data, behind a copy of the last 32 KB of the words
+    size_t cWords;                              // Number of the decoded words
+    size_t cbBytes;                             // Number of the bytes in the byte buffer, including the copy of the words
+    size_t cbWindow;                            // Size of the copy of the words at the begin of the byte buffer
+    size_t nMarkersEnd;                         // Position behind the last word that may be a marker
+    size_t nOffset;                             // Offset of the chunk's data in the merged output
+    size_t nResolved;                           // Words from this one on have been resolved with the window
+    DWORD dwAdler;                              // Adler-32 of the chunk's data
+    DWORD dwExpected;                           // Adler-32 stored behind the final block (last chunk only)
+    DWORD dwErrCode;
+    bool bFound;                                // false = no block found, the preceding chunk decodes this one too
+    bool bWords;                                // true = the chunk is still decoded to words
+    bool bFinalBlock;                           // The final block has been decoded
+    bool bLastChunk;                            // The chunk is decoded up to the final block
+};
+
+//-----------------------------------------------------------------------------
+// Local variables
+
+static const WORD LengthBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const BYTE LengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const WORD DistBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const BYTE DistExtra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const BYTE CodeLenOrder[FLATE_NUM_CODELEN] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+//-----------------------------------------------------------------------------
+// Bit buffer. Up to the last 8 bytes of the input, the bits are loaded 64 at a time.
+// Behind the end of the input, zero bytes are loaded and counted
+
+#define FLATE_REFILL()                                                          \
+    if((size_t)(pbInputEnd - pbInput) >= sizeof(ULONGLONG))                     \
+    {                                                                           \
+        BitBuffer |= LoadBits64(pbInput) << BitCount;                           \
+        pbInput += (63 - BitCount) >> 3;                                        \
+        BitCount |= 56;                                                         \
+    }                                                                           \
+    else                                                                        \
+    {                                                                           \
+        while(BitCount <= 56)                                                   \
+        {                                                                       \
+            if(pbInput < pbInputEnd)                                            \
+                BitBuffer |= (ULONGLONG)(*pbInput++) << BitCount;               \
+            else if(++cbOverrun > sizeof(ULONGLONG))                            \
+                return ERROR_FILE_CORRUPT;                                      \
+            BitCount += 8;                                                      \
+        }                                                                       \
+    }
+
+#define FLATE_BITS(n)       (DWORD)(BitBuffer & (((ULONGLONG)1 << (n)) - 1))
+#define FLATE_DROP(n)       { BitBuffer >>= (n); BitCount -= (n); }
+
+// Moves the input back to the first byte that hasn't been used yet.
+// If the zero bytes behind the input have been used, the input is truncated
+#define FLATE_ALIGN_INPUT()                                                     \
+    FLATE_DROP(BitCount & 7);                                                   \
+    if((BitCount >> 3) < cbOverrun)                                             \
+        return ERROR_FILE_CORRUPT;                                              \
+    pbInput -= (BitCount >> 3) - cbOverrun;                                     \
+    BitBuffer = 0;                                                              \
+    BitCount = 0;                                                               \
+    cbOverrun = 0;
+
+// The decoding functions work with local copies of the bit stream
+#define FLATE_LOAD_STREAM(Stream)                                               \
+    LPBYTE pbInput = Stream.pbInput;                                            \
+    LPBYTE pbInputEnd = Stream.pbInputEnd;                                      \
+    ULONGLONG BitBuffer = Stream.BitBuffer;                                     \
+    DWORD BitCount = Stream.BitCount;                                           \
+    size_t cbOverrun = Stream.cbOverrun
+
+#define FLATE_SAVE_STREAM(Stream)                                               \
+    Stream.pbInput = pbInput;                                                   \
+    Stream.BitBuffer = BitBuffer;                                               \
+    Stream.BitCount = BitCount;                                                 \
+    Stream.cbOverrun = cbOverrun
+
+static inline ULONGLONG LoadBits64(LPBYTE pbInput)
+{
+    ULONGLONG Value;
+
+    memcpy(&Value, pbInput, sizeof(ULONGLONG));
+    return Value;
+}
+
+//-----------------------------------------------------------------------------
+// Building the Huffman tables
+
+static DWORD GetSymbolEntry(DWORD dwType, DWORD dwSymbol)
+{
+    switch(dwType)
+    {
+        case FLATE_TABLE_LITLEN:
+            if(dwSymbol < 256)
+                return FLATE_LITERAL | (dwSymbol << 8);
+            if(dwSymbol == 256)
+                return FLATE_END;
+            if(dwSymbol < 257 + _countof(LengthBase))
+                return FLATE_LENGTH | (LengthExtra[dwSymbol - 257] << 8) | (LengthBase[dwSymbol - 257] << 16);
+            return FLATE_INVALID;
+
+        case FLATE_TABLE_DIST:
+            if(dwSymbol < _countof(DistBase))
+                return FLATE_LENGTH | (DistExtra[dwSymbol] << 8) | (DistBase[dwSymbol] << 16);
+            return FLATE_INVALID;
+
+        default:
+            return FLATE_LITERAL | (dwSymbol << 8);
+    }
+}
+
+// Builds the lookup table of a canonical Huffman code. Codes longer than the main table
+// continue in subtables. The same codes as in zlib's inflate_table() are refused
+static bool BuildTable(DWORD * pTable, DWORD dwTableSize, DWORD dwTableBits, const BYTE * Lengths, DWORD dwSymbols, DWORD dwType)
+{
+    WORD Count[FLATE_MAX_CODE_BITS + 1] = {0};
+    WORD Offsets[FLATE_MAX_CODE_BITS + 2];
+    WORD Sorted[FLATE_NUM_LITLEN];
+    DWORD dwMainSize = (1 << dwTableBits);
+    DWORD dwNextSub = dwMainSize;
+    DWORD dwSubPrefix = 0xFFFFFFFF;
+    DWORD dwSubStart = 0;
+    DWORD dwSubBits = 0;
+    DWORD dwMaxLength = 0;
+    DWORD dwCode = 0;
+    DWORD dwLength;
+    int nLeft = 1;
+
+    // Count the codes of each length
+    for(DWORD i = 0; i < dwSymbols; i++)
+        Count[Lengths[i]]++;
+    for(dwLength = 1; dwLength <= FLATE_MAX_CODE_BITS; dwLength++)
+    {
+        if(Count[dwLength] != 0)
+            dwMaxLength = dwLength;
+    }
+
+    // No codes at all: every lookup gives an invalid code
+    if(dwMaxLength == 0)
+    {
+        for(DWORD i = 0; i < dwMainSize; i++)
+            pTable[i] = FLATE_INVALID | 1;
+        return true;
+    }
+
+    // Refuse over-subscribed codes and incomplete ones, except a single code of one bit
+    for(dwLength = 1; dwLength <= FLATE_MAX_CODE_BITS; dwLength++)
+    {
+        nLeft = (nLeft << 1) - Count[dwLength];
+        if(nLeft < 0)
+            return false;
+    }
+    if(nLeft > 0)
+    {
+        if(dwType == FLATE_TABLE_CODELEN || dwMaxLength != 1)
+            return false;
+        for(DWORD i = 0; i < dwMainSize; i++)
+            pTable[i] = FLATE_INVALID | 1;
+    }
+
+    // Sort the symbols by their code length. Within the same length, they stay in order
+    Offsets[1] = 0;
+    for(dwLength = 1; dwLength <= FLATE_MAX_CODE_BITS; dwLength++)
+        Offsets[dwLength + 1] = Offsets[dwLength] + Count[dwLength];
+    for(DWORD i = 0; i < dwSymbols; i++)
+    {
+        if(Lengths[i] != 0)
+            Sorted[Offsets[Lengths[i]]++] = (WORD)i;
+    }
+
+    // Assign the canonical codes in the order of the sorted symbols
+    dwLength = Lengths[Sorted[0]];
+    for(DWORD i = 0; i < Offsets[FLATE_MAX_CODE_BITS + 1]; i++)
+    {
+        DWORD dwSymbol = Sorted[i];
+        DWORD dwEntry = GetSymbolEntry(dwType, dwSymbol);
+        DWORD dwReversed = 0;
+
+        // The code gets longer
+        dwCode <<= (Lengths[dwSymbol] - dwLength);
+        dwLength = Lengths[dwSymbol];
+
+        // The data contain the codes starting with their highest bit
+        for(DWORD j = 0; j < dwLength; j++)
+            dwReversed |= ((dwCode >> j) & 1) << (dwLength - j - 1);
+
+        if(dwLength <= dwTableBits)
+        {
+            // Fill all entries whose lowest bits are the code
+            for(DWORD j = dwReversed; j < dwMainSize; j += (1 << dwLength))
+                pTable[j] = dwEntry | dwLength;
+        }
+        else
+        {
+            // The first code with new main table bits starts a subtable,
+            // big enough for all codes that follow with the same main table bits
+            if((dwReversed & (dwMainSize - 1)) != dwSubPrefix)
+            {
+                dwSubPrefix = dwReversed & (dwMainSize - 1);
+                dwSubBits = dwLength - dwTableBits;
+                nLeft = (1 << dwSubBits);
+                while(dwSubBits + dwTableBits < dwMaxLength)
+                {
+                    nLeft -= Count[dwSubBits + dwTableBits];
+                    if(nLeft <= 0)
+                        break;
+                    dwSubBits++;
+                    nLeft <<= 1;
+                }
+
+                if(dwNextSub + (1 << dwSubBits) > dwTableSize)
+                    return false;
+                pTable[dwSubPrefix] = FLATE_SUBTABLE | (dwSubBits << 8) | (dwNextSub << 16);
+                dwSubStart = dwNextSub;
+                dwNextSub += (1 << dwSubBits);
+            }
+
+            // Fill the entries of the subtable
+            for(DWORD j = (dwReversed >> dwTableBits); j < (1u << dwSubBits); j += (1 << (dwLength - dwTableBits)))
+                pTable[dwSubStart + j] = dwEntry | (dwLength - dwTableBits);
+        }
+
+        // The remaining codes decide about the size of the next subtables
+        Count[dwLength]--;
+        dwCode++;
+    }
+    return true;
+}
+
+// If the bits after a short literal code hold another complete literal code,
+// one lookup decodes both. The entries are processed from the last one,
+// so that the second literal always comes from an entry that hasn't been changed yet
+static void PairLiterals(DWORD * pTable)
+{
+    for(DWORD i = (1 << FLATE_LITLEN_BITS); i > 0; i--)
+    {
+        DWORD dwEntry = pTable[i - 1];
+        DWORD dwLength = (dwEntry & FLATE_BITS_MASK);
+        DWORD dwSecond;
+
+        if((dwEntry & FLATE_KIND_MASK) == FLATE_LITERAL && dwLength < FLATE_LITLEN_BITS)
+        {
+            dwSecond = pTable[(i - 1) >> dwLength];
+            if((dwSecond & FLATE_KIND_MASK) == FLATE_LITERAL && (dwSecond & FLATE_BITS_MASK) <= FLATE_LITLEN_BITS - dwLength)
+            {
+                pTable[i - 1] = FLATE_LITERAL2 | (dwLength + (dwSecond & FLATE_BITS_MASK)) | (dwEntry & 0xFF00) | ((dwSecond & 0xFF00) << 8);
+            }
+        }
+    }
+}
+
+FLATE_FIXED_TABLES::FLATE_FIXED_TABLES()
+{
+    BYTE Lengths[FLATE_NUM_LITLEN];
+
+    // Literal/length codes, as given by RFC 1951
+    memset(Lengths + 0x00, 8, 144);
+    memset(Lengths + 144, 9, 112);
+    memset(Lengths + 256, 7, 24);
+    memset(Lengths + 280, 8, 8);
+    BuildTable(LitLen, _countof(LitLen), FLATE_LITLEN_BITS, Lengths, FLATE_NUM_LITLEN, FLATE_TABLE_LITLEN);
+    PairLiterals(LitLen);
+
+    // All distance codes have 5 bits
+    memset(Lengths, 5, FLATE_NUM_DIST);
+    BuildTable(Dist, _countof(Dist), FLATE_DIST_BITS, Lengths, FLATE_NUM_DIST, FLATE_TABLE_DIST);
+}
+
+static FLATE_FIXED_TABLES FixedTables;
+
+
+//-----------------------------------------------------------------------------
+// Decoding the blocks
+
+// The zlib header: deflate method, window of 32 KB at most, no preset dictionary
+static bool CheckZlibHeader(LPBYTE pbInput, LPBYTE pbInputEnd)
+{
+    if((pbInputEnd - pbInput) < 2)
+        return false;
+    if((pbInput[0] & 0x0F) != Z_DEFLATED || (pbInput[0] >> 4) + 8 > MAX_WBITS || (pbInput[1] & 0x20) != 0)
+        return false;
+    return (((pbInput[0] << 8) | pbInput[1]) % 31 == 0);
+}
+
+// Starts reading the bits at the given position. The position must be within the data
+static void SeekBitStream(FLATE_BITSTREAM & Stream, LPBYTE pbBegin, LPBYTE pbEnd, ULONGLONG BitPosition)
+{
+    Stream.pbInput = pbBegin + (size_t)(BitPosition >> 3);
+    Stream.pbInputEnd = pbEnd;
+    Stream.BitBuffer = 0;
+    Stream.BitCount = 0;
+    Stream.cbOverrun = 0;
+
+    // Skip the bits of the first byte that are before the position
+    if((BitPosition & 7) != 0)
+    {
+        Stream.BitBuffer = (*Stream.pbInput++) >> (DWORD)(BitPosition & 7);
+        Stream.BitCount = 8 - (DWORD)(BitPosition & 7);
+    }
+}
+
+static ULONGLONG GetBitPosition(const FLATE_BITSTREAM & Stream, LPBYTE pbBegin)
+{
+    return ((ULONGLONG)(Stream.pbInput - pbBegin) + Stream.cbOverrun) * 8 - Stream.BitCount;
+}
+
+// Reads the header of the next block. Stored blocks are skipped in the input,
+// the Huffman codes of a dynamic block are built to the given tables
+static DWORD ReadBlockHeader(FLATE_BITSTREAM & Stream, FLATE_TABLES & Tables, FLATE_BLOCK & Block)
+{
+    FLATE_LOAD_STREAM(Stream);
+    DWORD dwEntry;
+
+    FLATE_REFILL();
+    Block.bFinalBlock = (BitBuffer & 1) ? true : false;
+    switch(FLATE_BITS(3) >> 1)
+    {
+        case 0:     // Stored block
+        {
+            FLATE_DROP(3);
+            FLATE_ALIGN_INPUT();
+
+            // The length and its one's complement
+            if((pbInputEnd - pbInput) < 4)
+                return ERROR_FILE_CORRUPT;
+            Block.dwStoredLength = pbInput[0] | (pbInput[1] << 8);
+            if((Block.dwStoredLength ^ 0xFFFF) != (DWORD)(pbInput[2] | (pbInput[3] << 8)))
+                return ERROR_FILE_CORRUPT;
+            pbInput += 4;
+
+            // The data are copied as they are
+            if((size_t)(pbInputEnd - pbInput) < Block.dwStoredLength)
+                return ERROR_FILE_CORRUPT;
+            Block.pLitLen = Block.pDist = NULL;
+            Block.pbStored = pbInput;
+            pbInput += Block.dwStoredLength;
+            break;
+        }
+
+        case 1:     // Fixed Huffman codes
+        {
+            FLATE_DROP(3);
+            Block.pLitLen = FixedTables.LitLen;
+            Block.pDist = FixedTables.Dist;
+            break;
+        }
+
+        case 2:     // Dynamic Huffman codes
+        {
+            BYTE Lengths[FLATE_NUM_LITLEN + FLATE_NUM_DIST];
+            DWORD dwLitLens;
+            DWORD dwDists;
+            DWORD dwCodeLens;
+            DWORD dwIndex = 0;
+
+            // The numbers of codes. The refill has left enough bits for them
+            FLATE_DROP(3);
+            dwLitLens = FLATE_BITS(5) + 257;
+            dwDists = ((DWORD)(BitBuffer >> 5) & 0x1F) + 1;
+            dwCodeLens = ((DWORD)(BitBuffer >> 10) & 0x0F) + 4;
+            FLATE_DROP(14);
+            if(dwLitLens > 286 || dwDists > 30)
+                return ERROR_FILE_CORRUPT;
+
+            // The code for the code lengths
+            memset(Lengths, 0, FLATE_NUM_CODELEN);
+            for(DWORD i = 0; i < dwCodeLens; i++)
+            {
+                if(BitCount < 3)
+                    FLATE_REFILL();
+                Lengths[CodeLenOrder[i]] = (BYTE)FLATE_BITS(3);
+                FLATE_DROP(3);
+            }
+            if(!BuildTable(Tables.CodeLen, _countof(Tables.CodeLen), FLATE_CODELEN_BITS, Lengths, FLATE_NUM_CODELEN, FLATE_TABLE_CODELEN))
+                return ERROR_FILE_CORRUPT;
+
+            // The code lengths of the literal/length and distance codes
+            while(dwIndex < dwLitLens + dwDists)
+            {
+                DWORD dwRepeat;
+                BYTE Repeated = 0;
+
+                if(BitCount < FLATE_CODELEN_BITS + 7)
+                    FLATE_REFILL();
+                dwEntry = Tables.CodeLen[FLATE_BITS(FLATE_CODELEN_BITS)];
+                if((dwEntry & FLATE_KIND_MASK) != FLATE_LITERAL)
+                    return ERROR_FILE_CORRUPT;
+                FLATE_DROP(dwEntry & FLATE_BITS_MASK);
+
+                switch(dwEntry >> 8)
+                {
+                    case 16:    // Repeat the previous length 3-6 times
+                        if(dwIndex == 0)
+                            return ERROR_FILE_CORRUPT;
+                        Repeated = Lengths[dwIndex - 1];
+                        dwRepeat = FLATE_BITS(2) + 3;
+                        FLATE_DROP(2);
+                        break;
+
+                    case 17:    // Repeat zero 3-10 times
+                        dwRepeat = FLATE_BITS(3) + 3;
+                        FLATE_DROP(3);
+                        break;
+
+                    case 18:    // Repeat zero 11-138 times
+                        dwRepeat = FLATE_BITS(7) + 11;
+                        FLATE_DROP(7);
+                        break;
+
+                    default:
+                        Lengths[dwIndex++] = (BYTE)(dwEntry >> 8);
+                        continue;
+                }
+
+                if(dwIndex + dwRepeat > dwLitLens + dwDists)
+                    return ERROR_FILE_CORRUPT;
+                memset(Lengths + dwIndex, Repeated, dwRepeat);
+                dwIndex += dwRepeat;
+            }
+
+            // The block must be able to end
+            if(Lengths[256] == 0)
+                return ERROR_FILE_CORRUPT;
+            if(!BuildTable(Tables.LitLen, _countof(Tables.LitLen), FLATE_LITLEN_BITS, Lengths, dwLitLens, FLATE_TABLE_LITLEN))
+                return ERROR_FILE_CORRUPT;
+            if(!BuildTable(Tables.Dist, _countof(Tables.Dist), FLATE_DIST_BITS, Lengths + dwLitLens, dwDists, FLATE_TABLE_DIST))
+                return ERROR_FILE_CORRUPT;
+            PairLiterals(Tables.LitLen);
+            Block.pLitLen = Tables.LitLen;
+            Block.pDist = Tables.Dist;
+            break;
+        }
+
+        default:
+            return ERROR_FILE_CORRUPT;
+    }
+
+    FLATE_SAVE_STREAM(Stream);
+    return ERROR_SUCCESS;
+}
+
+// Decodes the data of one block. The output pointer and the bit stream only move
+// when the whole block has been decoded, so a block that didn't fit can be decoded again
+static DWORD DecodeBlockBytes(FLATE_BITSTREAM & Stream, FLATE_BLOCK & Block, LPBYTE pbOutputStart, LPBYTE & RefOutput, LPBYTE pbOutputEnd)
+{
+    LPBYTE pbOutput = RefOutput;
+    DWORD * pLitLen = Block.pLitLen;
+    DWORD * pDist = Block.pDist;
+    DWORD dwEntry;
+
+    // Stored block
+    if(pLitLen == NULL)
+    {
+        if((size_t)(pbOutputEnd - pbOutput) < Block.dwStoredLength)
+            return ERROR_INSUFFICIENT_BUFFER;
+        memcpy(pbOutput, Block.pbStored, Block.dwStoredLength);
+        RefOutput = pbOutput + Block.dwStoredLength;
+        return ERROR_SUCCESS;
+    }
+
+    // Decode the compressed data of the block. One refill gives enough bits
+    // for a literal/length code, a distance code and their extra bits
+    FLATE_LOAD_STREAM(Stream);
+    for(;;)
+    {
+        LPBYTE pbSource;
+        size_t cbLength;
+        size_t cbDistance;
+
+        if(BitCount < FLATE_SAFE_BITS)
+            FLATE_REFILL();
+        dwEntry = pLitLen[FLATE_BITS(FLATE_LITLEN_BITS)];
+        if((dwEntry & FLATE_KIND_MASK) == FLATE_SUBTABLE)
+        {
+            FLATE_DROP(FLATE_LITLEN_BITS);
+            dwEntry = pLitLen[(dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF)];
+        }
+        FLATE_DROP(dwEntry & FLATE_BITS_MASK);
+
+        // Literals. Both bytes of the entry are stored even for a single literal,
+        // the second one is overwritten by the next data
+        if((dwEntry & (FLATE_KIND_MASK & ~FLATE_LITERAL2)) == FLATE_LITERAL)
+        {
+            if((pbOutputEnd - pbOutput) < 2)
+            {
+                if((dwEntry & FLATE_KIND_MASK) != FLATE_LITERAL || pbOutput >= pbOutputEnd)
+                    return ERROR_INSUFFICIENT_BUFFER;
+                *pbOutput++ = (BYTE)(dwEntry >> 8);
+                continue;
+            }
+            pbOutput[0] = (BYTE)(dwEntry >> 8);
+            pbOutput[1] = (BYTE)(dwEntry >> 16);
+            pbOutput += ((dwEntry & FLATE_KIND_MASK) == FLATE_LITERAL2) ? 2 : 1;
+            continue;
+        }
+        if((dwEntry & FLATE_KIND_MASK) == FLATE_END)
+            break;
+        if((dwEntry & FLATE_KIND_MASK) != FLATE_LENGTH)
+            return ERROR_FILE_CORRUPT;
+
+        // Length of the match
+        cbLength = (dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF);
+        FLATE_DROP((dwEntry >> 8) & 0xFF);
+
+        // Distance of the match
+        dwEntry = pDist[FLATE_BITS(FLATE_DIST_BITS)];
+        if((dwEntry & FLATE_KIND_MASK) == FLATE_SUBTABLE)
+        {
+            FLATE_DROP(FLATE_DIST_BITS);
+            dwEntry = pDist[(dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF)];
+        }
+        if((dwEntry & FLATE_KIND_MASK) != FLATE_LENGTH)
+            return ERROR_FILE_CORRUPT;
+        FLATE_DROP(dwEntry & FLATE_BITS_MASK);
+        cbDistance = (dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF);
+        FLATE_DROP((dwEntry >> 8) & 0xFF);
+
+        // The match is copied from the data decoded so far
+        if(cbDistance > (size_t)(pbOutput - pbOutputStart))
+            return ERROR_FILE_CORRUPT;
+        if(cbLength > (size_t)(pbOutputEnd - pbOutput))
+            return ERROR_INSUFFICIENT_BUFFER;
+        pbSource = pbOutput - cbDistance;
+
+        // Far enough matches are copied by 16 or 8 bytes, if there is space for the overshoot
+        if(cbDistance >= 16 && (size_t)(pbOutputEnd - pbOutput) >= cbLength + 16)
+        {
+            LPBYTE pbCopyEnd = pbOutput + cbLength;
+
+            do
+            {
+                memcpy(pbOutput, pbSource, 16);
+                pbOutput += 16;
+                pbSource += 16;
+            }
+            while(pbOutput < pbCopyEnd);
+            pbOutput = pbCopyEnd;
+        }
+        else if(cbDistance >= 8 && (size_t)(pbOutputEnd - pbOutput) >= cbLength + 8)
+        {
+            LPBYTE pbCopyEnd = pbOutput + cbLength;
+
+            do
+            {
+                memcpy(pbOutput, pbSource, 8);
+                pbOutput += 8;
+                pbSource += 8;
+            }
+            while(pbOutput < pbCopyEnd);
+            pbOutput = pbCopyEnd;
+        }
+        else if(cbDistance == 1)
+        {
+            memset(pbOutput, pbSource[0], cbLength);
+            pbOutput += cbLength;
+        }
+        else
+        {
+            // Near matches repeat a short pattern. Each copy doubles the pattern
+            while(cbLength > 0)
+            {
+                size_t cbChunk = min(cbLength, (size_t)(pbOutput - pbSource));
+
+                memcpy(pbOutput, pbSource, cbChunk);
+                pbOutput += cbChunk;
+                cbLength -= cbChunk;
+            }
+        }
+    }
+
+    FLATE_SAVE_STREAM(Stream);
+    RefOutput = pbOutput;
+    return ERROR_SUCCESS;
+}
+
+// Decodes the data of one block to words. Matches that reach before the begin of the output
+// give markers instead of the data. Same as with bytes, nothing moves if the block doesn't fit
+static DWORD DecodeBlockWords(FLATE_BITSTREAM & Stream, FLATE_BLOCK & Block, LPWORD pOutputStart, LPWORD & RefOutput, LPWORD pOutputEnd, size_t & RefMarkersEnd)
+{
+    LPWORD pOutput = RefOutput;
+    DWORD * pLitLen = Block.pLitLen;
+    DWORD * pDist = Block.pDist;
+    size_t nMarkersEnd = RefMarkersEnd;
+    DWORD dwEntry;
+
+    // Stored block
+    if(pLitLen == NULL)
+    {
+        if((size_t)(pOutputEnd - pOutput) < Block.dwStoredLength)
+            return ERROR_INSUFFICIENT_BUFFER;
+        for(DWORD i = 0; i < Block.dwStoredLength; i++)
+            pOutput[i] = Block.pbStored[i];
+        RefOutput = pOutput + Block.dwStoredLength;
+        return ERROR_SUCCESS;
+    }
+
+    FLATE_LOAD_STREAM(Stream);
+    for(;;)
+    {
+        LPWORD pSource;
+        WORD Value;
+        size_t nPosition;
+        size_t cbLength;
+        size_t cbDistance;
+
+        if(BitCount < FLATE_SAFE_BITS)
+            FLATE_REFILL();
+        dwEntry = pLitLen[FLATE_BITS(FLATE_LITLEN_BITS)];
+        if((dwEntry & FLATE_KIND_MASK) == FLATE_SUBTABLE)
+        {
+            FLATE_DROP(FLATE_LITLEN_BITS);
+            dwEntry = pLitLen[(dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF)];
+        }
+        FLATE_DROP(dwEntry & FLATE_BITS_MASK);
+
+        // Literals. There must be space for two of them
+        if((dwEntry & (FLATE_KIND_MASK & ~FLATE_LITERAL2)) == FLATE_LITERAL)
+        {
+            if((pOutputEnd - pOutput) < 2)
+                return ERROR_INSUFFICIENT_BUFFER;
+            pOutput[0] = (WORD)((dwEntry >> 8) & 0xFF);
+            pOutput[1] = (WORD)((dwEntry >> 16) & 0xFF);
+            pOutput += ((dwEntry & FLATE_KIND_MASK) == FLATE_LITERAL2) ? 2 : 1;
+            continue;
+        }
+        if((dwEntry & FLATE_KIND_MASK) == FLATE_END)
+            break;
+        if((dwEntry & FLATE_KIND_MASK) != FLATE_LENGTH)
+            return ERROR_FILE_CORRUPT;
+
+        // Length of the match
+        cbLength = (dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF);
+        FLATE_DROP((dwEntry >> 8) & 0xFF);
+
+        // Distance of the match
+        dwEntry = pDist[FLATE_BITS(FLATE_DIST_BITS)];
+        if((dwEntry & FLATE_KIND_MASK) == FLATE_SUBTABLE)
+        {
+            FLATE_DROP(FLATE_DIST_BITS);
+            dwEntry = pDist[(dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF)];
+        }
+        if((dwEntry & FLATE_KIND_MASK) != FLATE_LENGTH)
+            return ERROR_FILE_CORRUPT;
+        FLATE_DROP(dwEntry & FLATE_BITS_MASK);
+        cbDistance = (dwEntry >> 16) + FLATE_BITS((dwEntry >> 8) & 0xFF);
+        FLATE_DROP((dwEntry >> 8) & 0xFF);
+
+        // The match may reach up to 32 KB before the begin of the output
+        nPosition = (pOutput - pOutputStart);
+        if(cbDistance > nPosition + FLATE_WINDOW_SIZE)
+            return ERROR_FILE_CORRUPT;
+        if(cbLength > (size_t)(pOutputEnd - pOutput))
+            return ERROR_INSUFFICIENT_BUFFER;
+
+        // Data before the begin of the output become markers
+        while(cbLength > 0 && nPosition < cbDistance)
+        {
+            *pOutput++ = (WORD)(FLATE_MARKER + FLATE_WINDOW_SIZE + nPosition - cbDistance);
+            nMarkersEnd = ++nPosition;
+            cbLength--;
+        }
+
+        // The rest is copied from the output. If the source may have markers, so may the copy
+        if(cbLength == 0)
+            continue;
+        pSource = pOutput - cbDistance;
+        if((size_t)(pSource - pOutputStart) < nMarkersEnd)
+            nMarkersEnd = nPosition + cbLength;
+
+        // Far enough matches are copied by 8 words, if there is space for the overshoot
+        if(cbDistance >= 8 && (size_t)(pOutputEnd - pOutput) >= cbLength + 8)
+        {
+            LPWORD pCopyEnd = pOutput + cbLength;
+
+            do
+            {
+                memcpy(pOutput, pSource, 8 * sizeof(WORD));
+                pOutput += 8;
+                pSource += 8;
+            }
+            while(pOutput < pCopyEnd);
+            pOutput = pCopyEnd;
+        }
+        else if(cbDistance == 1)
+        {
+            for(Value = pSource[0]; cbLength > 0; cbLength--)
+                *pOutput++ = Value;
+        }
+        else
+        {
+            // Near matches repeat a short pattern. Each copy doubles the pattern
+            while(cbLength > 0)
+            {
+                size_t cChunk = min(cbLength, (size_t)(pOutput - pSource));
+
+                memcpy(pOutput, pSource, cChunk * sizeof(WORD));
+                pOutput += cChunk;
+                cbLength -= cChunk;
+            }
+        }
+    }
+
+    FLATE_SAVE_STREAM(Stream);
+    RefOutput = pOutput;
+    RefMarkersEnd = nMarkersEnd;
+    return ERROR_SUCCESS;
+}
+
+// Checks that the next block has a valid type
+static DWORD CheckNextBlock(FLATE_BITSTREAM & Stream)
+{
+    FLATE_LOAD_STREAM(Stream);
+
+    FLATE_REFILL();
+    if((FLATE_BITS(3) >> 1) == 3)
+        return ERROR_FILE_CORRUPT;
+    FLATE_SAVE_STREAM(Stream);
+    return ERROR_SUCCESS;
+}
+
+// Reads the Adler-32 of the decoded data, which follows the last block
+static DWORD ReadAdler32(FLATE_BITSTREAM & Stream, DWORD & RefAdler)
+{
+    FLATE_LOAD_STREAM(Stream);
+
+    FLATE_ALIGN_INPUT();
+    if((pbInputEnd - pbInput) < 4)
+        return ERROR_FILE_CORRUPT;
+    RefAdler = (DWORD)((pbInput[0] << 24) | (pbInput[1] << 16) | (pbInput[2] << 8) | pbInput[3]);
+    return ERROR_SUCCESS;
+}
+
+// zlib counts the lengths in 32-bit integers, so big data go in pieces
+static DWORD GetAdler32(DWORD dwAdler, LPBYTE pbData, size_t cbData)
+{
+    while(cbData > 0)
+    {
+        uInt cbChunk = (uInt)min(cbData, (size_t)0x40000000);
+
+        dwAdler = adler32(dwAdler, pbData, cbChunk);
+        pbData += cbChunk;
+        cbData -= cbChunk;
+    }
+    return dwAdler;
+}
+
+//-----------------------------------------------------------------------------
+// Parallel inflate
+
+// Decodes one block of the chunk. When the buffer is full, it is doubled and the block starts again.
+// After the block, the chunk switches to bytes if the last 32 KB of the words have no markers
+static DWORD DecodeChunkBlock(FLATE_CHUNK & Chunk, FLATE_BLOCK & Block)
+{
+    DWORD dwErrCode = ERROR_INSUFFICIENT_BUFFER;
+
+    while(dwErrCode == ERROR_INSUFFICIENT_BUFFER)
+    {
+        if(Chunk.bWords)
+        {
+            LPWORD pOutputStart = (LPWORD)Chunk.Words.pbData;
+            LPWORD pOutput = pOutputStart + Chunk.cWords;
+
+            dwErrCode = DecodeBlockWords(Chunk.Stream, Block, pOutputStart, pOutput, pOutputStart + Chunk.Words.Size() / sizeof(WORD), Chunk.nMarkersEnd);
+            Chunk.cWords = (pOutput - pOutputStart);
+            if(dwErrCode == ERROR_INSUFFICIENT_BUFFER && (dwErrCode = Chunk.Words.Resize(Chunk.Words.Size() * 2)) == ERROR_SUCCESS)
+                dwErrCode = ERROR_INSUFFICIENT_BUFFER;
+        }
+        else
+        {
+            LPBYTE pbOutput = Chunk.Bytes.pbData + Chunk.cbBytes;
+
+            dwErrCode = DecodeBlockBytes(Chunk.Stream, Block, Chunk.Bytes.pbData, pbOutput, Chunk.Bytes.pbEnd);
+            Chunk.cbBytes = (pbOutput - Chunk.Bytes.pbData);
+            if(dwErrCode == ERROR_INSUFFICIENT_BUFFER && (dwErrCode = Chunk.Bytes.Resize(Chunk.Bytes.Size() * 2)) == ERROR_SUCCESS)
+                dwErrCode = ERROR_INSUFFICIENT_BUFFER;
+        }
+    }
+
+    // The markers are tracked only roughly. If the last 32 KB of the words may have some,
+    // look at them. Only markers have bits above the lowest byte
+    if(dwErrCode == ERROR_SUCCESS && Chunk.bWords && Chunk.cWords >= FLATE_WINDOW_SIZE && Chunk.nMarkersEnd > Chunk.cWords - FLATE_WINDOW_SIZE)
+    {
+        LPWORD pWindow = (LPWORD)Chunk.Words.pbData + Chunk.cWords - FLATE_WINDOW_SIZE;
+        WORD Value = 0;
+
+        for(size_t i = 0; i < FLATE_WINDOW_SIZE; i++)
+            Value |= pWindow[i];
+        if(Value < FLATE_MARKER)
+            Chunk.nMarkersEnd = Chunk.cWords - FLATE_WINDOW_SIZE;
+    }
+
+    // Nothing that follows can refer to the preceding chunk anymore. The last 32 KB
+    // of the words go to the begin of the byte buffer, for the matches that reach back
+    if(dwErrCode == ERROR_SUCCESS && Chunk.bWords && Chunk.cWords >= FLATE_WINDOW_SIZE && Chunk.nMarkersEnd <= Chunk.cWords - FLATE_WINDOW_SIZE)
+    {
+        LPWORD pWindow = (LPWORD)Chunk.Words.pbData + Chunk.cWords - FLATE_WINDOW_SIZE;
+
+        if((dwErrCode = Chunk.Bytes.Resize(FLATE_INITIAL_BYTES)) == ERROR_SUCCESS)
+        {
+            for(size_t i = 0; i < FLATE_WINDOW_SIZE; i++)
+                Chunk.Bytes.pbData[i] = (BYTE)pWindow[i];
+            Chunk.cbBytes = Chunk.cbWindow = FLATE_WINDOW_SIZE;
+            Chunk.bWords = false;
+        }
+    }
+    return dwErrCode;
+}
+
+// Tries whether the chunk can begin at the given position. There must be a block
+// with dynamic Huffman codes, whose data are valid and that is followed by another block
+static DWORD TryChunkStart(FLATE_CHUNK & Chunk, FLATE_TABLES & Tables, ULONGLONG BitPosition)
+{
+    FLATE_BLOCK Block;
+    DWORD dwErrCode;
+
+    SeekBitStream(Chunk.Stream, Chunk.pbDeflate, Chunk.Stream.pbInputEnd, BitPosition);
+    if((dwErrCode = ReadBlockHeader(Chunk.Stream, Tables, Block)) != ERROR_SUCCESS)
+        return dwErrCode;
+    if(Block.pLitLen != Tables.LitLen || Block.bFinalBlock)
+        return ERROR_FILE_CORRUPT;
+
+    // Start over with the words, the previous attempt may have switched to bytes
+    Chunk.cWords = Chunk.cbBytes = Chunk.cbWindow = Chunk.nMarkersEnd = 0;
+    Chunk.bWords = true;
+    if((dwErrCode = DecodeChunkBlock(Chunk, Block)) != ERROR_SUCCESS)
+        return dwErrCode;
+    if((dwErrCode = CheckNextBlock(Chunk.Stream)) != ERROR_SUCCESS)
+        return dwErrCode;
+
+    Chunk.StartBit = BitPosition;
+    return ERROR_SUCCESS;
+}
+
+// Searches the chunk for the first block. Most bit positions are refused by the block header
+static DWORD WINAPI FindChunkStartWorker(LPVOID lpParameter)
+{
+    FLATE_CHUNK * pChunk = (FLATE_CHUNK *)lpParameter;
+    FLATE_TABLES Tables;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    for(ULONGLONG BitPosition = pChunk->StartBit; BitPosition < pChunk->EndBit; BitPosition++)
+    {
+        LPBYTE pbHeader = pChunk->pbDeflate + (size_t)(BitPosition >> 3);
+        DWORD dwHeader = (pbHeader[0] | (pbHeader[1] << 8) | (pbHeader[2] << 16)) >> (DWORD)(BitPosition & 7);
+
+        // Not the final block, dynamic Huffman codes, at most 286 literal/length codes and 30 distance codes
+        if((dwHeader & 0x07) != 0x04 || ((dwHeader >> 3) & 0x1F) > 29 || ((dwHeader >> 8) & 0x1F) > 29)
+            continue;
+
+        if((dwErrCode = TryChunkStart(*pChunk, Tables, BitPosition)) == ERROR_SUCCESS)
+        {
+            pChunk->bFound = true;
+            break;
+        }
+
+        // Without memory, there is no point in searching further
+        if(dwErrCode == ERROR_NOT_ENOUGH_MEMORY)
+            break;
+    }
+
+    pChunk->dwErrCode = (dwErrCode == ERROR_NOT_ENOUGH_MEMORY) ? dwErrCode : ERROR_SUCCESS;
+    return pChunk->dwErrCode;
+}
+
+// Decodes the chunk up to the begin of the next one. The last chunk decodes up to the final block
+static DWORD WINAPI DecodeChunkWorker(LPVOID lpParameter)
+{
+    FLATE_CHUNK * pChunk = (FLATE_CHUNK *)lpParameter;
+    FLATE_TABLES Tables;
+    FLATE_BLOCK Block;
+    ULONGLONG BitPosition;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    while(pChunk->bFound)
+    {
+        // Only the last chunk may have the final block
+        if(pChunk->bFinalBlock)
+        {
+            dwErrCode = (pChunk->bLastChunk) ? ReadAdler32(pChunk->Stream, pChunk->dwExpected) : ERROR_FILE_CORRUPT;
+            break;
+        }
+
+        // The chunk must end exactly where the next one begins
+        BitPosition = GetBitPosition(pChunk->Stream, pChunk->pbDeflate);
+        if(pChunk->bLastChunk == false && BitPosition >= pChunk->StopBit)
+        {
+            dwErrCode = (BitPosition == pChunk->StopBit) ? ERROR_SUCCESS : ERROR_FILE_CORRUPT;
+            break;
+        }
+
+        if((dwErrCode = ReadBlockHeader(pChunk->Stream, Tables, Block)) != ERROR_SUCCESS)
+            break;
+        if((dwErrCode = DecodeChunkBlock(*pChunk, Block)) != ERROR_SUCCESS)
+            break;
+        pChunk->bFinalBlock = Block.bFinalBlock;
+    }
+
+    pChunk->dwErrCode = dwErrCode;
+    return dwErrCode;
+}
+
+// Copies the bytes of the chunk to the merged output. They don't depend on any other chunk
+static DWORD WINAPI CopyChunkWorker(LPVOID lpParameter)
+{
+    FLATE_CHUNK * pChunk = (FLATE_CHUNK *)lpParameter;
+    size_t cbData = pChunk->cbBytes - pChunk->cbWindow;
+
+    if(pChunk->bFound && pChunk->Bytes.pbData != NULL && cbData != 0)
+    {
+        memcpy(pChunk->pbOutput + pChunk->cWords, pChunk->Bytes.pbData + pChunk->cbWindow, cbData);
+        pChunk->Bytes.FreeData();
+    }
+    return ERROR_SUCCESS;
+}
+
+// Runs the worker on all chunks. The first chunk is processed by this thread,
+// and so is every chunk whose thread can't be created
+static void RunChunkWorkers(LPTHREAD_START_ROUTINE WorkerThread, FLATE_CHUNK * pChunks, DWORD dwChunks)
+{
+    HANDLE hThreads[MAXIMUM_WAIT_OBJECTS];
+
+    for(DWORD i = 1; i < dwChunks; i++)
+    {
+        if((hThreads[i] = CreateThread(NULL, 0, WorkerThread, &pChunks[i], 0, NULL)) == NULL)
+            WorkerThread(&pChunks[i]);
+    }
+    WorkerThread(&pChunks[0]);
+
+    // Wait for all threads to finish
+    for(DWORD i = 1; i < dwChunks; i++)
+    {
+        if(hThreads[i] != NULL)
+        {
+            WaitForSingleObject(hThreads[i], INFINITE);
+            CloseHandle(hThreads[i]);
+        }
+    }
+}
+
+// Replaces the markers in a range of the words with the data they refer to.
+// The 32 KB before the chunk must already be complete in the merged output.
+// Each word is translated by a table that has the literals and the window
+static DWORD ResolveMarkers(FLATE_CHUNK & Chunk, size_t nBegin, size_t nEnd)
+{
+    LPWORD pWords = (LPWORD)Chunk.Words.pbData;
+    LPBYTE pbOutput = Chunk.pbOutput;
+    size_t cbWindow = min(Chunk.nOffset, FLATE_WINDOW_SIZE);
+    BYTE Translate[FLATE_MARKER + FLATE_WINDOW_SIZE];
+
+    for(DWORD i = 0; i < FLATE_MARKER; i++)
+        Translate[i] = (BYTE)i;
+    memcpy(Translate + FLATE_MARKER + FLATE_WINDOW_SIZE - cbWindow, pbOutput - cbWindow, cbWindow);
+
+    // Markers must not refer to anything before the begin of the data
+    if(cbWindow < FLATE_WINDOW_SIZE)
+    {
+        for(size_t i = nBegin; i < nEnd; i++)
+        {
+            if(pWords[i] >= FLATE_MARKER && pWords[i] < FLATE_MARKER + FLATE_WINDOW_SIZE - cbWindow)
+                return ERROR_FILE_CORRUPT;
+        }
+    }
+
+    for(size_t i = nBegin; i < nEnd; i++)
+        pbOutput[i] = Translate[pWords[i]];
+    return ERROR_SUCCESS;
+}
+
+// Resolves the words of the chunk that belong to the last 32 KB of its data.
+// This is what the next chunk refers to, so the chunks must go in order
+static DWORD ResolveWindow(FLATE_CHUNK & Chunk)
+{
+    size_t cbData = Chunk.cbBytes - Chunk.cbWindow;
+
+    Chunk.nResolved = Chunk.cWords;
+    if(cbData < FLATE_WINDOW_SIZE)
+        Chunk.nResolved = Chunk.cWords - min(Chunk.cWords, FLATE_WINDOW_SIZE - cbData);
+    return ResolveMarkers(Chunk, Chunk.nResolved, Chunk.cWords);
+}
+
+// Resolves the rest of the words and calculates the Adler-32 of the chunk's data
+static DWORD WINAPI ResolveChunkWorker(LPVOID lpParameter)
+{
+    FLATE_CHUNK * pChunk = (FLATE_CHUNK *)lpParameter;
+
+    if(pChunk->bFound && (pChunk->dwErrCode = ResolveMarkers(*pChunk, 0, pChunk->nResolved)) == ERROR_SUCCESS)
+    {
+        pChunk->dwAdler = GetAdler32(1, pChunk->pbOutput, pChunk->cWords + pChunk->cbBytes - pChunk->cbWindow);
+        pChunk->Words.FreeData();
+    }
+    return pChunk->dwErrCode;
+}
+
+//-----------------------------------------------------------------------------
+// Public functions
+
+DWORD flate_decode_all(LPBYTE pbInput, LPBYTE pbInputEnd, LPBYTE pbOutput, LPBYTE pbOutputEnd, size_t & cbOutput)
+{
+    FLATE_BITSTREAM Stream;
+    FLATE_TABLES Tables;
+    FLATE_BLOCK Block;
+    LPBYTE pbOutputStart = pbOutput;
+    DWORD dwExpected = 0;
+    DWORD dwErrCode;
+
+    // The zlib header
+    if(!CheckZlibHeader(pbInput, pbInputEnd))
+        return ERROR_FILE_CORRUPT;
+    SeekBitStream(Stream, pbInput + 2, pbInputEnd, 0);
+
+    // Decode all blocks
+    do
+    {
+        if((dwErrCode = ReadBlockHeader(Stream, Tables, Block)) != ERROR_SUCCESS)
+            return dwErrCode;
+        if((dwErrCode = DecodeBlockBytes(Stream, Block, pbOutputStart, pbOutput, pbOutputEnd)) != ERROR_SUCCESS)
+            return dwErrCode;
+    }
+    while(Block.bFinalBlock == false);
+
+    // Verify the Adler-32 of the decoded data
+    if((dwErrCode = ReadAdler32(Stream, dwExpected)) != ERROR_SUCCESS)
+        return dwErrCode;
+    if(GetAdler32(1, pbOutputStart, pbOutput - pbOutputStart) != dwExpected)
+        return ERROR_FILE_CORRUPT;
+
+    cbOutput = (pbOutput - pbOutputStart);
+    return ERROR_SUCCESS;
+}
+
+DWORD flate_decode_parallel(LPBYTE pbInput, LPBYTE pbInputEnd, TPdfBlob & Output, DWORD dwThreads, size_t & cbOutput)
+{
+    std::vector<FLATE_CHUNK> Chunks;
+    LPBYTE pbDeflate = pbInput + 2;
+    size_t cbDeflate = (pbInputEnd > pbDeflate) ? (pbInputEnd - pbDeflate) : 0;
+    size_t cbChunk;
+    size_t cbTotal = 0;
+    DWORD dwChunks = dwThreads;
+    DWORD dwAdler = 1;
+    DWORD dwFound = 0;
+    DWORD dwErrCode = ERROR_SUCCESS;
+
+    // Every thread needs a big enough chunk of the compressed data
+    if(dwChunks > cbDeflate / FLATE_MIN_CHUNK_SIZE)
+        dwChunks = (DWORD)(cbDeflate / FLATE_MIN_CHUNK_SIZE);
+    if(dwChunks > MAXIMUM_WAIT_OBJECTS)
+        dwChunks = MAXIMUM_WAIT_OBJECTS;
+    if(dwChunks < 2)
+        return ERROR_NOT_SUPPORTED;
+    if(!CheckZlibHeader(pbInput, pbInputEnd))
+        return ERROR_FILE_CORRUPT;
+
+    try
+    {
+        // Split the compressed data to chunks. The block headers are searched for
+        // far enough from the end, so that the header and the Adler-32 fit in
+        Chunks.resize(dwChunks);
+        cbChunk = cbDeflate / dwChunks;
+        for(DWORD i = 0; i < dwChunks; i++)
+        {
+            FLATE_CHUNK & Chunk = Chunks[i];
+
+            Chunk.pbDeflate = pbDeflate;
+            Chunk.pbOutput = NULL;
+            Chunk.StartBit = (ULONGLONG)(i * cbChunk) * 8;
+            Chunk.EndBit = (ULONGLONG)min((i + 1) * cbChunk, cbDeflate - 8) * 8;
+            Chunk.StopBit = 0;
+            Chunk.cWords = Chunk.cbBytes = Chunk.cbWindow = Chunk.nMarkersEnd = Chunk.nOffset = Chunk.nResolved = 0;
+            Chunk.dwAdler = 1;
+            Chunk.dwExpected = 0;
+            Chunk.dwErrCode = ERROR_SUCCESS;
+            Chunk.bFound = Chunk.bFinalBlock = Chunk.bLastChunk = false;
+            Chunk.bWords = (i != 0);
+            SeekBitStream(Chunk.Stream, pbDeflate, pbInputEnd, Chunk.StartBit);
+
+            // The first chunk begins with the first block and needs no markers
+            if((dwErrCode = (i != 0) ? Chunk.Words.Resize(FLATE_INITIAL_WORDS) : Chunk.Bytes.Resize(FLATE_INITIAL_BYTES)) != ERROR_SUCCESS)
+                break;
+        }
+
+        // Find the first block of all chunks but the first one
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            Chunks[0].bFound = true;
+            RunChunkWorkers(FindChunkStartWorker, &Chunks[1], dwChunks - 1);
+        }
+
+        // Each chunk ends where the next found one begins. Chunks without any block found are left out.
+        // If they all are, the whole-buffer decoder will do better
+        for(DWORD i = 0; i < dwChunks && dwErrCode == ERROR_SUCCESS; i++)
+        {
+            if(Chunks[i].dwErrCode != ERROR_SUCCESS)
+                dwErrCode = Chunks[i].dwErrCode;
+            if(Chunks[i].bFound)
+            {
+                Chunks[i].bLastChunk = true;
+                for(DWORD j = i + 1; j < dwChunks && Chunks[i].bLastChunk; j++)
+                {
+                    if(Chunks[j].bFound)
+                    {
+                        Chunks[i].StopBit = Chunks[j].StartBit;
+                        Chunks[i].bLastChunk = false;
+                    }
+                }
+                dwFound++;
+            }
+        }
+        if(dwErrCode == ERROR_SUCCESS && dwFound < 2)
+            dwErrCode = ERROR_NOT_SUPPORTED;
+
+        // Decode all chunks
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            RunChunkWorkers(DecodeChunkWorker, &Chunks[0], dwChunks);
+
+            for(DWORD i = 0; i < dwChunks; i++)
+            {
+                if(Chunks[i].dwErrCode != ERROR_SUCCESS)
+                    dwErrCode = Chunks[i].dwErrCode;
+                if(Chunks[i].bFound)
+                {
+                    Chunks[i].nOffset = cbTotal;
+                    cbTotal += Chunks[i].cWords + Chunks[i].cbBytes - Chunks[i].cbWindow;
+                }
+            }
+        }
+
+        // Merge the chunks. The bytes of the first chunk are already in place, the bytes of the other
+        // chunks don't depend on anything, so they are copied in parallel. Then the windows are passed
+        // from chunk to chunk, and the markers are resolved in parallel
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            Output.FreeData();
+            Output.MoveFrom(Chunks[0].Bytes);
+            dwErrCode = Output.Resize(cbTotal);
+        }
+        if(dwErrCode == ERROR_SUCCESS)
+        {
+            for(DWORD i = 0; i < dwChunks; i++)
+                Chunks[i].pbOutput = Output.pbData + Chunks[i].nOffset;
+            RunChunkWorkers(CopyChunkWorker, &Chunks[0], dwChunks);
+
+            for(DWORD i = 0; i < dwChunks && dwErrCode == ERROR_SUCCESS; i++)
+            {
+                if(Chunks[i].bFound)
+                    dwErrCode = ResolveWindow(Chunks[i]);
+            }
+
+            if(dwErrCode == ERROR_SUCCESS)
+                RunChunkWorkers(ResolveChunkWorker, &Chunks[0], dwChunks);
+        }
+
+        // Verify the Adler-32 of the decoded data. zlib's lengths are 32-bit, but only their remainder matters
+        for(DWORD i = 0; i < dwChunks && dwErrCode == ERROR_SUCCESS; i++)
+        {
+            FLATE_CHUNK & Chunk = Chunks[i];
+
+            if(Chunk.dwErrCode != ERROR_SUCCESS)
+                dwErrCode = Chunk.dwErrCode;
+            if(Chunk.bFound && dwErrCode == ERROR_SUCCESS)
+            {
+                dwAdler = adler32_combine(dwAdler, Chunk.dwAdler, (z_off_t)((Chunk.cWords + Chunk.cbBytes - Chunk.cbWindow) % FLATE_ADLER_BASE));
+                if(Chunk.bLastChunk && dwAdler != Chunk.dwExpected)
+                    dwErrCode = ERROR_FILE_CORRUPT;
+            }
+        }
+    }
+    catch(std::bad_alloc)
+    {
+        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // On failure, the other decoders will do the job
+    if(dwErrCode != ERROR_SUCCESS)
+    {
+        Output.FreeData();
+        return dwErrCode;
+    }
+
+    cbOutput = cbTotal;
+    return ERROR_SUCCESS;
+}
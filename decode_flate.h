@@ -0,0 +1,26 @@
+/*****************************************************************************/
+/* decode_flate.h                         Copyright (c) Ladislav Zezula 2024 */
+/*---------------------------------------------------------------------------*/
+/* Whole-buffer decoder for FlateDecode (zlib) data                          */
+/*---------------------------------------------------------------------------*/
+/*   Date    Ver   Who  Comment                                              */
+/* --------  ----  ---  -------                                              */
+/* 17.10.26  1.00  Lad  Created                                              */
+/*****************************************************************************/
+
+#ifndef __DECODE_FLATE_H__
+#define __DECODE_FLATE_H__
+
+// Decodes a complete zlib stream in one go. The whole input must be in memory and the output
+// buffer must be big enough for all the decoded data. Returns ERROR_INSUFFICIENT_BUFFER
+// if the output doesn't fit and ERROR_FILE_CORRUPT for anything that the streaming zlib
+// should decide about (damaged, truncated or unusual data)
+DWORD flate_decode_all(LPBYTE pbInput, LPBYTE pbInputEnd, LPBYTE pbOutput, LPBYTE pbOutputEnd, size_t & cbOutput);
+
+// Experimental: decodes a big zlib stream by more threads. The compressed data are split to chunks,
+// each of them begins at a block found by trying all bit positions. The output gets the exact size
+// of the decoded data. Returns ERROR_NOT_SUPPORTED if the data are too small for the threads
+// or no blocks were found, and ERROR_FILE_CORRUPT if the chunks don't fit together
+DWORD flate_decode_parallel(LPBYTE pbInput, LPBYTE pbInputEnd, TPdfBlob & Output, DWORD dwThreads, size_t & cbOutput);
+
+#endif // __DECODE_FLATE_H__
@@ -11,153 +11,152 @@
 #include "wcx_pdf.h"
 #include "decode_lzw.h"
 
-// Decoding table
-typedef struct
+// Moves the rest of the current sequence to the output
+static void LZWFlushSequence(LZWState & State, LPBYTE & pbOutput, LPBYTE pbOutputEnd)
 {
-    unsigned int length;
-    unsigned int head;
-    unsigned char tail;
-} LZWTable;
+    size_t cbCopy = min((size_t)(State.dwSeqLength - State.dwSeqWritten), (size_t)(pbOutputEnd - pbOutput));
 
-DWORD LZWDecode(TPdfBlob & Output, TPdfBlob & Input, int nEarlyChange)
+    memcpy(pbOutput, State.SequenceBuffer + State.dwSeqWritten, cbCopy);
+    State.dwSeqWritten += (DWORD)cbCopy;
+    pbOutput += cbCopy;
+}
+
+DWORD LZWInit(LZWState & State, int nEarlyChange)
+{
+    LZWTable * pTable = State.pTable;
+
+    // The table of a previous decoding is reused. The entries are always written before being read
+    memset(&State, 0, sizeof(LZWState));
+    State.dwNextCode = 258;
+    State.dwBitCount = 9;
+    State.bFirst = true;
+    State.nEarlyChange = nEarlyChange;
+
+    // Create the decoding table
+    if(pTable == NULL && (pTable = new LZWTable[4097]) == NULL)
+        return ERROR_NOT_ENOUGH_MEMORY;
+    State.pTable = pTable;
+    return ERROR_SUCCESS;
+}
+
+void LZWFree(LZWState & State)
+{
+    delete [] State.pTable;
+    State.pTable = NULL;
+}
+
+// Decodes as much of the input as fits into the output. Returns ERROR_HANDLE_EOF when all data have been decoded
+DWORD LZWDecode(LZWState & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput)
 {
-    LZWTable * pTable;
-    DWORD dwErrCode = ERROR_SUCCESS;
-    DWORD dwInBuffer = 0;                           // Input bit buffer
-    DWORD dwNextCode = 258;                         // Code for next dictionary entry
-    DWORD dwBitCount = 9;                           // Number of bits in a code
-    DWORD dwInpBits = 0;                            // Number of bits in input buffer
-    DWORD dwPrevCode = 0;                           // Previous code used in stream
+    LZWTable * pTable = State.pTable;
     DWORD dwCode;
-    DWORD dwSeqLength = 0;                          // Length of current sequence
-    unsigned char SequenceBuffer[4097];             // Buffer for current sequence
-    unsigned char uchNewChar = 0;                   // Next char to be added to table
-    bool bFirst = true;                             // First code after a table clear
     int i, j;
 
-    // Pre-allocate the output buffer to be of the same size like the input data
-    // This prevents the need to do many reallocations during decompression
-    Output.Resize(Input.Size());
+    // Give the rest of the sequence from the previous call first
+    LZWFlushSequence(State, pbOutput, pbOutputEnd);
 
-    // Create the decoding table
-    if((pTable = new LZWTable[4097]) != NULL)
+    // Decompressing cycle
+    while(State.dwSeqWritten == State.dwSeqLength)
     {
-        // Decompressing cycle
-        while(Input.pbPtr < Input.pbEnd)
+        // The data end with the last complete input byte
+        if(pbInput >= pbInputEnd && State.bInCode == false)
+            return bEndOfInput ? ERROR_HANDLE_EOF : ERROR_SUCCESS;
+        State.bInCode = true;
+
+        // Read bytes from compressed data
+        while(State.dwInpBits < State.dwBitCount)
         {
-            // Read bytes from compressed data
-            while(dwInpBits < dwBitCount)
-            {
-                // Make sure that there is enough bytes in the input buffer
-                if(Input.pbPtr >= Input.pbEnd)
-                {
-                    dwErrCode = ERROR_INVALID_DATA;
-                    goto __LZW_Error;
-                }
-
-                // Add those 8 bits to the accumulator
-                dwInBuffer = (dwInBuffer << 8) | *Input.pbPtr++;
-                dwInpBits += 8;
-            }
+            // Make sure that there is enough bytes in the input buffer
+            if(pbInput >= pbInputEnd)
+                return bEndOfInput ? ERROR_INVALID_DATA : ERROR_SUCCESS;
 
-            // Get the decompression code
-            dwCode = (dwInBuffer >> (dwInpBits - dwBitCount)) & ((1 << dwBitCount) - 1);
-            //Dbg(_T("Code: %u\n"), dwCode);
-            dwInpBits -= dwBitCount;
+            // Add those 8 bits to the accumulator
+            State.dwInBuffer = (State.dwInBuffer << 8) | *pbInput++;
+            State.dwInpBits += 8;
+        }
 
-            // Check for the end of decompression
-            if(dwCode == 257)
-                break;
+        // Get the decompression code
+        dwCode = (State.dwInBuffer >> (State.dwInpBits - State.dwBitCount)) & ((1 << State.dwBitCount) - 1);
+        //Dbg(_T("Code: %u\n"), dwCode);
+        State.dwInpBits -= State.dwBitCount;
+        State.bInCode = false;
 
-            // Check for the end of block
-            if(dwCode == 256)
-            {
-                // Reset the decompression table
-                dwNextCode = 258;
-                dwBitCount = 9;
-                dwSeqLength = 0;
-                bFirst = true;
-                continue;
-            }
+        // Check for the end of decompression
+        if(dwCode == 257)
+            return ERROR_HANDLE_EOF;
 
-            // Check for too big table
-            if(dwNextCode >= 4097)
-            {
-                dwErrCode = ERROR_INVALID_DATA;
-                goto __LZW_Error;
-            }
+        // Check for the end of block
+        if(dwCode == 256)
+        {
+            // Reset the decompression table
+            State.dwNextCode = 258;
+            State.dwBitCount = 9;
+            State.dwSeqLength = 0;
+            State.dwSeqWritten = 0;
+            State.bFirst = true;
+            continue;
+        }
 
-            DWORD dwNextLength = dwSeqLength + 1;
+        // Check for too big table
+        if(State.dwNextCode >= 4097)
+            return ERROR_INVALID_DATA;
 
-            if(dwCode < 256)
-            {
-                SequenceBuffer[0] = (uint8_t)dwCode;
-                dwSeqLength = 1;
-            }
-            else if(dwCode < dwNextCode)
-            {
-                dwSeqLength = pTable[dwCode].length;
-
-                for(i = dwSeqLength - 1, j = dwCode; i > 0; --i)
-                {
-                    SequenceBuffer[i] = pTable[j].tail;
-                    j = pTable[j].head;
-                }
-                SequenceBuffer[0] = (uint8_t)j;
-            }
-            else if(dwCode == dwNextCode)
-            {
-                SequenceBuffer[dwSeqLength] = uchNewChar;
-                ++dwSeqLength;
-            }
-            else
-            {
-                dwErrCode = ERROR_INVALID_DATA;
-                goto __LZW_Error;
-            }
+        DWORD dwNextLength = State.dwSeqLength + 1;
 
-            uchNewChar = SequenceBuffer[0];
+        if(dwCode < 256)
+        {
+            State.SequenceBuffer[0] = (uint8_t)dwCode;
+            State.dwSeqLength = 1;
+        }
+        else if(dwCode < State.dwNextCode)
+        {
+            State.dwSeqLength = pTable[dwCode].length;
 
-            if(bFirst)
-                bFirst = false;
-            else
+            for(i = State.dwSeqLength - 1, j = dwCode; i > 0; --i)
             {
-                pTable[dwNextCode].length = dwNextLength;
-                pTable[dwNextCode].head = dwPrevCode;
-                pTable[dwNextCode++].tail = uchNewChar;
-
-                switch(dwNextCode + nEarlyChange)
-                {
-                    case 512:
-                        dwBitCount = 10;
-                        break;
-                    case 1024:
-                        dwBitCount = 11;
-                        break;
-                    case 2048:
-                        dwBitCount = 12;
-                        break;
-                }
+                State.SequenceBuffer[i] = pTable[j].tail;
+                j = pTable[j].head;
             }
-            dwPrevCode = dwCode;
+            State.SequenceBuffer[0] = (uint8_t)j;
+        }
+        else if(dwCode == State.dwNextCode)
+        {
+            State.SequenceBuffer[State.dwSeqLength] = State.uchNewChar;
+            ++State.dwSeqLength;
+        }
+        else
+        {
+            return ERROR_INVALID_DATA;
+        }
 
-            // Append the decompressed sequence to the output buffer
-            if((dwErrCode = Output.AppendBytes(SequenceBuffer, dwSeqLength)) != ERROR_SUCCESS)
+        State.uchNewChar = State.SequenceBuffer[0];
+
+        if(State.bFirst)
+            State.bFirst = false;
+        else
+        {
+            pTable[State.dwNextCode].length = dwNextLength;
+            pTable[State.dwNextCode].head = State.dwPrevCode;
+            pTable[State.dwNextCode++].tail = State.uchNewChar;
+
+            switch(State.dwNextCode + State.nEarlyChange)
             {
-                break;
+                case 512:
+                    State.dwBitCount = 10;
+                    break;
+                case 1024:
+                    State.dwBitCount = 11;
+                    break;
+                case 2048:
+                    State.dwBitCount = 12;
+                    break;
             }
         }
+        State.dwPrevCode = dwCode;
 
-        __LZW_Error:
-        delete [] pTable;
-    }
-    else
-    {
-        dwErrCode = ERROR_NOT_ENOUGH_MEMORY;
+        // Give the decompressed sequence to the output
+        State.dwSeqWritten = 0;
+        LZWFlushSequence(State, pbOutput, pbOutputEnd);
     }
-    
-    // Fix the length of the decoded data
-    if(dwErrCode == ERROR_SUCCESS)
-        Output.pbEnd = Output.pbPtr;
-    return dwErrCode;
+    return ERROR_SUCCESS;
 }
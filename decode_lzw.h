@@ -15,6 +15,34 @@
 #ifndef __DECODE_LZW_H__
 #define __DECODE_LZW_H__
 
-DWORD LZWDecode(TPdfBlob & Output, TPdfBlob & Input, int dwEarlyChange);
+// Decoding table
+typedef struct
+{
+    unsigned int length;
+    unsigned int head;
+    unsigned char tail;
+} LZWTable;
+
+// State of the decoder between two chunks of data
+typedef struct
+{
+    LZWTable * pTable;                              // Decoding table. Must be NULL or a table of a previous LZWInit
+    DWORD dwInBuffer;                               // Input bit buffer
+    DWORD dwNextCode;                               // Code for next dictionary entry
+    DWORD dwBitCount;                               // Number of bits in a code
+    DWORD dwInpBits;                                // Number of bits in input buffer
+    DWORD dwPrevCode;                               // Previous code used in stream
+    DWORD dwSeqLength;                              // Length of current sequence
+    DWORD dwSeqWritten;                             // Bytes of the current sequence already given to the output
+    unsigned char SequenceBuffer[4097];             // Buffer for current sequence
+    unsigned char uchNewChar;                       // Next char to be added to table
+    bool bFirst;                                    // First code after a table clear
+    bool bInCode;                                   // A code is being loaded
+    int nEarlyChange;
+} LZWState;
+
+DWORD LZWInit(LZWState & State, int nEarlyChange);
+DWORD LZWDecode(LZWState & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput);
+void  LZWFree(LZWState & State);
 
 #endif // __DECODE_LZW_H__
@@ -11,64 +11,78 @@
 #include "wcx_pdf.h"
 #include "decode_runlength.h"
 
-DWORD runlength_decode(TPdfBlob & Output, TPdfBlob & Input)
+void runlength_init(RUNLENGTH_STATE & State)
 {
-    DWORD dwErrCode = ERROR_SUCCESS;
+    memset(&State, 0, sizeof(RUNLENGTH_STATE));
+}
 
-    while(Input.pbPtr < Input.pbEnd)
+// Decodes as much of the input as fits into the output. Returns ERROR_HANDLE_EOF when all data have been decoded
+DWORD runlength_decode(RUNLENGTH_STATE & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput)
+{
+    for(;;)
     {
-        unsigned char one_byte = *Input.pbPtr++;
-
-        // Ending char
-        if(one_byte == 0x80)
-            break;
-
         // Sequence copied
-        if(one_byte < 0x80)
+        if(State.copy_length != 0)
         {
-            size_t chunk_length = one_byte + 1;
+            size_t chunk_length = min(State.copy_length, (size_t)(pbInputEnd - pbInput));
 
-            // Do we have enough bytes in the input buffer?
-            if((Input.pbPtr + chunk_length) > Input.pbEnd)
-                chunk_length = (Input.pbEnd - Input.pbPtr);
-            
             // Copy the data directly
-            if((dwErrCode = Output.AppendBytes(Input.pbPtr, chunk_length)) != ERROR_SUCCESS)
-                return dwErrCode;
-            Input.pbPtr += chunk_length;
-            continue;
+            chunk_length = min(chunk_length, (size_t)(pbOutputEnd - pbOutput));
+            memcpy(pbOutput, pbInput, chunk_length);
+            State.copy_length -= chunk_length;
+            pbOutput += chunk_length;
+            pbInput += chunk_length;
+
+            // If there's not enough bytes in the input, the sequence is cut
+            if(State.copy_length != 0 && pbInput >= pbInputEnd && bEndOfInput)
+                State.copy_length = 0;
         }
 
         // Character multiplied
-        if(one_byte > 0x80)
+        if(State.repeat_length != 0 && State.need_repeat_byte == false)
         {
-            size_t chunk_length = 0x101 - one_byte;
+            size_t chunk_length = min(State.repeat_length, (size_t)(pbOutputEnd - pbOutput));
 
-            // Do we have at least 1 more byte there?
-            if(Input.pbPtr >= Input.pbEnd)
-                return ERROR_INVALID_DATA;
-            one_byte = *Input.pbPtr++;
+            // Fill the buffer
+            memset(pbOutput, State.repeat_byte, chunk_length);
+            State.repeat_length -= chunk_length;
+            pbOutput += chunk_length;
+        }
 
-            // Check how many bytes do we have there
-            if((Output.pbPtr + chunk_length) > Output.pbEnd)
-            {
-                // Resize the output buffer
-                if((dwErrCode = Output.Resize((Output.pbPtr - Output.pbData) + chunk_length)) != ERROR_SUCCESS)
-                    return dwErrCode;
-            }
+        // Is the output full, or do we need more input?
+        if(State.copy_length != 0 || (State.repeat_length != 0 && State.need_repeat_byte == false))
+            return ERROR_SUCCESS;
+        if(pbInput >= pbInputEnd)
+        {
+            // The character to repeat must be there
+            if(bEndOfInput)
+                return State.need_repeat_byte ? ERROR_INVALID_DATA : ERROR_HANDLE_EOF;
+            return ERROR_SUCCESS;
+        }
 
-            // Fill the buffer
-            memset(Output.pbPtr, one_byte, chunk_length);
-            Output.pbPtr += chunk_length;
+        unsigned char one_byte = *pbInput++;
+
+        // The character to be repeated
+        if(State.need_repeat_byte)
+        {
+            State.repeat_byte = one_byte;
+            State.need_repeat_byte = false;
             continue;
         }
 
-        break;
-    }
+        // Ending char
+        if(one_byte == 0x80)
+            return ERROR_HANDLE_EOF;
 
-    // Reset the length
-    Output.pbEnd = Output.pbPtr;
-    return dwErrCode;
+        // Length of the sequence or of the repeat
+        if(one_byte < 0x80)
+        {
+            State.copy_length = one_byte + 1;
+        }
+        else
+        {
+            State.repeat_length = 0x101 - one_byte;
+            State.need_repeat_byte = true;
+        }
+    }
 }
-
-
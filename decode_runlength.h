@@ -11,6 +11,16 @@
 #ifndef __DECODE_RUNLENGTH_H__
 #define __DECODE_RUNLENGTH_H__
 
-DWORD runlength_decode(TPdfBlob & Output, TPdfBlob & Input);
+// State of the decoder between two chunks of data
+struct RUNLENGTH_STATE
+{
+    size_t copy_length;                     // Bytes of the sequence that remain to be copied
+    size_t repeat_length;                   // Remaining number of repeats of the character
+    unsigned char repeat_byte;              // The character to be repeated
+    bool need_repeat_byte;                  // The length of the repeat has been loaded, the character not yet
+};
+
+void  runlength_init(RUNLENGTH_STATE & State);
+DWORD runlength_decode(RUNLENGTH_STATE & State, LPBYTE & pbInput, LPBYTE pbInputEnd, LPBYTE & pbOutput, LPBYTE pbOutputEnd, bool bEndOfInput);
 
 #endif // __DECODE_RUNLENGTH_H__
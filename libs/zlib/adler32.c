@@ -6,6 +6,9 @@
 /* @(#) $Id$ */
 
 #include "zutil.h"
+#ifdef ADLER32_SIMD
+#  include "adler32_simd.h"
+#endif
 
 local uLong adler32_combine_ OF((uLong adler1, uLong adler2, z_off64_t len2));
 
@@ -68,6 +71,12 @@ uLong ZEXPORT adler32_z(adler, buf, len)
     unsigned long sum2;
     unsigned n;
 
+#if defined(ADLER32_SIMD) && defined(X86_SIMD_SSSE3)
+    /* longer data are summed with SSSE3 or AVX2, if the CPU has them */
+    if (buf != Z_NULL && len >= ADLER32_SIMD_MIN_LENGTH && x86_cpu_enable_ssse3)
+        return adler32_simd(adler, buf, len);
+#endif
+
     /* split Adler-32 into component sums */
     sum2 = (adler >> 16) & 0xffff;
     adler &= 0xffff;
@@ -0,0 +1,172 @@
+/* adler32_simd.c -- Adler-32 checksum with SSSE3 or AVX2
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/*
+   Both sums are computed over blocks of 32 (SSSE3) or 64 (AVX2) bytes:
+
+     s1 += b[0] + b[1] + ... + b[n-1]
+     s2 += n * s1_before_block + n * b[0] + (n-1) * b[1] + ... + 1 * b[n-1]
+
+   The byte sums come from PSADBW, the weighted sums from PMADDUBSW with the
+   weights n..1 and PMADDWD. The "n * s1_before_block" parts are collected in
+   v_ps and multiplied by the block size at the end. At most NMAX bytes are
+   summed before the modulo, exactly like in the scalar code.
+ */
+
+#include "zutil.h"
+#include "adler32_simd.h"
+
+#ifdef X86_SIMD_SSSE3
+
+#if defined(_MSC_VER)
+#  include <tmmintrin.h>
+#  ifdef X86_SIMD_AVX2
+#    include <immintrin.h>
+#  endif
+#else
+#  include <immintrin.h>
+#endif
+
+#define BASE 65521U     /* largest prime smaller than 65536 */
+#define NMAX 5552
+/* NMAX is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
+
+/* Adds the remaining bytes that don't make a whole block */
+local uLong adler32_simd_tail(unsigned s1, unsigned s2, const Bytef *buf, z_size_t len)
+{
+    while (len--) {
+        s1 += *buf++;
+        s2 += s1;
+    }
+    s1 %= BASE;
+    s2 %= BASE;
+    return s1 | ((uLong)s2 << 16);
+}
+
+TARGET_SSSE3
+local uLong adler32_ssse3(uLong adler, const Bytef *buf, z_size_t len)
+{
+    unsigned s1 = (unsigned)(adler & 0xffff);
+    unsigned s2 = (unsigned)((adler >> 16) & 0xffff);
+    z_size_t blocks = len / 32;
+
+    len -= blocks * 32;
+
+    while (blocks) {
+        const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+        const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i v_ps, v_s1, v_s2;
+        unsigned n = NMAX / 32;
+
+        if (n > blocks)
+            n = (unsigned)blocks;
+        blocks -= n;
+
+        v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+        v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+        v_s1 = _mm_setzero_si128();
+
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *)(buf));
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            buf += 32;
+        } while (--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        /* Horizontal sums of the four lanes */
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v_s1)) % BASE;
+        s2 = (unsigned)_mm_cvtsi128_si32(v_s2) % BASE;
+    }
+
+    return adler32_simd_tail(s1, s2, buf, len);
+}
+
+#ifdef X86_SIMD_AVX2
+
+TARGET_AVX2
+local uLong adler32_avx2(uLong adler, const Bytef *buf, z_size_t len)
+{
+    unsigned s1 = (unsigned)(adler & 0xffff);
+    unsigned s2 = (unsigned)((adler >> 16) & 0xffff);
+    z_size_t blocks = len / 64;
+
+    len -= blocks * 64;
+
+    while (blocks) {
+        const __m256i tap1 = _mm256_setr_epi8(64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49,
+                                              48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33);
+        const __m256i tap2 = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                              16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i v_ps, v_s1, v_s2;
+        __m128i v_sum1, v_sum2;
+        unsigned n = NMAX / 64;
+
+        if (n > blocks)
+            n = (unsigned)blocks;
+        blocks -= n;
+
+        v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+        v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+        v_s1 = _mm256_setzero_si256();
+
+        do {
+            const __m256i bytes1 = _mm256_loadu_si256((const __m256i *)(buf));
+            const __m256i bytes2 = _mm256_loadu_si256((const __m256i *)(buf + 32));
+
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes1, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes2, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes2, tap2), ones));
+            buf += 64;
+        } while (--n);
+
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 6));
+
+        /* Horizontal sums of the eight lanes */
+        v_sum1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+        v_sum2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+        v_sum1 = _mm_add_epi32(v_sum1, _mm_shuffle_epi32(v_sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_sum1 = _mm_add_epi32(v_sum1, _mm_shuffle_epi32(v_sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_shuffle_epi32(v_sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_sum2 = _mm_add_epi32(v_sum2, _mm_shuffle_epi32(v_sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v_sum1)) % BASE;
+        s2 = (unsigned)_mm_cvtsi128_si32(v_sum2) % BASE;
+    }
+
+    /* Avoid the penalty of the dirty upper halves in the following SSE code */
+    _mm256_zeroupper();
+    return adler32_simd_tail(s1, s2, buf, len);
+}
+
+#endif /* X86_SIMD_AVX2 */
+
+uLong ZLIB_INTERNAL adler32_simd(uLong adler, const Bytef *buf, z_size_t len)
+{
+#ifdef X86_SIMD_AVX2
+    if (x86_cpu_enable_avx2)
+        return adler32_avx2(adler, buf, len);
+#endif
+    return adler32_ssse3(adler, buf, len);
+}
+
+#undef BASE
+#undef NMAX
+
+#endif /* X86_SIMD_SSSE3 */
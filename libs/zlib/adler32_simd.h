@@ -0,0 +1,21 @@
+/* adler32_simd.h -- Adler-32 checksum with SSSE3 or AVX2
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef ADLER32_SIMD_H
+#define ADLER32_SIMD_H
+
+#include "cpu_features.h"
+
+#ifdef X86_SIMD_SSSE3
+
+/* Shorter data are left to the scalar code */
+#define ADLER32_SIMD_MIN_LENGTH 64
+
+/* Computes the checksum with the best instruction set of the CPU.
+   Must only be called if x86_cpu_enable_ssse3 is set */
+uLong ZLIB_INTERNAL adler32_simd OF((uLong adler, const Bytef *buf, z_size_t len));
+
+#endif /* X86_SIMD_SSSE3 */
+
+#endif /* ADLER32_SIMD_H */
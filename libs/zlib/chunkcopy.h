@@ -0,0 +1,86 @@
+/* chunkcopy.h -- copying the matches of inflate_fast() in 16 or 32 byte chunks
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef CHUNKCOPY_H
+#define CHUNKCOPY_H
+
+#include "cpu_features.h"
+
+#ifdef X86_SIMD_SSSE3
+
+#if defined(_MSC_VER)
+#  include <emmintrin.h>
+#  ifdef X86_SIMD_AVX2
+#    include <immintrin.h>
+#  endif
+#else
+#  include <immintrin.h>
+#endif
+
+/* The last chunk may write up to this many bytes behind the match */
+#define CHUNKCOPY_SLACK 32
+
+#ifdef X86_SIMD_AVX2
+/* Copies 32 bytes at a time. The source must be at least 32 bytes behind */
+TARGET_AVX2
+local void chunkcopy_avx2(unsigned char FAR *out, const unsigned char FAR *from, unsigned char FAR *limit)
+{
+    do {
+        _mm256_storeu_si256((__m256i *)out, _mm256_loadu_si256((const __m256i *)from));
+        out += 32;
+        from += 32;
+    } while (out < limit);
+    _mm256_zeroupper();
+}
+#endif
+
+/*
+   Copies a match of len bytes from dist bytes back, like the byte loop of
+   inflate_fast(), and returns the end of the match. The source may overlap
+   the destination: a near match repeats its pattern, which is doubled until
+   it is as long as a chunk. The caller must have CHUNKCOPY_SLACK bytes of
+   output space behind the match.
+ */
+local unsigned char FAR *chunkcopy_lapped(unsigned char FAR *out, unsigned dist, unsigned len)
+{
+    const unsigned char FAR *from = out - dist;
+    unsigned char FAR *limit = out + len;
+
+    /* Runs of one byte */
+    if (dist == 1) {
+        memset(out, *from, len);
+        return limit;
+    }
+
+    /* Near matches: the source stays at the start of the pattern,
+       so each copy doubles the distance */
+    while ((unsigned)(out - from) < 16 && out < limit) {
+        unsigned n = (unsigned)(out - from);
+
+        if (n > (unsigned)(limit - out))
+            n = (unsigned)(limit - out);
+        memcpy(out, from, n);
+        out += n;
+    }
+
+#ifdef X86_SIMD_AVX2
+    /* Long far matches go by 32 bytes */
+    if (x86_cpu_enable_avx2 && (unsigned)(out - from) >= 32 && (unsigned)(limit - out) >= 64) {
+        chunkcopy_avx2(out, from, limit);
+        return limit;
+    }
+#endif
+
+    /* The rest goes by 16 bytes */
+    while (out < limit) {
+        _mm_storeu_si128((__m128i *)out, _mm_loadu_si128((const __m128i *)from));
+        out += 16;
+        from += 16;
+    }
+    return limit;
+}
+
+#endif /* X86_SIMD_SSSE3 */
+
+#endif /* CHUNKCOPY_H */
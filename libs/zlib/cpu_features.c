@@ -0,0 +1,75 @@
+/* cpu_features.c -- run-time detection of the SIMD instruction sets
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include "zutil.h"
+#include "cpu_features.h"
+
+#ifdef X86_SIMD_SSSE3
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+int ZLIB_INTERNAL x86_cpu_enable_sse2 = 0;
+int ZLIB_INTERNAL x86_cpu_enable_ssse3 = 0;
+int ZLIB_INTERNAL x86_cpu_enable_avx2 = 0;
+
+local void cpu_cpuid(int leaf, int regs[4])
+{
+#if defined(_MSC_VER) && (_MSC_VER >= 1600)
+    __cpuidex(regs, leaf, 0);
+#elif defined(_MSC_VER)
+    __cpuid(regs, leaf);
+#else
+    unsigned int a, b, c, d;
+
+    __cpuid_count(leaf, 0, a, b, c, d);
+    regs[0] = (int)a;
+    regs[1] = (int)b;
+    regs[2] = (int)c;
+    regs[3] = (int)d;
+#endif
+}
+
+#ifdef X86_SIMD_AVX2
+/* The operating system must save the YMM registers on context switches */
+local int cpu_ymm_enabled(void)
+{
+#if defined(_MSC_VER)
+    return (_xgetbv(0) & 6) == 6;
+#else
+    unsigned int a, d;
+
+    __asm__ __volatile__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+#endif
+}
+#endif
+
+void ZLIB_INTERNAL cpu_check_features(void)
+{
+    int regs[4];
+    int max_leaf;
+
+    cpu_cpuid(0, regs);
+    max_leaf = regs[0];
+
+    if (max_leaf >= 1) {
+        cpu_cpuid(1, regs);
+        x86_cpu_enable_sse2 = (regs[3] & (1 << 26)) != 0;
+        x86_cpu_enable_ssse3 = x86_cpu_enable_sse2 && (regs[2] & (1 << 9)) != 0;
+
+#ifdef X86_SIMD_AVX2
+        /* AVX2 needs OSXSAVE and AVX in leaf 1 and AVX2 in leaf 7 */
+        if (max_leaf >= 7 && (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && cpu_ymm_enabled()) {
+            cpu_cpuid(7, regs);
+            x86_cpu_enable_avx2 = x86_cpu_enable_ssse3 && (regs[1] & (1 << 5)) != 0;
+        }
+#endif
+    }
+}
+
+#endif /* X86_SIMD_SSSE3 */
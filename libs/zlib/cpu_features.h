@@ -0,0 +1,50 @@
+/* cpu_features.h -- run-time detection of the SIMD instruction sets
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/* The SIMD code is compiled for x86 and x64. AVX2 intrinsics need Visual Studio 2012 or newer */
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#  define X86_SIMD_SSSE3
+#  if !defined(_MSC_VER) || (_MSC_VER >= 1700)
+#    define X86_SIMD_AVX2
+#  endif
+#endif
+
+/* GCC and Clang only allow the intrinsics in functions compiled for the instruction set */
+#if defined(__GNUC__)
+#  define TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#  define TARGET_SSSE3
+#  define TARGET_AVX2
+#endif
+
+#ifdef X86_SIMD_SSSE3
+
+/* The plugin reads the flags too, outside of zlib */
+#ifndef ZLIB_INTERNAL
+#  define ZLIB_INTERNAL
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int ZLIB_INTERNAL x86_cpu_enable_sse2;
+extern int ZLIB_INTERNAL x86_cpu_enable_ssse3;
+extern int ZLIB_INTERNAL x86_cpu_enable_avx2;
+
+/* Fills the flags above. Called once when the plugin is loaded, before any other
+   thread can use zlib. Until then, the flags are clear and the scalar code is used */
+void ZLIB_INTERNAL cpu_check_features(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* X86_SIMD_SSSE3 */
+
+#endif /* CPU_FEATURES_H */
@@ -7,6 +7,9 @@
 #include "inftrees.h"
 #include "inflate.h"
 #include "inffast.h"
+#ifdef INFLATE_CHUNK_SIMD
+#  include "chunkcopy.h"
+#endif
 
 #ifdef ASMINF
 #  pragma message("Assembler code may have bugs -- use at your own risk")
@@ -249,6 +252,14 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                     }
                 }
                 else {
+#if defined(INFLATE_CHUNK_SIMD) && defined(X86_SIMD_SSSE3)
+                    /* copy by chunks, if the output has space for the last one */
+                    if (x86_cpu_enable_sse2 &&
+                        (unsigned)(end - out) + 257 >= len + CHUNKCOPY_SLACK) {
+                        out = chunkcopy_lapped(out, dist, len);
+                        continue;
+                    }
+#endif
                     from = out - dist;          /* copy direct from output */
                     do {                        /* minimum length is three */
                         *out++ = *from++;
@@ -14,13 +14,39 @@
 //-----------------------------------------------------------------------------
 // Local variables
 
-#define PDF_BLOCK_SIZE 0x10000
+#define PDF_BLOCK_SIZE 0x100000         // Size of one block decoded and written during extraction
+
+// Writes the extracted data on a worker thread, so that the next block
+// is being decoded while the previous one is written to the disk
+struct TPdfFileWriter
+{
+    HANDLE hFile;                       // The target file
+    HANDLE hThread;                     // Writer thread. NULL = write synchronously
+    HANDLE hWriteStart;                 // Set when there is a block to be written
+    HANDLE hWriteDone;                  // Set when the block has been written
+    LPBYTE pbBlock;                     // The block to be written
+    DWORD cbBlock;                      // Length of the block. Zero stops the thread
+    bool bWriteFailed;
+};
 
 PFN_PROCESS_DATAA PfnProcessDataA;      // Process data procedure (ANSI)
 PFN_PROCESS_DATAW PfnProcessDataW;      // Process data procedure (UNICODE)
 PFN_CHANGE_VOLUMEA PfnChangeVolA;       // Change volume procedure (ANSI)
 PFN_CHANGE_VOLUMEW PfnChangeVolW;       // Change volume procedure (UNICODE)
 
+TPdfOptions g_Options =                 // Plugin options
+{
+    false,                              // bShowRevisions
+    false,                              // bLazyDecode
+    false,                              // bExactSizes
+    false,                              // bParallelInflate
+    0,                                  // dwScanThreads
+    0,                                  // dwDecodeThreads
+    256,                                // dwDecodedCacheSize
+    0,                                  // dwKeepOpenTime
+    L""                                 // szCacheDir
+};
+
 //-----------------------------------------------------------------------------
 // CanYouHandleThisFile(W) allows the plugin to handle files with different
 // extensions than the one defined in Total Commander
@@ -54,16 +80,16 @@ static HANDLE OpenArchiveAW(TOpenArchiveData * pArchiveData, LPCWSTR szArchiveNa
         // Check the valid archive access
         if(pArchiveData->OpenMode == PK_OM_LIST || pArchiveData->OpenMode == PK_OM_EXTRACT)
         {
-            TPdfDatabase * pPdfDb;
+            HANDLE hArchive;
 
             // Set the open result to no memory
             pArchiveData->OpenResult = E_NO_MEMORY;
 
-            // Attempt to open the PDF
-            if((pPdfDb = TPdfDatabase::Open(szArchiveName, false)) != NULL)
+            // Attempt to open the PDF. If the same file is already open, its database is shared
+            if((hArchive = TPdfDatabase::OpenArchive(szArchiveName)) != NULL)
             {
                 pArchiveData->OpenResult = 0;
-                return (HANDLE)(pPdfDb);
+                return hArchive;
             }
         }
     }
@@ -87,18 +113,8 @@ HANDLE WINAPI OpenArchive(TOpenArchiveData * pArchiveData)
 
 int WINAPI CloseArchive(HANDLE hArchive)
 {
-    TPdfDatabase * pPdfDb;
-
-    if((pPdfDb = TPdfDatabase::FromHandle(hArchive)) != NULL)
-    {
-        // Force-close all loaded files
-        pPdfDb->RemoveAllFiles();
-
-        // Release the database twice to make it go away 
-        pPdfDb->Release();
-        pPdfDb->Release();
-    }
-    return (pPdfDb != NULL) ? ERROR_SUCCESS : E_NOT_SUPPORTED;
+    // The database is closed with the last handle, or a while later if it's shared
+    return TPdfDatabase::CloseArchive(hArchive) ? ERROR_SUCCESS : E_NOT_SUPPORTED;
 }
 
 //-----------------------------------------------------------------------------
@@ -156,11 +172,133 @@ static int CallProcessDataProc(LPCWSTR szFullPath, int nSize)
     return TRUE;
 }
 
+static void WriteBlock(TPdfFileWriter & Writer)
+{
+    DWORD dwBytesTransferred = 0;
+
+    if(!WriteFile(Writer.hFile, Writer.pbBlock, Writer.cbBlock, &dwBytesTransferred, NULL) || dwBytesTransferred != Writer.cbBlock)
+        Writer.bWriteFailed = true;
+}
+
+static DWORD WINAPI WriterThread(LPVOID lpParameter)
+{
+    TPdfFileWriter & Writer = *(TPdfFileWriter *)(lpParameter);
+
+    // Write blocks until we get an empty one
+    for(;;)
+    {
+        WaitForSingleObject(Writer.hWriteStart, INFINITE);
+        if(Writer.cbBlock == 0)
+            break;
+
+        WriteBlock(Writer);
+        SetEvent(Writer.hWriteDone);
+    }
+    return 0;
+}
+
+static int WriteDecodedStream(TPdfFilterChain & Chain, HANDLE hFile, LPCWSTR szFullPath, ULONGLONG & RefTotalSize)
+{
+    TPdfFileWriter Writer = {hFile};
+    LPBYTE Blocks[2];
+    DWORD dwIndex = 0;
+    bool bWritePending = false;
+    int nError = 0;
+
+    // Allocate two blocks. One is being decoded while the other is written
+    Blocks[0] = (LPBYTE)HeapAlloc(g_hHeap, 0, PDF_BLOCK_SIZE * 2);
+    Blocks[1] = Blocks[0] + PDF_BLOCK_SIZE;
+    if(Blocks[0] == NULL)
+        return E_NO_MEMORY;
+
+    // Start the writer thread. If that fails, the blocks are written synchronously
+    Writer.hWriteStart = CreateEvent(NULL, FALSE, FALSE, NULL);
+    Writer.hWriteDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if(Writer.hWriteStart != NULL && Writer.hWriteDone != NULL)
+        Writer.hThread = CreateThread(NULL, 0, WriterThread, &Writer, 0, NULL);
+
+    for(;;)
+    {
+        size_t cbRead = 0;
+
+        // Decode the next block
+        if(Chain.Read(Blocks[dwIndex], PDF_BLOCK_SIZE, cbRead) != ERROR_SUCCESS)
+        {
+            nError = E_BAD_DATA;
+            break;
+        }
+
+        // Wait until the previous block is written
+        if(bWritePending)
+        {
+            WaitForSingleObject(Writer.hWriteDone, INFINITE);
+            bWritePending = false;
+        }
+        if(Writer.bWriteFailed)
+        {
+            nError = E_EWRITE;
+            break;
+        }
+
+        // Write the block
+        if(cbRead != 0)
+        {
+            Writer.pbBlock = Blocks[dwIndex];
+            Writer.cbBlock = (DWORD)(cbRead);
+            if(Writer.hThread != NULL)
+            {
+                SetEvent(Writer.hWriteStart);
+                bWritePending = true;
+            }
+            else
+            {
+                WriteBlock(Writer);
+            }
+
+            // The callback gets the number of bytes processed since the last call.
+            // If it returns FALSE, the user has cancelled the operation
+            RefTotalSize += cbRead;
+            if(!CallProcessDataProc(szFullPath, (int)(cbRead)))
+            {
+                nError = E_EABORTED;
+                break;
+            }
+        }
+
+        // Less data than requested means the end of the stream
+        if(cbRead < PDF_BLOCK_SIZE)
+            break;
+        dwIndex ^= 1;
+    }
+
+    // Wait for the last block
+    if(bWritePending)
+        WaitForSingleObject(Writer.hWriteDone, INFINITE);
+    if(Writer.bWriteFailed && nError == 0)
+        nError = E_EWRITE;
+
+    // Stop the writer thread
+    if(Writer.hThread != NULL)
+    {
+        Writer.cbBlock = 0;
+        SetEvent(Writer.hWriteStart);
+        WaitForSingleObject(Writer.hThread, INFINITE);
+        CloseHandle(Writer.hThread);
+    }
+    if(Writer.hWriteDone != NULL)
+        CloseHandle(Writer.hWriteDone);
+    if(Writer.hWriteStart != NULL)
+        CloseHandle(Writer.hWriteStart);
+
+    HeapFree(g_hHeap, 0, Blocks[0]);
+    return nError;
+}
+
 static int ExtractFile(HANDLE hArchive, LPCWSTR szDestPath, LPCWSTR szDestName)
 {
+    TPdfFilterChain Chain;
     TPdfDatabase * pPdfDb;
     TPdfFile * pPdfFile;
-    LPCTSTR szPlainName;
     HANDLE hFile;
     TCHAR szFullPath[MAX_PATH];
     int nError = 0;
@@ -170,43 +308,47 @@ static int ExtractFile(HANDLE hArchive, LPCWSTR szDestPath, LPCWSTR szDestName)
     {
         // Prepare the complete path of the destination file
         MergePath(szFullPath, _countof(szFullPath), szDestPath, szDestName);
-        szPlainName = GetPlainName(szFullPath);
 
-        // Attempt to find the file within thew PDF
+        // Attempt to find the file within thew PDF. The name may contain the revision folder
         // Note that if the user selects "rename file", a completely arbitrary name can be passed here
         // and we are unable to find the file in the PDF.
-        if((pPdfFile = pPdfDb->ReferenceFile(szPlainName)) != NULL)
+        if((pPdfFile = pPdfDb->ReferenceFile(szFullPath)) != NULL)
         {
-            DWORD dwWritten = 0;
-            DWORD dwTotalSize = pPdfFile->FileSize();
-
-            // Write the target file
-            hFile = CreateFile(szFullPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, NULL);
-            if(hFile != INVALID_HANDLE_VALUE)
+            // Open the decoded data. Files that haven't been decoded yet
+            // are decoded block by block while being written
+            if(pPdfDb->OpenFileStream(pPdfFile, Chain) == ERROR_SUCCESS)
             {
-                while(dwWritten < dwTotalSize)
+                ULONGLONG TotalSize = 0;
+
+                // Write the target file
+                hFile = CreateFile(szFullPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, NULL);
+                if(hFile != INVALID_HANDLE_VALUE)
                 {
-                    LPBYTE pbBuffer = pPdfFile->GetData().pbData + dwWritten;
-                    DWORD dwToWrite = ((dwWritten + PDF_BLOCK_SIZE) < dwTotalSize) ? PDF_BLOCK_SIZE : dwTotalSize - dwWritten;
-                    DWORD dwBytedTransferred = 0;
+                    nError = WriteDecodedStream(Chain, hFile, szFullPath, TotalSize);
+                    CloseHandle(hFile);
 
-                    // Write the data to the file
-                    if(!WriteFile(hFile, pbBuffer, dwToWrite, &dwBytedTransferred, NULL))
+                    // Don't leave incomplete files behind
+                    if(nError != 0)
                     {
-                        nError = E_EWRITE;
-                        break;
+                        DeleteFile(szFullPath);
                     }
-
-                    // Increment the number of bytes written to the file
-                    dwWritten += dwToWrite;
-                    CallProcessDataProc(szFullPath, (int)(dwTotalSize));
+                    else
+                    {
+                        pPdfFile->m_FileSize = TotalSize;
+                        pPdfFile->m_bExactSize = true;
+                    }
+                }
+                else
+                {
+                    nError = E_ECREATE;
                 }
 
-                CloseHandle(hFile);
+                // Decoded data, if any, stay in the LRU list of the database
+                Chain.Close();
             }
             else
             {
-                nError = E_ECREATE;
+                nError = E_BAD_DATA;
             }
         }
         else
@@ -239,19 +381,29 @@ static int ExtractFileToMemory(HANDLE hArchive, TExtractedData ** ppOut, LPCWSTR
         // and we are unable to find the file in the PDF.
         if((pPdfFile = pPdfDb->ReferenceFile(szPlainName)) != NULL)
         {
-            // Allocate buffer for the extracted data
-            pExtractedData = (TExtractedData *)LocalAlloc(LPTR, sizeof(TExtractedData) + pPdfFile->FileSize());
-            if(pExtractedData != NULL)
+            // Decode the file, if it hasn't been decoded yet
+            if(pPdfDb->DecodeFile(pPdfFile) == ERROR_SUCCESS)
             {
-                CallProcessDataProc(szPlainName, 0);
-                memcpy(pExtractedData->Data, pPdfFile->GetData().pbData, pPdfFile->FileSize());
-                pExtractedData->Length = pPdfFile->FileSize();
-                CallProcessDataProc(szPlainName, pPdfFile->FileSize());
-                ppOut[0] = pExtractedData;
+                size_t cbFileSize = pPdfFile->GetData().Size();
+
+                // Allocate buffer for the extracted data
+                pExtractedData = (TExtractedData *)LocalAlloc(LPTR, sizeof(TExtractedData) + cbFileSize);
+                if(pExtractedData != NULL)
+                {
+                    CallProcessDataProc(szPlainName, 0);
+                    memcpy(pExtractedData->Data, pPdfFile->GetData().pbData, cbFileSize);
+                    pExtractedData->Length = cbFileSize;
+                    CallProcessDataProc(szPlainName, (int)min(cbFileSize, (size_t)0x7FFFFFFF));
+                    ppOut[0] = pExtractedData;
+                }
+                else
+                {
+                    nError = E_NO_MEMORY;
+                }
             }
             else
             {
-                nError = E_NO_MEMORY;
+                nError = E_BAD_DATA;
             }
         }
         else
@@ -297,6 +449,21 @@ int WINAPI ProcessFile(HANDLE hArchive, PROCESS_FILE_OPERATION nOperation, LPCST
 // Totalcmd calls ReadHeader to find out what files are in the archive.
 // https://www.ghisler.ch/wiki/index.php?title=ReadHeader
 
+// The sizes are 64-bit in the extended headers
+template <typename HDR>
+static void StoreFileSizes(HDR * pHeaderData, ULONGLONG PackSize, ULONGLONG UnpSize)
+{
+    pHeaderData->PackSize = PackSize;
+    pHeaderData->UnpSize = UnpSize;
+}
+
+// The old header only has 32-bit sizes
+static void StoreFileSizes(THeaderData * pHeaderData, ULONGLONG PackSize, ULONGLONG UnpSize)
+{
+    pHeaderData->PackSize = (DWORD)min(PackSize, 0xFFFFFFFF);
+    pHeaderData->UnpSize = (DWORD)min(UnpSize, 0xFFFFFFFF);
+}
+
 template <typename HDR>
 static void StoreFoundFile(struct TPdfFile * pPdfFile, HDR * pHeaderData, const DOS_FTIME & ft)
 {
@@ -310,8 +477,7 @@ static void StoreFoundFile(struct TPdfFile * pPdfFile, HDR * pHeaderData, const
     pHeaderData->FileTime = ft;
 
     // Store the file sizes
-    pHeaderData->PackSize = pPdfFile->PackSize();
-    pHeaderData->UnpSize = pPdfFile->FileSize();
+    StoreFileSizes(pHeaderData, pPdfFile->PackSize(), pPdfFile->FileSize());
 
     // Store file attributes
     pHeaderData->FileAttr = FILE_ATTRIBUTE_ARCHIVE;
@@ -321,14 +487,18 @@ template <typename HDR>
 int ReadHeaderTemplate(HANDLE hArchive, HDR * pHeaderData)
 {
     TPdfDatabase * pPdfDb;
+    TPdfArchive * pArchive;
     TPdfFile * pPdfFile;
     DWORD dwErrCode = E_UNKNOWN_FORMAT;
 
     // Check the proper parameters
     if((pPdfDb = TPdfDatabase::FromHandle(hArchive)) != NULL)
     {
+        // Each archive handle has its own position in the list of files
+        pArchive = static_cast<TPdfArchive *>(hArchive);
+
         // Split the action
-        if((pPdfFile = pPdfDb->OpenNextFile()) != NULL)
+        if((pPdfFile = pPdfDb->OpenNextFile(pArchive->m_nNextFile)) != NULL)
         {
             StoreFoundFile(pPdfFile, pHeaderData, pPdfDb->FileTime());
             dwErrCode = 0;
@@ -455,5 +625,18 @@ void WINAPI ConfigurePacker(HWND hParent, HINSTANCE hDllInstance)
 
 void WINAPI PackSetDefaultParams(TPackDefaultParamStruct * dps)
 {
-    UNREFERENCED_PARAMETER(dps);
+    LPCSTR szIniName = dps->DefaultIniName;
+    char szCacheDir[MAX_PATH];
+
+    // Load the plugin options
+    g_Options.bShowRevisions = GetPrivateProfileIntA("wcx_pdf", "ShowRevisions", g_Options.bShowRevisions, szIniName) ? true : false;
+    g_Options.bLazyDecode = GetPrivateProfileIntA("wcx_pdf", "LazyDecode", g_Options.bLazyDecode, szIniName) ? true : false;
+    g_Options.bExactSizes = GetPrivateProfileIntA("wcx_pdf", "ExactSizes", g_Options.bExactSizes, szIniName) ? true : false;
+    g_Options.bParallelInflate = GetPrivateProfileIntA("wcx_pdf", "ParallelInflate", g_Options.bParallelInflate, szIniName) ? true : false;
+    g_Options.dwScanThreads = GetPrivateProfileIntA("wcx_pdf", "ScanThreads", g_Options.dwScanThreads, szIniName);
+    g_Options.dwDecodeThreads = GetPrivateProfileIntA("wcx_pdf", "DecodeThreads", g_Options.dwDecodeThreads, szIniName);
+    g_Options.dwDecodedCacheSize = GetPrivateProfileIntA("wcx_pdf", "DecodedCacheSize", g_Options.dwDecodedCacheSize, szIniName);
+    g_Options.dwKeepOpenTime = GetPrivateProfileIntA("wcx_pdf", "KeepOpenTime", g_Options.dwKeepOpenTime, szIniName);
+    GetPrivateProfileStringA("wcx_pdf", "CacheDir", "", szCacheDir, _countof(szCacheDir), szIniName);
+    StringCchCopyX(g_Options.szCacheDir, _countof(g_Options.szCacheDir), szCacheDir);
 }
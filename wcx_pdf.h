@@ -17,12 +17,16 @@
 #include <tchar.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <windows.h>
 #include <windowsx.h>
 #include <commctrl.h>
 #include <strsafe.h>
 
 #include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
 
 #include "Utils.h"                              // Utility functions
 #include "TStringConvert.h"                     // String conversions
@@ -203,6 +207,24 @@ typedef struct
 	char  DefaultIniName[MAX_PATH];
 } TPackDefaultParamStruct;
 
+//-----------------------------------------------------------------------------
+// Plugin options, loaded from the [wcx_pdf] section of the plugin INI file
+
+struct TPdfOptions
+{
+    bool bShowRevisions;                        // Show superseded objects of older revisions in "rev-N" folders
+    bool bLazyDecode;                           // Decode streams on extraction instead of on enumeration
+    bool bExactSizes;                           // Lazy mode: Run a counting pass to report exact unpacked sizes
+    bool bParallelInflate;                      // Experimental: Decode big Flate streams by more threads
+    DWORD dwScanThreads;                        // Number of threads scanning files without xref (0 = one per CPU, 1 = no threads)
+    DWORD dwDecodeThreads;                      // Number of threads decoding streams (0 = one per CPU, 1 = no threads)
+    DWORD dwDecodedCacheSize;                   // Megabytes of decoded data kept in memory per archive (0 = no limit)
+    DWORD dwKeepOpenTime;                       // Seconds an archive stays open after it was closed, for the next open (0 = close at once)
+    WCHAR szCacheDir[MAX_PATH];                 // Directory for the catalog cache files (empty = no caching)
+};
+
+extern TPdfOptions g_Options;
+
 //-----------------------------------------------------------------------------
 // Plugin function prototypes
 
@@ -1,12 +1,16 @@
 #define NO_DUMMY_DECL
 #define NO_GZIP
+#define ADLER32_SIMD                    // Adler-32 with SSSE3/AVX2, selected at run time
+#define INFLATE_CHUNK_SIMD              // Matches copied in 16/32-byte chunks, selected at run time
 #pragma warning(disable: 4090)          // '=' : different 'const' qualifiers
 #pragma warning(disable: 4127)          // conditional expression is constant
 #pragma warning(disable: 4131)          // 'adler32' : uses old-style declarator
 #pragma warning(disable: 4242)          // '=' : conversion from 'unsigned int' to 'Bytef', possible loss of data
 #pragma warning(disable: 4244)          // '=' : conversion from 'unsigned int' to 'Bytef', possible loss of data
 
+#include "./libs/zlib/cpu_features.c"
 #include "./libs/zlib/adler32.c"
+#include "./libs/zlib/adler32_simd.c"
 #undef DO1
 #undef DO8
 #include "./libs/zlib/trees.c"